@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/type-system/context.h>
+
+using namespace emel;
+
+// nums of state.range_y() elements, stored as generic reps if state.range_x() is 0
+static type::rep make_array(const benchmark::State &state)
+{
+	std::vector<type::rep> values;
+	for (std::int64_t idx = 0; idx < state.range_y(); ++idx)
+		values.emplace_back(double(idx) + 0.5);
+
+	type::rep arr(std::move(values));
+	if (!state.range_x()) {
+		auto *const ad = arr.get_counted_unchecked()->get<array_data>();
+		ad->set(0, type::rep("generic"));
+		ad->set(0, 0.5);
+	}
+	return arr;
+}
+
+static void Arr_Sum(benchmark::State &state)
+{
+	type::rep arr = make_array(state);
+	auto *const ad = arr.get_counted_unchecked()->get<array_data>();
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(ad->sum());
+
+	state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+static void Arr_Map(benchmark::State &state)
+{
+	type::rep arr = make_array(state);
+	auto *const ad = arr.get_counted_unchecked()->get<array_data>();
+
+	while (state.KeepRunning())
+		ad->map(op_kind::mul, 1.0001);
+
+	state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+static void Arr_Compare(benchmark::State &state)
+{
+	type::rep arr = make_array(state);
+	auto *const ad = arr.get_counted_unchecked()->get<array_data>();
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(ad->compare(op_kind::lt, double(state.range_y() / 2)));
+
+	state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+static void Arr_Fill(benchmark::State &state)
+{
+	type::rep arr = make_array(state);
+	auto *const ad = arr.get_counted_unchecked()->get<array_data>();
+
+	// filling with a generic value keeps the array generic
+	const type::rep value = state.range_x() ? type::rep(1.5) : type::rep("generic");
+	while (state.KeepRunning())
+		ad->fill(value);
+
+	state.SetItemsProcessed(state.iterations() * state.range_y());
+}
+
+static void set_layouts(benchmark::internal::Benchmark *bench) {
+	for (int typed = 0; typed < 2; ++typed)
+		for (int len = 64; len <= 65536; len *= 32)
+			bench->ArgPair(typed, len);
+}
+
+BENCHMARK(Arr_Sum)->Apply(set_layouts);
+BENCHMARK(Arr_Map)->Apply(set_layouts);
+BENCHMARK(Arr_Compare)->Apply(set_layouts);
+BENCHMARK(Arr_Fill)->Apply(set_layouts);
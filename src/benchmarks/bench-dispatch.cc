@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/type-system/context.h>
+#include <emel/type-system/type-builtins.h>
+
+using namespace emel;
+
+// the chain of bit tests of get_type() before type_ops::table
+static const type *type_by_bit_tests(const type::rep &r)
+{
+	if (r.is_local_num())
+		return num::get();
+	else if (r.is_local_int())
+		return int_::get();
+	else if (r.is_none())
+		return none::get();
+	else if (r.is_local_str())
+		return loc_str::get();
+	else if (r.is_bool())
+		return bool_::get();
+	else if (r.is_counted_str())
+		return str::get();
+	else if (r.is_arr())
+		return arr::get();
+	return r.get_counted_unchecked()->get<object_info>()->t;
+}
+
+// nums only if state.range_x() is 0, else nums, ints, bools and nones in turn
+static std::vector<type::rep> make_reps(const benchmark::State &state)
+{
+	std::vector<type::rep> reps;
+	for (std::int64_t idx = 0; idx < 1024; ++idx) {
+		// the order of the kinds isn't predictable by the period
+		switch (state.range_x() ? (idx * 7 + idx / 5) % 4 : 0) {
+			case 0: reps.emplace_back(double(idx) + 0.5); break;
+			case 1: reps.emplace_back(idx); break;
+			case 2: reps.emplace_back(0 == idx % 3); break;
+			default: reps.emplace_back(); break;
+		}
+	}
+	return reps;
+}
+
+template <typename Fn>
+static void run_dispatch(benchmark::State &state, Fn fn)
+{
+	const std::vector<type::rep> reps = make_reps(state);
+
+	while (state.KeepRunning())
+		for (const auto &r : reps)
+			benchmark::DoNotOptimize(fn(r));
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(reps.size()));
+}
+
+static void Dispatch_Virtual_Kind(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->get_kind(); });
+}
+
+static void Dispatch_Table_Kind(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.get_kind(); });
+}
+
+static void Dispatch_Virtual_Bool(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->get_bool(r); });
+}
+
+static void Dispatch_Table_Bool(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.ops().get_bool(r); });
+}
+
+static void Dispatch_Virtual_Int(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->get_int(r); });
+}
+
+static void Dispatch_Table_Int(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.ops().get_int(r); });
+}
+
+static void Dispatch_Virtual_Num(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->get_num(r); });
+}
+
+static void Dispatch_Table_Num(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.ops().get_num(r); });
+}
+
+static void Dispatch_Virtual_Str(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->get_str(r); });
+}
+
+static void Dispatch_Table_Str(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.ops().get_str(r); });
+}
+
+static void Dispatch_Virtual_Size(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return type_by_bit_tests(r)->size(r); });
+}
+
+static void Dispatch_Table_Size(benchmark::State &state) {
+	run_dispatch(state, [](const type::rep &r) { return r.ops().size(r); });
+}
+
+BENCHMARK(Dispatch_Virtual_Kind)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Kind)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Virtual_Bool)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Bool)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Virtual_Int)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Int)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Virtual_Num)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Num)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Virtual_Str)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Str)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Virtual_Size)->Arg(0)->Arg(1);
+BENCHMARK(Dispatch_Table_Size)->Arg(0)->Arg(1);
@@ -0,0 +1,595 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/compiler/peephole.h>
+#include <emel/compiler/reg-translator.h>
+#include <emel/runtime/const-pool.h>
+#include <emel/runtime/inline-cache.h>
+#include <emel/runtime/interp.h>
+#include <emel/runtime/reg-interp.h>
+
+using namespace emel;
+
+// const pool layout shared by all of the scripts below
+enum { c_none, c_zero, c_one, c_count, c_m1, c_m2, c_m3, c_m4, c_str };
+
+static std::vector<value_type> make_const_pool(std::int64_t count)
+{
+	return { empty_value, 0.0, 1.0, double(count), -1.0, -2.0, -3.0, -4.0 };
+}
+
+// for(i = count, acc = 0; i; i = i - 1) acc = acc + i
+static const insn_array for_loop {
+	insn_encode(opcode::push_const, c_zero),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_count),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::brf_false, 10),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::call_op, op_kind::add),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::brb, 10),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::ret, 1)
+};
+
+// i = count; while i > 0: i = i - 1
+static const insn_array while_loop {
+	insn_encode(opcode::push_const, c_count),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::push_const, c_zero),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::gt),
+	insn_encode(opcode::brf_false, 6),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::brb, 8),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::ret, 1)
+};
+
+// for(i = count, acc = 0; i; i = i - 1)
+//     switch i: case -1, -2, -3, -4: acc = acc - 1; default: acc = acc + i
+static const insn_array switch_loop {
+	insn_encode(opcode::push_const, c_count),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::push_const, c_zero),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::brf_false, 32),
+	insn_encode(opcode::push_const, c_m1),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::eq),
+	insn_encode(opcode::brf_true, 14),
+	insn_encode(opcode::push_const, c_m2),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::eq),
+	insn_encode(opcode::brf_true, 10),
+	insn_encode(opcode::push_const, c_m3),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::eq),
+	insn_encode(opcode::brf_true, 6),
+	insn_encode(opcode::push_const, c_m4),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::eq),
+	insn_encode(opcode::brf_true, 2),
+	insn_encode(opcode::brf, 6),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::brf, 5),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::call_op, op_kind::add),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::brb, 32),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::ret, 1)
+};
+
+static const char *mode_name(runtime::dispatch_mode mode)
+{
+	switch (mode) {
+		case runtime::dispatch_mode::switch_: return "switch";
+		case runtime::dispatch_mode::threaded: return "threaded";
+	}
+
+	return "";
+}
+
+static void run_script(benchmark::State &state, const insn_array &insns,
+	std::int64_t insns_per_loop, std::int64_t insns_fixed)
+{
+	const auto mode = static_cast<runtime::dispatch_mode>(state.range_x());
+	const auto count = state.range_y();
+	const auto const_pool = make_const_pool(count);
+	const runtime::code_object code(insns);
+
+	while (state.KeepRunning()) {
+		runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+		interp.set_dispatch_mode(mode);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetLabel(mode_name(mode));
+	state.SetItemsProcessed(state.iterations() * (insns_per_loop * count + insns_fixed));
+}
+
+static void Interp_ForLoop(benchmark::State &state) {
+	run_script(state, for_loop, 11, 8);
+}
+
+static void Interp_WhileLoop(benchmark::State &state) {
+	run_script(state, while_loop, 9, 8);
+}
+
+static void Interp_SwitchLoop(benchmark::State &state) {
+	run_script(state, switch_loop, 28, 8);
+}
+
+// same scripts after superinstruction fusion; items are counted
+// in the original instructions to keep the rates comparable
+static void run_fused_script(benchmark::State &state, const insn_array &insns,
+	std::int64_t insns_per_loop, std::int64_t insns_fixed)
+{
+	const auto mode = static_cast<runtime::dispatch_mode>(state.range_x());
+	const auto count = state.range_y();
+	const auto const_pool = make_const_pool(count);
+	insn_array fused(insns);
+	const auto stats = compiler::peephole::fuse(fused);
+	const runtime::code_object code(fused);
+
+	while (state.KeepRunning()) {
+		runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+		interp.set_dispatch_mode(mode);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetLabel(std::string(mode_name(mode)) + ", fused, " + std::to_string(stats.insns_after)
+		+ "/" + std::to_string(stats.insns_before) + " insns");
+	state.SetItemsProcessed(state.iterations() * (insns_per_loop * count + insns_fixed));
+}
+
+static void Interp_FusedForLoop(benchmark::State &state) {
+	run_fused_script(state, for_loop, 11, 8);
+}
+
+static void Interp_FusedWhileLoop(benchmark::State &state) {
+	run_fused_script(state, while_loop, 9, 8);
+}
+
+static void Interp_FusedSwitchLoop(benchmark::State &state) {
+	run_fused_script(state, switch_loop, 28, 8);
+}
+
+// same scripts on the register tier; items are counted in stack
+// instructions, so the rates are comparable with the stack tier
+static void run_reg_script(benchmark::State &state, const insn_array &insns,
+	std::int64_t insns_per_loop, std::int64_t insns_fixed)
+{
+	const auto count = state.range_x();
+	const auto const_pool = make_const_pool(count);
+	const auto code = compiler::reg_translator::translate(insns, 2);
+
+	while (state.KeepRunning()) {
+		runtime::reg_interp interp(const_pool, *code);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetLabel("register, " + std::to_string(code->insns.size())
+		+ "/" + std::to_string(insns.size()) + " insns");
+	state.SetItemsProcessed(state.iterations() * (insns_per_loop * count + insns_fixed));
+}
+
+static void Interp_RegForLoop(benchmark::State &state) {
+	run_reg_script(state, for_loop, 11, 8);
+}
+
+static void Interp_RegWhileLoop(benchmark::State &state) {
+	run_reg_script(state, while_loop, 9, 8);
+}
+
+static void Interp_RegSwitchLoop(benchmark::State &state) {
+	run_reg_script(state, switch_loop, 28, 8);
+}
+
+// fetch and decode cost of the code walk alone, without any handlers
+static void Interp_FetchDeque(benchmark::State &state)
+{
+	const insn_array insns(switch_loop.begin(), switch_loop.end());
+
+	while (state.KeepRunning()) {
+		std::uint32_t sum = 0;
+		for(auto pc = insns.begin(); pc != insns.end(); ++pc)
+			sum += insn_decode(*pc).second;
+		benchmark::DoNotOptimize(sum);
+	}
+
+	state.SetItemsProcessed(state.iterations() * insns.size());
+}
+
+static void Interp_FetchLinked(benchmark::State &state)
+{
+	const runtime::code_object code(switch_loop);
+
+	while (state.KeepRunning()) {
+		std::uint32_t sum = 0;
+		for(auto *pc = code.begin(); pc != code.end(); ++pc)
+			sum += pc->arg;
+		benchmark::DoNotOptimize(sum);
+	}
+
+	state.SetItemsProcessed(state.iterations() * code.size());
+}
+
+static void Interp_CallFrames(benchmark::State &state)
+{
+	const auto depth = state.range_x();
+	const std::vector<value_type> const_pool { empty_value };
+	const insn_array insns { insn_encode(opcode::ret, 0) };
+	const runtime::code_object code(insns);
+
+	runtime::interp interp(const_pool, code.begin(), code.end(), 0, 1);
+
+	while (state.KeepRunning()) {
+		for(auto i = 0; i < depth; ++i)
+			interp.push_frame(const_pool, code.begin(), code.end(), 4, 8);
+		for(auto i = 0; i < depth; ++i)
+			interp.drop_frame();
+	}
+
+	state.SetItemsProcessed(state.iterations() * depth);
+}
+
+// arithmetic on unboxed operands: inline tag tests against
+// the virtual object operators of the generic path
+static void Arith_FastPath(benchmark::State &state)
+{
+	const bool ints = state.range_x();
+	runtime::object acc = ints ? runtime::object(std::int64_t(1)) : runtime::object(1.0);
+	const runtime::object step = ints ? runtime::object(std::int64_t(3)) : runtime::object(1.5);
+	runtime::object tmp, cond;
+
+	while (state.KeepRunning()) {
+		for(int i = 0; i < 1000; ++i) {
+			runtime::eval_fast_op(op_kind::add, acc, step, tmp);
+			runtime::eval_fast_op(op_kind::sub, tmp, step, acc);
+			runtime::eval_fast_op(op_kind::lt, acc, step, cond);
+		}
+		benchmark::DoNotOptimize(cond);
+	}
+
+	state.SetLabel(ints ? "int" : "num");
+	state.SetItemsProcessed(state.iterations() * 3000);
+}
+
+static void Arith_Generic(benchmark::State &state)
+{
+	const bool ints = state.range_x();
+	runtime::object acc = ints ? runtime::object(std::int64_t(1)) : runtime::object(1.0);
+	const runtime::object step = ints ? runtime::object(std::int64_t(3)) : runtime::object(1.5);
+	runtime::object tmp;
+	bool cond = false;
+
+	while (state.KeepRunning()) {
+		for(int i = 0; i < 1000; ++i) {
+			tmp = acc + step;
+			acc = tmp - step;
+			cond = acc < step;
+		}
+		benchmark::DoNotOptimize(cond);
+	}
+
+	state.SetLabel(ints ? "int" : "num");
+	state.SetItemsProcessed(state.iterations() * 3000);
+}
+
+// for(i = count, acc = 0; i; i = i - 1) acc = acc + this.f
+static const insn_array field_loop {
+	insn_encode(opcode::push_const, c_zero),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_count),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::brf_false, 11),
+	insn_encode(opcode::push_local, 2),
+	insn_encode(opcode::push_field, 0),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::call_op, op_kind::add),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::brb, 11),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::ret, 1)
+};
+
+struct field_interp : runtime::interp
+{
+	using interp::interp;
+	using interp::top_frame;
+};
+
+// field reads through the inline cache by receivers of state.range_x()
+// classes with different layouts, more than four make the site megamorphic
+static void Interp_FieldAccess(benchmark::State &state)
+{
+	const auto nr_classes = state.range_x();
+	const std::int64_t count = 1000;
+	const auto const_pool = make_const_pool(count);
+	const runtime::code_object code(field_loop);
+
+	std::vector<runtime::object> receivers;
+	for(auto i = 0; i < nr_classes; ++i) {
+		memory_ptr<context_info> whois(memory::make_counted<context_info>(
+			context_kind::type, boost::flyweight<std::string>("C" + std::to_string(i))), false);
+		whois->fields_offsets.push_back(offset_t(i));
+		receivers.push_back(runtime::make_instance(whois, i + 1));
+		runtime::get_instance(receivers.back())->fields[i] = type::rep(1.0);
+	}
+
+	field_interp interp(const_pool, code.begin(), code.end(), 3, 2);
+	bool first = true;
+
+	while (state.KeepRunning()) {
+		for(const auto &receiver : receivers) {
+			if(!first)
+				interp.push_frame(const_pool, code.begin(), code.end(), 3, 2);
+			first = false;
+			interp.top_frame->locals[2] = receiver;
+			benchmark::DoNotOptimize(interp.run());
+		}
+	}
+
+	state.SetLabel(std::to_string(nr_classes) + " classes");
+	state.SetItemsProcessed(state.iterations() * nr_classes * count);
+}
+
+// switch with state.range_x() cases on the key of the last case, repeated
+// 1000 times; state.range_y() selects dense numbers, sparse numbers or strings
+static std::vector<value_type> make_switch_pool(std::int64_t nr_cases, std::int64_t keys)
+{
+	std::vector<value_type> pool { empty_value, 1.0, 1000.0 };
+
+	for(std::int64_t k = 0; k < nr_cases; ++k) {
+		switch(keys) {
+			case 0: pool.push_back(double(k)); break;
+			case 1: pool.push_back(k * 7.5 + 0.25); break;
+			default: pool.push_back("case-" + std::to_string(k)); break;
+		}
+	}
+
+	return pool;
+}
+
+static const char *keys_name(std::int64_t keys) {
+	return 0 == keys ? "dense" : 1 == keys ? "sparse" : "strings";
+}
+
+// locals: 0 - counter, 1 - switch value
+static insn_array make_switch_loop(std::uint32_t nr_cases, bool table)
+{
+	insn_array insns {
+		insn_encode(opcode::push_const, 2),
+		insn_encode(opcode::load_local, 0),
+		insn_encode(opcode::push_const, 3 + nr_cases - 1),
+		insn_encode(opcode::load_local, 1)
+	};
+
+	const std::size_t loop_idx = insns.size();
+	insns.push_back(insn_encode(opcode::push_local, 0));
+	const std::size_t exit_idx = insns.size();
+	insns.push_back(insn_encode(opcode::brf_false));
+
+	std::size_t cases_idx;
+
+	if(table) {
+		// the case k is at cases_idx + k, the offsets are from br_table
+		insns.push_back(insn_encode(opcode::push_local, 1));
+		for(std::uint32_t k = 0; k < nr_cases; ++k) {
+			insns.push_back(insn_encode(opcode::push, 2 + k));
+			insns.push_back(insn_encode(opcode::push_const, 3 + k));
+		}
+		insns.push_back(insn_encode(opcode::br_table, nr_cases));
+		insns.push_back(insn_encode(opcode::brf, nr_cases + 1));
+		cases_idx = insns.size();
+	} else {
+		// compare and branch for each case, then the branch to the end
+		cases_idx = insns.size() + 4 * nr_cases + 1;
+		for(std::uint32_t k = 0; k < nr_cases; ++k) {
+			insns.push_back(insn_encode(opcode::push_local, 1));
+			insns.push_back(insn_encode(opcode::push_const, 3 + k));
+			insns.push_back(insn_encode(opcode::call_op, op_kind::eq));
+			insns.push_back(insn_encode(opcode::brf_true,
+				std::uint32_t(cases_idx + k - insns.size())));
+		}
+		insns.push_back(insn_encode(opcode::brf, nr_cases + 1));
+	}
+
+	for(std::uint32_t k = 0; k < nr_cases; ++k)
+		insns.push_back(insn_encode(opcode::brf, nr_cases - k));
+
+	insns.push_back(insn_encode(opcode::push_const, 1));
+	insns.push_back(insn_encode(opcode::push_local, 0));
+	insns.push_back(insn_encode(opcode::call_op, op_kind::sub));
+	insns.push_back(insn_encode(opcode::load_local, 0));
+	insns.push_back(insn_encode(opcode::brb, std::uint32_t(insns.size() - loop_idx)));
+
+	insns[exit_idx] = insn_encode(opcode::brf_false, std::uint32_t(insns.size() - exit_idx));
+	insns.push_back(insn_encode(opcode::push_local, 1));
+	insns.push_back(insn_encode(opcode::ret, 1));
+	return insns;
+}
+
+static void run_switch(benchmark::State &state, bool table)
+{
+	const auto nr_cases = state.range_x();
+	const auto keys = state.range_y();
+	const auto const_pool = make_switch_pool(nr_cases, keys);
+	const runtime::code_object code(make_switch_loop(std::uint32_t(nr_cases), table));
+
+	while (state.KeepRunning()) {
+		runtime::interp interp(const_pool, code.begin(), code.end(), 2, 3);
+		interp.set_dispatch_mode(runtime::dispatch_mode::threaded);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetLabel(keys_name(keys));
+	state.SetItemsProcessed(state.iterations() * 1000);
+}
+
+static void Switch_BrTable(benchmark::State &state) {
+	run_switch(state, true);
+}
+
+static void Switch_CompareChain(benchmark::State &state) {
+	run_switch(state, false);
+}
+
+static void set_switch_cases(benchmark::internal::Benchmark *bench) {
+	for (int keys = 0; keys < 3; ++keys)
+		for (int j = 4; j <= 1024; j *= 4)
+			bench->ArgPair(j, keys);
+}
+
+// native code of the loop, compiled on the first entry
+static void Interp_JitForLoop(benchmark::State &state)
+{
+	const auto count = state.range_x();
+	const auto const_pool = make_const_pool(count);
+	const runtime::code_object code(for_loop);
+
+	while (state.KeepRunning()) {
+		runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+		interp.set_jit_threshold(1);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetItemsProcessed(state.iterations() * count);
+}
+
+// c_str of the string benchmarks, long enough to be counted
+static const std::string long_string = "a string longer than a local rep";
+
+// for(i = count; i; i = i - 1) s = "..."
+static const insn_array string_loop {
+	insn_encode(opcode::push_const, c_count),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::brf_false, 8),
+	insn_encode(opcode::push_const, c_str),
+	insn_encode(opcode::load_local, 1),
+	insn_encode(opcode::push_const, c_one),
+	insn_encode(opcode::push_local, 0),
+	insn_encode(opcode::call_op, op_kind::sub),
+	insn_encode(opcode::load_local, 0),
+	insn_encode(opcode::brb, 8),
+	insn_encode(opcode::push_local, 1),
+	insn_encode(opcode::ret, 1)
+};
+
+static void Interp_StringConsts(benchmark::State &state)
+{
+	const auto count = state.range_x();
+	auto const_pool = make_const_pool(count);
+	const_pool.push_back(long_string);
+	const runtime::code_object code(string_loop);
+
+	while (state.KeepRunning()) {
+		runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+		benchmark::DoNotOptimize(interp.run());
+	}
+
+	state.SetItemsProcessed(state.iterations() * count);
+}
+
+// a constant made on each push, as push_const did before the pool was
+// materialized, against a copy from the pool; range_x() is the length
+static void ConstPool_PerPush(benchmark::State &state)
+{
+	const value_type value = long_string.substr(0, std::size_t(state.range_x()));
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(runtime::make_object(value));
+}
+
+static void ConstPool_Materialized(benchmark::State &state)
+{
+	const std::vector<value_type> const_pool {
+		long_string.substr(0, std::size_t(state.range_x()))
+	};
+	const runtime::materialized_pool pool(const_pool);
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(runtime::object(pool[0]));
+}
+
+static void set_dispatch_modes(benchmark::internal::Benchmark *bench) {
+	for (auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded })
+		for (int j = 100; j <= 100000; j *= 10)
+			bench->ArgPair(static_cast<int>(mode), j);
+}
+
+BENCHMARK(Interp_ForLoop)->Apply(set_dispatch_modes);
+BENCHMARK(Interp_WhileLoop)->Apply(set_dispatch_modes);
+BENCHMARK(Interp_SwitchLoop)->Apply(set_dispatch_modes);
+
+BENCHMARK(Interp_FusedForLoop)->Apply(set_dispatch_modes);
+BENCHMARK(Interp_FusedWhileLoop)->Apply(set_dispatch_modes);
+BENCHMARK(Interp_FusedSwitchLoop)->Apply(set_dispatch_modes);
+
+BENCHMARK(Interp_RegForLoop)->Range(100, 100000);
+BENCHMARK(Interp_RegWhileLoop)->Range(100, 100000);
+BENCHMARK(Interp_RegSwitchLoop)->Range(100, 100000);
+
+BENCHMARK(Interp_JitForLoop)->Range(100, 100000);
+
+BENCHMARK(Interp_StringConsts)->Range(100, 100000);
+BENCHMARK(ConstPool_PerPush)->Arg(4)->Arg(16)->Arg(32);
+BENCHMARK(ConstPool_Materialized)->Arg(4)->Arg(16)->Arg(32);
+
+BENCHMARK(Arith_FastPath)->Arg(0)->Arg(1);
+BENCHMARK(Arith_Generic)->Arg(0)->Arg(1);
+
+BENCHMARK(Switch_BrTable)->Apply(set_switch_cases);
+BENCHMARK(Switch_CompareChain)->Apply(set_switch_cases);
+
+BENCHMARK(Interp_FieldAccess)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+BENCHMARK(Interp_FetchDeque);
+BENCHMARK(Interp_FetchLinked);
+
+BENCHMARK(Interp_CallFrames)->Range(8, 8 << 10);
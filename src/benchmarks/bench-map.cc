@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/type-system/map-data.h>
+
+#include <unordered_map>
+
+using namespace emel;
+
+// keys are scattered, so that probes don't follow the insertion order
+static std::int64_t key_of(std::int64_t idx)
+{
+	return (idx * 0x9e3779b97f4a7c15LL) >> 8;
+}
+
+static type::rep make_filled_map(std::int64_t count)
+{
+	type::rep m = make_map();
+	map_data *const md = get_map(m);
+	for (std::int64_t idx = 0; idx < count; ++idx)
+		md->set(type::rep(long(key_of(idx))), type::rep(double(idx)));
+	return m;
+}
+
+static void Map_Insert(benchmark::State &state)
+{
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(make_filled_map(state.range_x()));
+
+	state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+static void Map_Lookup(benchmark::State &state)
+{
+	const type::rep m = make_filled_map(state.range_x());
+	const map_data *const md = get_map(m);
+	std::int64_t idx = 0;
+
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(md->find(type::rep(long(key_of(idx)))));
+		if (++idx == state.range_x())
+			idx = 0;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+
+static void Map_LookupMissing(benchmark::State &state)
+{
+	const type::rep m = make_filled_map(state.range_x());
+	const map_data *const md = get_map(m);
+	std::int64_t idx = 0;
+
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(md->find(type::rep(long(key_of(idx) + 1))));
+		if (++idx == state.range_x())
+			idx = 0;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+
+static void Std_UnorderedMap_Insert(benchmark::State &state)
+{
+	while (state.KeepRunning()) {
+		std::unordered_map<std::int64_t, double> m;
+		for (std::int64_t idx = 0; idx < state.range_x(); ++idx)
+			m[key_of(idx)] = double(idx);
+		benchmark::DoNotOptimize(m);
+	}
+
+	state.SetItemsProcessed(state.iterations() * state.range_x());
+}
+
+static void Std_UnorderedMap_Lookup(benchmark::State &state)
+{
+	std::unordered_map<std::int64_t, double> m;
+	for (std::int64_t idx = 0; idx < state.range_x(); ++idx)
+		m[key_of(idx)] = double(idx);
+	std::int64_t idx = 0;
+
+	while (state.KeepRunning()) {
+		benchmark::DoNotOptimize(m.find(key_of(idx)));
+		if (++idx == state.range_x())
+			idx = 0;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(Map_Insert)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(Map_Lookup)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(Map_LookupMissing)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(Std_UnorderedMap_Insert)->RangeMultiplier(10)->Range(1000, 10000000);
+BENCHMARK(Std_UnorderedMap_Lookup)->RangeMultiplier(10)->Range(1000, 10000000);
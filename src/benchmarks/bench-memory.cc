@@ -21,6 +21,9 @@
 
 #include <emel/memory/memory.h>
 
+#include <string>
+#include <vector>
+
 using namespace emel;
 
 using allocated_type = void *;
@@ -36,6 +39,7 @@ static const char *source_name(memory::source_type type)
 		case memory::gnu_pool: return "gnu pool";
 		case memory::mt_pool: return "mt pool";
 		case memory::boost_pool: return "boost pool";
+		case memory::slab_pool: return "slab pool";
 		case memory::collectable_gc_pool: return "coll pool";
 		case memory::atomic_gc_pool: return "atomic pool";
 		case memory::uncollectable_gc_pool: return "uncoll pool";
@@ -100,6 +104,92 @@ static void Memory_MakeManyObjects(benchmark::State &state)
 	state.SetBytesProcessed(state.iterations() * state.range_y() * item_size);
 }
 
+static const char *counting_name(int type)
+{
+	switch (type) {
+		case 0: return "biased";
+		case 1: return "shared";
+		case 2: return "contended";
+	}
+
+	return "";
+}
+
+/// Copies of a reference, as of reps on dup, push_local and calls
+static void Memory_CopyRef(benchmark::State &state)
+{
+	static memory::counted_ptr contended(memory::make_counted<allocated_type>(), false);
+	memory::counted_ptr p(memory::make_counted<allocated_type>(), false);
+
+	if(1 == state.range_x())
+		p->share();
+	if(2 == state.range_x()) {
+		contended->share();
+		p = contended;
+	}
+
+	while (state.KeepRunning()) {
+		memory::counted_ptr copy(p);
+		benchmark::DoNotOptimize(copy.get());
+	}
+
+	state.SetLabel(counting_name(int(state.range_x())));
+	state.SetItemsProcessed(state.iterations());
+}
+
+/// Temporaries of a script invocation, freed at its end, with or without a region
+static void Memory_Invocation(benchmark::State &state)
+{
+	using string_type = std::basic_string<char, std::char_traits<char>, rt_allocator<char>>;
+
+	while (state.KeepRunning()) {
+		std::unique_ptr<memory::region> scope;
+		if(state.range_x())
+			scope.reset(new memory::region);
+
+		std::vector<memory::counted_ptr, rt_allocator<memory::counted_ptr>>
+			temps(rt_allocator<memory::counted_ptr>(memory::get_source()));
+
+		for(auto i = 0; i < state.range_y(); ++i)
+			temps.emplace_back(memory::make_counted<string_type>(
+				"a temporary string of the invocation"), false);
+	}
+
+	state.SetLabel(state.range_x() ? "region" : "default pool");
+	state.SetItemsProcessed(state.iterations());
+}
+
+/// Collectable objects, of which range_x percents survive in a ring of references,
+/// with the minor collection pauses of the thread
+static void Memory_MakeCollectable(benchmark::State &state)
+{
+	memory::attach_thread();
+
+	std::vector<memory::counted_ptr> survivors(1024);
+	std::size_t idx = 0;
+	const auto before = memory::get_nursery_stats();
+
+	while (state.KeepRunning()) {
+		memory::counted_ptr p(memory::make_collectable<allocated_type>(), false);
+		if(std::int64_t(idx % 100) < state.range_x())
+			survivors[idx % survivors.size()] = std::move(p);
+		++idx;
+	}
+
+	const auto after = memory::get_nursery_stats();
+	survivors.clear();
+	memory::detach_thread();
+
+	const auto nr_collections = after.nr_collections - before.nr_collections;
+	const auto total_pause = (after.total_pause - before.total_pause).count();
+	state.SetLabel(std::to_string(state.range_x()) + "% survive, "
+		+ std::to_string(nr_collections) + " minor, max "
+		+ std::to_string(after.max_pause.count() / 1000) + " us, mean "
+		+ std::to_string(nr_collections ? total_pause / std::int64_t(nr_collections) / 1000 : 0) + " us");
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * item_size);
+}
+
 static void set_objects_count(benchmark::internal::Benchmark *bench) {
 	for (int i = memory::default_pool; i < memory::last_source_type; ++i)
 		for (int j = 10; j <= 1000000; j *= 10)
@@ -108,6 +198,9 @@ static void set_objects_count(benchmark::internal::Benchmark *bench) {
 
 BENCHMARK(Memory_GetSource);
 
+BENCHMARK(Memory_CopyRef)->DenseRange(0, 2);
+BENCHMARK(Memory_CopyRef)->DenseRange(0, 2)->ThreadRange(2, 32);
+
 BENCHMARK(Memory_MakeOneObject)->DenseRange(memory::default_pool,
 	memory::atomic_uncollectable_gc_pool);
 BENCHMARK(Memory_MakeOneObject)->DenseRange(memory::default_pool,
@@ -115,3 +208,9 @@ BENCHMARK(Memory_MakeOneObject)->DenseRange(memory::default_pool,
 
 BENCHMARK(Memory_MakeManyObjects)->Apply(set_objects_count);
 BENCHMARK(Memory_MakeManyObjects)->Apply(set_objects_count)->ThreadRange(2, 32);
+
+BENCHMARK(Memory_Invocation)->ArgPair(0, 16)->ArgPair(1, 16)->ArgPair(0, 256)->ArgPair(1, 256);
+BENCHMARK(Memory_Invocation)->ArgPair(0, 16)->ArgPair(1, 16)->ThreadRange(2, 32);
+
+BENCHMARK(Memory_MakeCollectable)->Arg(0)->Arg(10)->Arg(50);
+BENCHMARK(Memory_MakeCollectable)->Arg(0)->Arg(10)->ThreadRange(2, 32);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/type-system/context.h>
+#include <emel/type-system/nan-box.h>
+
+using namespace emel;
+
+// nums in the unboxed range of rep if state.range_x() is 0, else every
+// 8th of them is too large for it, as are results of overflows
+static std::vector<double> make_nums(const benchmark::State &state)
+{
+	std::vector<double> nums;
+	for (int idx = 0; idx < 1024; ++idx)
+		nums.push_back(state.range_x() && 0 == idx % 8 ? 1e300 * idx : idx + 0.25);
+	return nums;
+}
+
+static void Encoding_Rep_Box(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	std::vector<type::rep> reps(nums.size());
+
+	while (state.KeepRunning())
+		for (std::size_t idx = 0; idx < nums.size(); ++idx)
+			reps[idx].set(nums[idx]);
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+static void Encoding_NanBox_Box(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	std::vector<nan_box> boxes(nums.size());
+
+	while (state.KeepRunning()) {
+		for (std::size_t idx = 0; idx < nums.size(); ++idx)
+			boxes[idx] = nan_box(nums[idx]);
+		benchmark::DoNotOptimize(boxes.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+static void Encoding_Rep_Unbox(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	const std::vector<type::rep> reps(nums.cbegin(), nums.cend());
+
+	while (state.KeepRunning()) {
+		double sum = 0;
+		for (const auto &r : reps)
+			sum += r.is_local_num() ? r.local_num() : r.ops().get_num(r);
+		benchmark::DoNotOptimize(sum);
+	}
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+static void Encoding_NanBox_Unbox(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	std::vector<nan_box> boxes;
+	for (const double num : nums)
+		boxes.emplace_back(num);
+
+	while (state.KeepRunning()) {
+		double sum = 0;
+		for (const auto &b : boxes)
+			sum += b.as_num();
+		benchmark::DoNotOptimize(sum);
+	}
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+// elementwise sums of two arrays of boxed values, as by the add operator
+static void Encoding_Rep_Add(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	const std::vector<type::rep> lhs(nums.cbegin(), nums.cend()), rhs(nums.crbegin(), nums.crend());
+	std::vector<type::rep> res(nums.size());
+
+	while (state.KeepRunning())
+		for (std::size_t idx = 0; idx < nums.size(); ++idx) {
+			const type::rep &l = lhs[idx], &r = rhs[idx];
+			if (l.is_local_num() && r.is_local_num())
+				res[idx].set(l.local_num() + r.local_num());
+			else
+				res[idx].set(l.ops().get_num(l) + r.ops().get_num(r));
+		}
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+static void Encoding_NanBox_Add(benchmark::State &state)
+{
+	const std::vector<double> nums = make_nums(state);
+	std::vector<nan_box> lhs, rhs, res(nums.size());
+	for (std::size_t idx = 0; idx < nums.size(); ++idx) {
+		lhs.emplace_back(nums[idx]);
+		rhs.emplace_back(nums[nums.size() - idx - 1]);
+	}
+
+	while (state.KeepRunning()) {
+		for (std::size_t idx = 0; idx < nums.size(); ++idx)
+			res[idx] = nan_box(lhs[idx].as_num() + rhs[idx].as_num());
+		benchmark::DoNotOptimize(res.data());
+	}
+
+	state.SetItemsProcessed(state.iterations() * std::int64_t(nums.size()));
+}
+
+BENCHMARK(Encoding_Rep_Box)->Arg(0)->Arg(1);
+BENCHMARK(Encoding_NanBox_Box)->Arg(0)->Arg(1);
+BENCHMARK(Encoding_Rep_Unbox)->Arg(0)->Arg(1);
+BENCHMARK(Encoding_NanBox_Unbox)->Arg(0)->Arg(1);
+BENCHMARK(Encoding_Rep_Add)->Arg(0)->Arg(1);
+BENCHMARK(Encoding_NanBox_Add)->Arg(0)->Arg(1);
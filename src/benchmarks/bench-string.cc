@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the benchmark suite of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <benchmark/benchmark.h>
+
+#include <emel/type-system/context.h>
+#include <emel/type-system/str-kernels.h>
+
+#include <codecvt>
+#include <cstring>
+#include <locale>
+
+using namespace emel;
+
+// char16_t storage, which string_data used before, for comparison
+struct char16_string
+{
+	using converter_type = std::wstring_convert<
+		std::codecvt_utf8_utf16<char16_t>, char16_t>;
+
+	std::u16string u;
+
+	explicit char16_string(const std::string &utf8) {
+		converter_type converter;
+		u = converter.from_bytes(utf8);
+	}
+
+	std::string get_str() const {
+		converter_type converter;
+		return converter.to_bytes(u);
+	}
+
+	std::string at(std::size_t idx) const {
+		converter_type converter;
+		return converter.to_bytes(u.at(idx));
+	}
+};
+
+// text of state.range_y() bytes, ASCII if state.range_x() is 0
+static std::string make_text(const benchmark::State &state)
+{
+	const std::string piece = state.range_x() ? "жаркий день " : "a hot day ";
+	std::string text;
+	while (text.size() < std::size_t(state.range_y()))
+		text += piece;
+	return text;
+}
+
+static void Str_RoundTripUtf8(benchmark::State &state)
+{
+	const std::string text = make_text(state);
+
+	while (state.KeepRunning()) {
+		string_data sd(text.data(), text.size());
+		benchmark::DoNotOptimize(sd.get_str());
+	}
+
+	state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+static void Str_RoundTripChar16(benchmark::State &state)
+{
+	const std::string text = make_text(state);
+
+	while (state.KeepRunning()) {
+		char16_string str(text);
+		benchmark::DoNotOptimize(str.get_str());
+	}
+
+	state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+// indexed access to all of the characters
+static void Str_AtUtf8(benchmark::State &state)
+{
+	const std::string text = make_text(state);
+	string_data sd(text.data(), text.size());
+
+	while (state.KeepRunning())
+		for (std::size_t idx = 0; idx < sd.size(); ++idx)
+			benchmark::DoNotOptimize(sd.at(idx));
+
+	state.SetItemsProcessed(state.iterations() * sd.size());
+}
+
+static void Str_AtChar16(benchmark::State &state)
+{
+	const std::string text = make_text(state);
+	const char16_string str(text);
+
+	while (state.KeepRunning())
+		for (std::size_t idx = 0; idx < str.u.size(); ++idx)
+			benchmark::DoNotOptimize(str.at(idx));
+
+	state.SetItemsProcessed(state.iterations() * str.u.size());
+}
+
+static void set_text_kinds(benchmark::internal::Benchmark *bench) {
+	for (int non_ascii = 0; non_ascii < 2; ++non_ascii)
+		for (int len = 16; len <= 4096; len *= 16)
+			bench->ArgPair(non_ascii, len);
+}
+
+BENCHMARK(Str_RoundTripUtf8)->Apply(set_text_kinds);
+BENCHMARK(Str_RoundTripChar16)->Apply(set_text_kinds);
+
+BENCHMARK(Str_AtUtf8)->Apply(set_text_kinds);
+BENCHMARK(Str_AtChar16)->Apply(set_text_kinds);
+
+// kernels of state.range_x(): 0 for scalar, 1 for the dispatched ones
+static const str_kernels &get_kernels(const benchmark::State &state)
+{
+	return state.range_x() ? str_kernels::get() : str_kernels::scalar();
+}
+
+// two equal buffers of state.range_y() bytes
+static void Str_Equal(benchmark::State &state)
+{
+	const str_kernels &kernels = get_kernels(state);
+	const std::string lhs(std::size_t(state.range_y()), 'a'), rhs = lhs;
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(kernels.mismatch(lhs.data(), rhs.data(), lhs.size()));
+
+	state.SetBytesProcessed(state.iterations() * lhs.size());
+	state.SetLabel(kernels.name);
+}
+
+static void Str_Equal_Memcmp(benchmark::State &state)
+{
+	const std::string lhs(std::size_t(state.range_y()), 'a'), rhs = lhs;
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(std::memcmp(lhs.data(), rhs.data(), lhs.size()));
+
+	state.SetBytesProcessed(state.iterations() * lhs.size());
+}
+
+static void Str_Hash(benchmark::State &state)
+{
+	const str_kernels &kernels = get_kernels(state);
+	const std::string text(std::size_t(state.range_y()), 'a');
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(kernels.hash(text.data(), text.size()));
+
+	state.SetBytesProcessed(state.iterations() * text.size());
+	state.SetLabel(kernels.name);
+}
+
+static void Str_Hash_Std(benchmark::State &state)
+{
+	const std::string text(std::size_t(state.range_y()), 'a');
+	const std::hash<std::string> hasher;
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(hasher(text));
+
+	state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+// the needle is at the end, its first and last bytes are frequent
+static void Str_Find(benchmark::State &state)
+{
+	const str_kernels &kernels = get_kernels(state);
+	std::string hay(std::size_t(state.range_y()), 'a');
+	const std::string needle = "abcda";
+	hay.replace(hay.size() - needle.size(), needle.size(), needle);
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(kernels.find(hay.data(), hay.size(), needle.data(), needle.size()));
+
+	state.SetBytesProcessed(state.iterations() * hay.size());
+	state.SetLabel(kernels.name);
+}
+
+static void Str_Find_Std(benchmark::State &state)
+{
+	std::string hay(std::size_t(state.range_y()), 'a');
+	const std::string needle = "abcda";
+	hay.replace(hay.size() - needle.size(), needle.size(), needle);
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(hay.find(needle));
+
+	state.SetBytesProcessed(state.iterations() * hay.size());
+}
+
+static const int kernel_sizes[] = { 8, 64, 1024, 65536 };
+
+static void set_kernel_sizes(benchmark::internal::Benchmark *bench) {
+	for (int dispatched = 0; dispatched < 2; ++dispatched)
+		for (int len : kernel_sizes)
+			bench->ArgPair(dispatched, len);
+}
+
+// baselines of the standard library, the kernel argument is unused
+static void set_sizes(benchmark::internal::Benchmark *bench) {
+	for (int len : kernel_sizes)
+		bench->ArgPair(0, len);
+}
+
+BENCHMARK(Str_Equal)->Apply(set_kernel_sizes);
+BENCHMARK(Str_Equal_Memcmp)->Apply(set_sizes);
+BENCHMARK(Str_Hash)->Apply(set_kernel_sizes);
+BENCHMARK(Str_Hash_Std)->Apply(set_sizes);
+BENCHMARK(Str_Find)->Apply(set_kernel_sizes);
+BENCHMARK(Str_Find_Std)->Apply(set_sizes);
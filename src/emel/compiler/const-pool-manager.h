@@ -20,6 +20,7 @@
 #pragma once
 
 #include "../opcodes.h"
+#include "../type-system/str-kernels.h"
 
 #include <unordered_map>
 #include <boost/optional.hpp>
@@ -30,7 +31,7 @@ namespace emel { namespace compiler {
 
 class const_pool_manager
 {
-    std::unordered_map<std::string, std::size_t> string_pool;
+    std::unordered_map<std::string, std::size_t, str_hasher, str_equal_to> string_pool;
     std::unordered_map<double, std::size_t> number_pool;
     boost::optional<std::size_t> opt_true, opt_false;
     std::size_t pool_index;
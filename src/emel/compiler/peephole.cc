@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "peephole.h"
+
+namespace emel { namespace compiler {
+
+static bool is_forward_branch(opcode op)
+{
+    return opcode::brf == op || opcode::brf_true == op || opcode::brf_false == op;
+}
+
+static bool is_backward_branch(opcode op)
+{
+    return opcode::brb == op || opcode::brb_true == op || opcode::brb_false == op;
+}
+
+void peephole::profile(const insn_array &insns, std::size_t n, ngram_profile &result)
+{
+    if(!n || insns.size() < n)
+        return;
+
+    std::vector<opcode> ngram(n);
+
+    for(std::size_t i = 0; i + n <= insns.size(); ++i) {
+        for(std::size_t j = 0; j < n; ++j)
+            ngram[j] = insn_decode(insns[i + j]).first;
+        ++result[ngram];
+    }
+}
+
+fusion_stats peephole::fuse(insn_array &insns)
+{
+    const std::size_t size = insns.size();
+    fusion_stats stats;
+    stats.insns_before = stats.insns_after = size;
+
+    std::vector<std::pair<opcode, std::uint32_t>> code;
+    std::vector<bool> targets(size + 1, false);
+    code.reserve(size);
+
+    for(std::size_t i = 0; i < size; ++i) {
+        code.push_back(insn_decode(insns[i]));
+        const auto op = code.back().first;
+        const auto arg = code.back().second;
+
+        // offsets of these are not plain branches, leave the code as is
+        if(opcode::br_table == op || opcode::try_ == op || opcode::end_try == op)
+            return stats;
+
+        if(is_forward_branch(op) && i + arg <= size)
+            targets[i + arg] = true;
+        else if(is_backward_branch(op) && arg <= i)
+            targets[i - arg] = true;
+    }
+
+    auto fusible = [&](std::size_t i, std::size_t len) {
+        if(i + len > size)
+            return false;
+        for(std::size_t j = 1; j < len; ++j)
+            if(targets[i + j])
+                return false;
+        return true;
+    };
+
+    auto fusible_kind = [](std::uint32_t arg) {
+        const auto kind = static_cast<op_kind>(arg);
+        return (kind >= op_kind::not_ && kind <= op_kind::neg)
+            || (kind >= op_kind::or_ && kind <= op_kind::div);
+    };
+
+    insn_array result;
+    std::vector<std::size_t> new_index(size + 1, 0);
+    std::vector<std::size_t> old_index;
+
+    for(std::size_t i = 0; i < size;) {
+        const auto op = code[i].first;
+        const auto arg = code[i].second;
+        new_index[i] = result.size();
+        old_index.push_back(i);
+
+        if(opcode::push_local == op && fusible(i, 3)
+                && opcode::call_op == code[i + 1].first && fusible_kind(code[i + 1].second)
+                && opcode::load_local == code[i + 2].first
+                && arg < (1u << fused_arg::store_operand_bits)
+                && code[i + 2].second < (1u << fused_arg::store_target_bits)) {
+            result.push_back(insn_encode(opcode::call_op_store,
+                fused_arg::make(static_cast<op_kind>(code[i + 1].second), arg, code[i + 2].second)));
+            new_index[i + 1] = new_index[i + 2] = new_index[i];
+            ++stats.call_op_store;
+            i += 3;
+            continue;
+        }
+
+        if((opcode::push_local == op || opcode::push_const == op) && fusible(i, 2)
+                && opcode::call_op == code[i + 1].first && fusible_kind(code[i + 1].second)
+                && arg < (1u << fused_arg::operand_bits)) {
+            const bool local = opcode::push_local == op;
+            result.push_back(insn_encode(local ? opcode::call_op_local : opcode::call_op_const,
+                fused_arg::make(static_cast<op_kind>(code[i + 1].second), arg)));
+            new_index[i + 1] = new_index[i];
+            ++(local ? stats.call_op_local : stats.call_op_const);
+            i += 2;
+            continue;
+        }
+
+        result.push_back(insns[i]);
+        ++i;
+    }
+
+    new_index[size] = result.size();
+
+    // retarget branches to the new positions
+    for(std::size_t pos = 0; pos < result.size(); ++pos) {
+        const auto insn = insn_decode(result[pos]);
+        const std::size_t old_pos = old_index[pos];
+
+        if(is_forward_branch(insn.first) && old_pos + insn.second <= size)
+            result[pos] = insn_encode(insn.first,
+                std::uint32_t(new_index[old_pos + insn.second] - pos));
+        else if(is_backward_branch(insn.first) && insn.second <= old_pos)
+            result[pos] = insn_encode(insn.first,
+                std::uint32_t(pos - new_index[old_pos - insn.second]));
+    }
+
+    stats.insns_after = result.size();
+    insns = std::move(result);
+    return stats;
+}
+
+} // namespace compiler
+
+} // namespace emel
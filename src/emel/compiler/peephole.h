@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../opcodes.h"
+
+#include <map>
+#include <vector>
+
+namespace emel { namespace compiler {
+
+/// Number of occurrences of each opcode sequence
+using ngram_profile = std::map<std::vector<opcode>, std::size_t>;
+
+struct fusion_stats {
+    std::size_t insns_before = 0, insns_after = 0;
+    std::size_t call_op_const = 0, call_op_local = 0, call_op_store = 0;
+};
+
+/// Superinstruction fusion over the code of a single method.
+/// The fused sequences were picked by the n-gram profile of the test
+/// corpus: push_const+call_op, push_local+call_op, and the assignment
+/// push_local+call_op+load_local, which is the hot step of the loops.
+/// Sequences crossing a branch target are left intact,
+/// branch offsets are recomputed for the shrunk code.
+class EMEL_EXPORT peephole
+{
+public:
+    /// Count sequences of @a n opcodes in the code
+    static void profile(const insn_array &insns, std::size_t n, ngram_profile &result);
+
+    /// Rewrite the code in place, returns the number of fused sequences
+    static fusion_stats fuse(insn_array &insns);
+};
+
+} // namespace compiler
+
+} // namespace emel
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "reg-translator.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace emel { namespace compiler {
+
+static constexpr std::uint32_t reg(std::uint32_t idx) {
+    return reg_operand::make(reg_operand::reg, idx);
+}
+
+reg_translator::reg_translator(const insn_array &insns, std::uint32_t nr_locals)
+    : insns(insns), nr_locals(nr_locals)
+    , index_map(insns.size() + 1, 0)
+    , target_depth(insns.size() + 1, -1)
+    , targets(insns.size() + 1, false)
+{
+    result.nr_locals = nr_locals;
+}
+
+boost::optional<reg_code> reg_translator::translate(
+        const insn_array &insns, std::uint32_t nr_locals)
+{
+    reg_translator translator(insns, nr_locals);
+
+    if(!translator.find_targets() || !translator.translate_insns())
+        return boost::none;
+
+    translator.patch_branches();
+    translator.result.nr_regs = nr_locals + translator.max_depth;
+    return std::move(translator.result);
+}
+
+bool reg_translator::find_targets()
+{
+    for(std::size_t i = 0; i < insns.size(); ++i) {
+        const auto insn = insn_decode(insns[i]);
+        std::ptrdiff_t target = -1;
+
+        switch(insn.first) {
+            case opcode::spec:
+            case opcode::pop:
+            case opcode::dup:
+            case opcode::swap:
+            case opcode::ret:
+            case opcode::push:
+            case opcode::push_const:
+            case opcode::call_op:
+                break;
+
+            case opcode::push_local:
+            case opcode::load_local:
+                if(insn.second >= nr_locals)
+                    return false;
+                break;
+
+            case opcode::brf:
+            case opcode::brf_true:
+            case opcode::brf_false:
+                target = i + insn.second;
+                break;
+
+            case opcode::brb:
+            case opcode::brb_true:
+            case opcode::brb_false:
+                target = std::ptrdiff_t(i) - insn.second;
+                break;
+
+            default:
+                // no register form yet
+                return false;
+        }
+
+        if(target >= 0) {
+            if(static_cast<std::size_t>(target) > insns.size())
+                return false;
+            targets[target] = true;
+        }
+    }
+
+    return true;
+}
+
+bool reg_translator::translate_insns()
+{
+    bool reachable = true;
+
+    for(std::size_t i = 0; i < insns.size(); ++i) {
+        if(targets[i]) {
+            // every path must enter the label with canonical temporaries
+            if(reachable)
+                flush();
+            else
+                reset_stack(target_depth[i] < 0 ? stack.size() : target_depth[i]);
+            last_def_valid = false;
+            reachable = true;
+        }
+
+        index_map[i] = result.insns.size();
+        const auto insn = insn_decode(insns[i]);
+        std::uint32_t arg = insn.second;
+
+        switch(insn.first) {
+            case opcode::spec:
+                break;
+
+            case opcode::pop:
+                if(!arg) arg = 1;
+                if(stack.size() < arg)
+                    return false;
+                stack.resize(stack.size() - arg);
+                break;
+
+            case opcode::dup:
+                if(!arg) arg = 1;
+                if(stack.empty())
+                    return false;
+                while(arg--)
+                    push(stack.back());
+                break;
+
+            case opcode::swap: {
+                if(stack.size() < 2)
+                    return false;
+                flush();
+                const auto depth = stack.size();
+                emit(reg_opcode::swap, temp(depth - 1), temp(depth - 2));
+                break;
+            }
+
+            case opcode::ret:
+                if(arg > 0) {
+                    if(stack.empty())
+                        return false;
+                    emit(reg_opcode::ret, pop(), 1);
+                } else
+                    emit(reg_opcode::ret, 0, 0);
+                reachable = false;
+                break;
+
+            case opcode::push:
+                push(reg_operand::make(reg_operand::immediate, arg));
+                break;
+
+            case opcode::push_const:
+                push(reg_operand::make(reg_operand::constant, arg));
+                break;
+
+            case opcode::push_local:
+                push(reg(arg));
+                break;
+
+            case opcode::load_local:
+                if(stack.empty())
+                    return false;
+                store_local(arg);
+                break;
+
+            case opcode::call_op: {
+                const auto kind = static_cast<op_kind>(arg);
+                if(op_kind::not_ == kind || op_kind::neg == kind) {
+                    if(stack.empty())
+                        return false;
+                    const auto operand = pop();
+                    const auto dst = temp(stack.size());
+                    emit(static_cast<reg_opcode>(static_cast<int>(reg_opcode::not_)
+                        + static_cast<int>(kind) - static_cast<int>(op_kind::not_)), dst, operand);
+                    push(dst);
+
+                } else if(kind >= op_kind::or_ && kind <= op_kind::div) {
+                    if(stack.size() < 2)
+                        return false;
+                    const auto lhs = pop();
+                    const auto rhs = pop();
+                    const auto dst = temp(stack.size());
+                    emit(static_cast<reg_opcode>(static_cast<int>(reg_opcode::or_)
+                        + static_cast<int>(kind) - static_cast<int>(op_kind::or_)), dst, lhs, rhs);
+                    push(dst);
+
+                } else
+                    return false;
+
+                last_def_valid = true;
+                break;
+            }
+
+            case opcode::brf:
+                flush();
+                emit_branch(reg_opcode::jmp, 0, i + arg);
+                reachable = false;
+                break;
+
+            case opcode::brb:
+                flush();
+                emit_branch(reg_opcode::jmp, 0, i - arg);
+                reachable = false;
+                break;
+
+            case opcode::brf_true:
+            case opcode::brf_false:
+            case opcode::brb_true:
+            case opcode::brb_false: {
+                if(stack.empty())
+                    return false;
+                const auto cond = pop();
+                flush();
+                const bool forward = opcode::brf_true == insn.first
+                        || opcode::brf_false == insn.first;
+                const bool on_true = opcode::brf_true == insn.first
+                        || opcode::brb_true == insn.first;
+                emit_branch(on_true ? reg_opcode::jt : reg_opcode::jf,
+                            cond, forward ? i + arg : i - arg);
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    index_map[insns.size()] = result.insns.size();
+    return true;
+}
+
+void reg_translator::patch_branches()
+{
+    for(const auto &fixup : fixups) {
+        auto &insn = result.insns[fixup.first];
+        insn.b = static_cast<std::uint32_t>(
+            std::int32_t(index_map[fixup.second]) - std::int32_t(fixup.first));
+    }
+}
+
+std::uint32_t reg_translator::temp(std::size_t depth) const
+{
+    return reg(nr_locals + depth);
+}
+
+bool reg_translator::references(std::uint32_t operand) const
+{
+    return std::find(stack.cbegin(), stack.cend(), operand) != stack.cend();
+}
+
+void reg_translator::push(std::uint32_t operand)
+{
+    stack.push_back(operand);
+    max_depth = std::max(max_depth, stack.size());
+}
+
+std::uint32_t reg_translator::pop()
+{
+    assert(!stack.empty());
+    const auto operand = stack.back();
+    stack.pop_back();
+    return operand;
+}
+
+void reg_translator::flush()
+{
+    // lower slots never refer to the higher temporaries,
+    // so the bottom-up order never clobbers a pending operand
+    for(std::size_t depth = 0; depth < stack.size(); ++depth) {
+        const auto dst = temp(depth);
+        if(stack[depth] != dst) {
+            emit(reg_opcode::move, dst, stack[depth]);
+            stack[depth] = dst;
+        }
+    }
+}
+
+void reg_translator::flush_refs(std::uint32_t operand)
+{
+    for(std::size_t depth = 0; depth < stack.size(); ++depth) {
+        if(stack[depth] == operand) {
+            const auto dst = temp(depth);
+            emit(reg_opcode::move, dst, operand);
+            stack[depth] = dst;
+        }
+    }
+}
+
+void reg_translator::reset_stack(std::size_t depth)
+{
+    stack.clear();
+    for(std::size_t i = 0; i < depth; ++i)
+        push(temp(i));
+}
+
+void reg_translator::emit(reg_opcode op, std::uint32_t a, std::uint32_t b, std::uint32_t c)
+{
+    result.insns.push_back({ op, a, b, c });
+    last_def_valid = false;
+}
+
+void reg_translator::emit_branch(reg_opcode op, std::uint32_t cond, std::size_t target)
+{
+    assert(target <= insns.size());
+    target_depth[target] = stack.size();
+    fixups.emplace_back(result.insns.size(), target);
+    emit(op, cond);
+}
+
+void reg_translator::store_local(std::uint32_t idx)
+{
+    const auto value = pop();
+    const auto local = reg(idx);
+
+    if(value == local)
+        return;
+
+    // write the result of the last instruction straight into the local
+    if(last_def_valid && value == temp(stack.size())
+            && result.insns.back().a == value
+            && !references(value) && !references(local)) {
+        result.insns.back().a = local;
+        last_def_valid = false;
+        return;
+    }
+
+    flush_refs(local);
+    emit(reg_opcode::move, local, value);
+}
+
+} // namespace compiler
+
+} // namespace emel
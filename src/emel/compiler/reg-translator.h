@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../reg-opcodes.h"
+
+#include <boost/optional.hpp>
+
+namespace emel { namespace compiler {
+
+/// Translates the stack code of a method into the register code.
+/// Stack slots become temporary registers placed after the locals;
+/// pushes of locals and constants are folded into the operands
+/// of the consuming instruction, so `a = b + c` is a single add.
+/// Returns none for methods using instructions, which have no
+/// register form yet; such methods stay on the stack tier.
+class EMEL_EXPORT reg_translator
+{
+    const insn_array &insns;
+    const std::uint32_t nr_locals;
+
+    reg_code result;
+    std::vector<std::uint32_t> stack;
+    std::vector<std::size_t> index_map;
+    std::vector<std::pair<std::size_t, std::size_t>> fixups;
+    std::vector<long> target_depth;
+    std::vector<bool> targets;
+    std::size_t max_depth = 0;
+    bool last_def_valid = false;
+
+    reg_translator(const insn_array &insns, std::uint32_t nr_locals);
+
+public:
+    static boost::optional<reg_code> translate(
+            const insn_array &insns, std::uint32_t nr_locals);
+
+private:
+    bool find_targets();
+    bool translate_insns();
+    void patch_branches();
+
+    std::uint32_t temp(std::size_t depth) const;
+    bool references(std::uint32_t operand) const;
+    void push(std::uint32_t operand);
+    std::uint32_t pop();
+    void flush();
+    void flush_refs(std::uint32_t reg);
+    void reset_stack(std::size_t depth);
+    void emit(reg_opcode op, std::uint32_t a, std::uint32_t b = 0, std::uint32_t c = 0);
+    void emit_branch(reg_opcode op, std::uint32_t cond, std::size_t target);
+    void store_local(std::uint32_t idx);
+};
+
+} // namespace compiler
+
+} // namespace emel
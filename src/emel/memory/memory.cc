@@ -18,7 +18,9 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "memory.h"
+#include "slab-resource.h"
 
+#include <boost/container/pmr/global_resource.hpp>
 #include <boost/container/pmr/synchronized_pool_resource.hpp>
 #include <boost/container/pmr/resource_adaptor.hpp>
 
@@ -29,7 +31,10 @@
 #include <gc.h>
 #include <javaxfc.h>
 
+#include <algorithm>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace emel {
 
@@ -60,6 +65,22 @@ private:
 	const memory_kind k;
 };
 
+/// Blocks of mt_allocator are aligned by _M_align, so that the alignment
+/// of counted objects needs no over-allocation as in resource_adaptor
+class mt_memory_resource final : public boost::container::pmr::memory_resource
+{
+protected:
+	virtual void *do_allocate(size_t bytes, size_t alignment) override;
+	virtual void do_deallocate(void *ptr, size_t bytes, size_t alignment) override;
+	virtual bool do_is_equal(const memory::resource_type &other) const noexcept override;
+
+public:
+	mt_memory_resource();
+
+private:
+	mt_allocator<char> alloc;
+};
+
 template <typename Tp>
 using pmr_adaptor = boost::container::pmr::resource_adaptor<Tp>;
 
@@ -70,35 +91,34 @@ static void once_init()
 {
 	static pmr_adaptor<bitmap_allocator<char>> bitmap_pool_instance;
 	static pmr_adaptor<gnu_pool_allocator<char>> gnu_pool_instance;
-	static pmr_adaptor<mt_allocator<char>> mt_pool_instance;
+	static mt_memory_resource mt_pool_instance;
 	static boost::container::pmr::synchronized_pool_resource boost_pool_instance;
+	static slab_memory_resource slab_pool_instance;
 	static gc_memory_resource collectable_gc_instance(gc_memory_resource::collectable);
 	static gc_memory_resource atomic_gc_instance(gc_memory_resource::atomic);
 	static gc_memory_resource uncollectable_gc_instance(gc_memory_resource::uncollectable);
 	static gc_memory_resource atomic_uncollectable_gc_instance(gc_memory_resource::atomic_uncollectable);
 
-	auto opt = mt_pool_instance.get_allocator()._M_get_options();
-	opt._M_align = 16; // FIXME 8-byte ptr alignment
-	opt._M_chunk_size = 65536 - 4 * sizeof(void *);
-	opt._M_max_bytes = opt._M_chunk_size;
-	mt_pool_instance.get_allocator()._M_set_options(opt);
-
 	GC_set_all_interior_pointers(true);
 	GC_set_java_finalization(true);
 	GC_INIT();
 	GC_allow_register_threads();
 
 	s_sources = {
-		boost::container::pmr::new_delete_resource(),
+		nullptr, // the default resource, see get_global_source()
 		&bitmap_pool_instance, &gnu_pool_instance,
-		&mt_pool_instance, &boost_pool_instance,
+		&mt_pool_instance, &boost_pool_instance, &slab_pool_instance,
 		&collectable_gc_instance, &atomic_gc_instance,
 		&uncollectable_gc_instance, &atomic_uncollectable_gc_instance
 	};
 }
 
-void *gc_memory_resource::do_allocate(size_t bytes, size_t /*alignment*/)
+void *gc_memory_resource::do_allocate(size_t bytes, size_t alignment)
 {
+	// objects of bdwgc are aligned by granules, 16 bytes on 64-bit targets
+	assert(alignment <= memory::counted_alignment);
+	(void) alignment;
+
 	switch (k) {
 		case collectable: return GC_MALLOC(bytes);
 		case atomic: return GC_MALLOC_ATOMIC(bytes);
@@ -124,11 +144,40 @@ gc_memory_resource::gc_memory_resource(gc_memory_resource::memory_kind k) : k(k)
 {
 }
 
+void *mt_memory_resource::do_allocate(size_t bytes, size_t alignment)
+{
+	assert(alignment <= memory::counted_alignment);
+	(void) alignment;
+	return alloc.allocate(bytes);
+}
+
+void mt_memory_resource::do_deallocate(void *ptr, size_t bytes, size_t /*alignment*/)
+{
+	alloc.deallocate(static_cast<char *>(ptr), bytes);
+}
+
+bool mt_memory_resource::do_is_equal(const memory::resource_type &other) const noexcept
+{
+	return this == &other;
+}
+
+mt_memory_resource::mt_memory_resource()
+{
+	auto opt = alloc._M_get_options();
+	opt._M_align = memory::counted_alignment;
+	opt._M_chunk_size = 65536 - 4 * sizeof(void *);
+	opt._M_max_bytes = opt._M_chunk_size;
+	alloc._M_set_options(opt);
+}
+
 /*static*/
 void memory::register_finalizer(atomic_counted *obj)
 {
 	assert(obj);
 
+	// finalizers run on any thread
+	obj->share();
+
 	// finalizer must owns obj's counter
 	const bool res = obj->weak_acquire();
 	assert(res);
@@ -151,6 +200,160 @@ void memory::register_finalizer(atomic_counted *obj)
 		- reinterpret_cast<char *>(base)), nullptr, nullptr);
 }
 
+/// Young objects of a minor collection, that are kept for the next one
+static constexpr std::uint32_t nursery_max_age = 2;
+/// Objects made between the minor collections
+static constexpr std::size_t nursery_capacity = 4096;
+
+/// Collectable objects of the thread, whose finalizers aren't registered
+/// yet. The list holds a weak reference to each and keeps them reachable
+/// for bdwgc, their memory isn't moved: the references on the stack can't
+/// be updated. Minor collections free the objects that died young and
+/// promote the survivors, either remembered or old enough, registering
+/// their finalizers.
+struct memory::nursery
+{
+	struct entry {
+		atomic_counted *obj;
+		std::uint32_t age;
+	};
+
+	std::vector<entry, rt_allocator<entry>> young;
+	std::size_t next_collection = nursery_capacity;
+	nursery_stats stats { };
+
+	nursery() : young(rt_allocator<entry>(get_source(uncollectable_gc_pool))) {
+		young.reserve(nursery_capacity);
+	}
+
+	~nursery();
+
+	void add(atomic_counted *obj);
+	std::size_t collect(bool full) noexcept;
+
+	static nursery &local();
+
+	static thread_local nursery *current;
+	static thread_local bool destroyed;
+};
+
+thread_local memory::nursery *memory::nursery::current = nullptr;
+thread_local bool memory::nursery::destroyed = false;
+
+memory::nursery::~nursery()
+{
+	collect(true);
+	current = nullptr;
+	destroyed = true;
+}
+
+/*static*/
+memory::nursery &memory::nursery::local()
+{
+	static thread_local nursery instance;
+	current = &instance;
+	return instance;
+}
+
+void memory::nursery::add(atomic_counted *obj)
+{
+	young.push_back(entry { obj, 0 });
+	if(young.size() >= next_collection)
+		collect(false);
+}
+
+std::size_t memory::nursery::collect(bool full) noexcept
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::size_t nr_kept = 0, nr_promoted = 0;
+
+	// references released by the other threads may end more of them
+	merge_queued_refs();
+
+	for(entry &e : young) {
+		atomic_counted *const obj = e.obj;
+
+		if(0 >= obj->use_count()) {
+			obj->generation.store(atomic_counted::old_generation, std::memory_order_relaxed);
+			obj->weak_release();
+			++stats.nr_died_young;
+		}
+		else if(full || ++e.age >= nursery_max_age || atomic_counted::remembered_generation
+				== obj->generation.load(std::memory_order_relaxed)) {
+			obj->generation.store(atomic_counted::old_generation, std::memory_order_relaxed);
+			register_finalizer(obj);
+			obj->weak_release();
+			++nr_promoted;
+		}
+		else
+			young[nr_kept++] = e;
+	}
+
+	young.resize(nr_kept);
+	next_collection = nr_kept + nursery_capacity;
+
+	const auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start);
+	++stats.nr_collections;
+	stats.nr_promoted += nr_promoted;
+	stats.total_pause += pause;
+	stats.max_pause = std::max(stats.max_pause, pause);
+	return nr_promoted;
+}
+
+/*static*/
+void memory::make_young(atomic_counted *obj)
+{
+	assert(obj);
+
+	// the nursery owns obj's counter, as the finalizer after it
+	const bool res = obj->weak_acquire();
+	assert(res);
+	(void) res;
+
+	// objects made on the thread exit are promoted at once
+	if(__builtin_expect(nursery::destroyed, false)) {
+		register_finalizer(obj);
+		obj->weak_release();
+		return;
+	}
+
+	obj->generation.store(atomic_counted::young_generation, std::memory_order_relaxed);
+	nursery::local().add(obj);
+}
+
+static thread_local const char *tls_stack_base = nullptr;
+
+/*static*/
+void memory::remember(const void *slot, atomic_counted *obj) noexcept
+{
+	if(!tls_stack_base) {
+		GC_stack_base sb;
+		if(GC_SUCCESS == GC_get_stack_base(&sb))
+			tls_stack_base = static_cast<const char *>(sb.mem_base);
+	}
+
+	// the stores to the stack of the thread don't outlive it,
+	// the stack grows down on all of the supported targets
+	const auto *const addr = static_cast<const char *>(slot);
+	if(addr >= static_cast<const char *>(__builtin_frame_address(0)) && addr < tls_stack_base)
+		return;
+
+	obj->generation.store(atomic_counted::remembered_generation, std::memory_order_relaxed);
+}
+
+/*static*/
+std::size_t memory::collect_nursery(bool full)
+{
+	return nursery::current ? nursery::current->collect(full) : 0;
+}
+
+/*static*/
+memory::nursery_stats memory::get_nursery_stats()
+{
+	return nursery::current ? nursery::current->stats : nursery_stats { };
+}
+
 /*static*/
 std::size_t memory::run_finalizers()
 {
@@ -166,12 +369,14 @@ bool memory::should_run_finalizers()
 /*static*/
 void memory::finalize_all()
 {
+	collect_nursery(true);
 	GC_finalize_all();
 }
 
 /*static*/
 void memory::run_gc()
 {
+	collect_nursery(true);
 	GC_gcollect();
 }
 
@@ -272,23 +477,148 @@ bool memory::attach_thread()
 /*static*/
 void memory::detach_thread()
 {
+	// promotion registers finalizers, the thread must be known to bdwgc
+	collect_nursery(true);
 	GC_unregister_my_thread();
 }
 
 /*static*/
 memory::resource_type *memory::get_source(source_type t)
+{
+	if(default_pool == t)
+		if(resource_type *const source = region::current_source())
+			return source;
+	return get_global_source(t);
+}
+
+/*static*/
+memory::resource_type *memory::get_global_source(source_type t)
 {
 	std::call_once(s_flag, once_init);
+	if(default_pool == t)
+		return boost::container::pmr::get_default_resource();
 	return s_sources.at(t);
 }
 
+static constexpr std::int32_t refs_merged = 1;
+static constexpr std::int32_t refs_queued = 2;
+static constexpr std::int32_t refs_one = 4;
+
+static std::int32_t count_of(std::int32_t refs) noexcept
+{
+	return (refs & ~(refs_one - 1)) / refs_one;
+}
+
+/// Thread owning counted objects, it merges the queued ones. Ids aren't
+/// reused, an id missing in the registry is one of an exited thread.
+struct counting_thread
+{
+	std::uint32_t id;
+	std::vector<memory::atomic_counted *> queue;
+	std::atomic_bool has_queued { false };
+
+	counting_thread();
+	~counting_thread();
+};
+
+static std::mutex &threads_lock()
+{
+	// threads may exit after the static objects are destroyed
+	static auto *const lock = new std::mutex;
+	return *lock;
+}
+
+static std::unordered_map<std::uint32_t, counting_thread *> &threads()
+{
+	static auto *const registry = new std::unordered_map<std::uint32_t, counting_thread *>;
+	return *registry;
+}
+
+static std::atomic_uint_least32_t s_last_thread_id { 0 };
+// read on each count, and the library is loaded with the program
+static thread_local std::uint32_t tls_thread_id __attribute__((tls_model("initial-exec"))) = 0;
+static thread_local counting_thread *tls_thread = nullptr;
+static thread_local bool tls_thread_exited = false;
+
+counting_thread::counting_thread()
+	: id(s_last_thread_id.fetch_add(1, std::memory_order_relaxed) + 1)
+{
+	std::lock_guard<std::mutex> lock(threads_lock());
+	threads().emplace(id, this);
+	tls_thread = this;
+	tls_thread_id = id;
+}
+
+counting_thread::~counting_thread()
+{
+	tls_thread_exited = true;
+	memory::merge_queued_refs();
+}
+
+static bool is_current_thread(const std::atomic_uint_least32_t &owner) noexcept
+{
+	const auto id = owner.load(std::memory_order_relaxed);
+	return id && id == tls_thread_id;
+}
+
+/// Objects of the threads that are exiting are shared from the start
+static std::uint32_t current_thread_id() noexcept
+{
+	if(__builtin_expect(!tls_thread_id && !tls_thread_exited, false)) {
+		static thread_local counting_thread state;
+		(void) state;
+	}
+
+	return tls_thread_id;
+}
+
+/*static*/
+std::size_t memory::merge_queued_refs()
+{
+	counting_thread *const self = tls_thread;
+	if(!self)
+		return 0;
+
+	std::vector<atomic_counted *> queue;
+	{
+		std::lock_guard<std::mutex> lock(threads_lock());
+		queue.swap(self->queue);
+		self->has_queued.store(false, std::memory_order_relaxed);
+
+		// the objects queued later are merged by the threads releasing them
+		if(tls_thread_exited) {
+			threads().erase(self->id);
+			tls_thread_id = 0;
+			tls_thread = nullptr;
+		}
+	}
+
+	for(atomic_counted *obj : queue)
+		obj->merge(-1);
+	return queue.size();
+}
+
+memory::atomic_counted::atomic_counted() noexcept
+	: refs(0), weak_refs(1), owner(current_thread_id()), local_refs(1), generation(old_generation)
+{
+	if(!owner.load(std::memory_order_relaxed)) {
+		refs.store(refs_one | refs_merged, std::memory_order_relaxed);
+		local_refs.store(0, std::memory_order_relaxed);
+	}
+}
+
 bool memory::atomic_counted::acquire() noexcept
 {
-	auto count = use_count();
+	if(is_current_thread(owner)) {
+		local_refs.store(local_refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	auto count = refs.load(std::memory_order_relaxed);
 	do {
-		if(count <= 0)
+		if((count & refs_merged) && count_of(count) <= 0)
 			return false;
-	} while(refs.compare_exchange_weak(count, count + 1,
+	} while(!refs.compare_exchange_weak(count, count + refs_one,
 			std::memory_order_acq_rel, std::memory_order_relaxed));
 
 	return true;
@@ -296,17 +626,102 @@ bool memory::atomic_counted::acquire() noexcept
 
 void memory::atomic_counted::release() noexcept
 {
-	if(1 == refs.fetch_sub(1, std::memory_order_relaxed))
-	{
-		dispose();
+	if(!is_current_thread(owner)) {
+		release_shared();
+		return;
+	}
 
-		// to ensure that the effects of dispose() are observed
-		// in the thread that runs destroy().
-		std::atomic_thread_fence(std::memory_order_acq_rel);
+	const auto count = local_refs.load(std::memory_order_relaxed) - 1;
+	local_refs.store(count, std::memory_order_relaxed);
+	if(count)
+		return;
+
+	// no other thread has ever counted the object
+	if(0 == refs.load(std::memory_order_acquire))
+		die();
+	else
+		merge(0);
+
+	counting_thread *const self = tls_thread;
+	if(__builtin_expect(self && self->has_queued.load(std::memory_order_relaxed), false))
+		merge_queued_refs();
+}
+
+void memory::atomic_counted::release_shared() noexcept
+{
+	auto count = refs.load(std::memory_order_relaxed);
+	for(;;) {
+		if(count & refs_merged) {
+			if(refs.compare_exchange_weak(count, count - refs_one,
+					std::memory_order_acq_rel, std::memory_order_relaxed)) {
+				if(1 == count_of(count))
+					die();
+				return;
+			}
+		}
+		// the rest of the references are counted by the owner
+		else if(count_of(count) > 0 || (count & refs_queued)) {
+			if(refs.compare_exchange_weak(count, count - refs_one,
+					std::memory_order_acq_rel, std::memory_order_relaxed))
+				return;
+		}
+		else if(refs.compare_exchange_weak(count, count | refs_queued,
+				std::memory_order_acq_rel, std::memory_order_relaxed))
+			break;
+	}
+
+	// the reference is passed to the owner, it merges the counters
+	const auto id = owner.load(std::memory_order_acquire);
+	if(id) {
+		std::lock_guard<std::mutex> lock(threads_lock());
+		const auto it = threads().find(id);
+		if(threads().end() != it) {
+			it->second->queue.push_back(this);
+			it->second->has_queued.store(true, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	merge(-1);
+}
 
-		if(1 == weak_refs.fetch_sub(1, std::memory_order_relaxed))
-			destroy();
+/// Called by the owner, or by any thread once the owner has exited
+void memory::atomic_counted::merge(std::int32_t delta) noexcept
+{
+	auto count = refs.load(std::memory_order_relaxed);
+	std::int32_t merged;
+	do {
+		merged = count_of(count) + delta;
+		if(!(count & refs_merged))
+			merged += local_refs.load(std::memory_order_relaxed);
+	} while(!refs.compare_exchange_weak(count, merged * refs_one | refs_merged,
+			std::memory_order_acq_rel, std::memory_order_relaxed));
+
+	if(!(count & refs_merged)) {
+		local_refs.store(0, std::memory_order_relaxed);
+		owner.store(0, std::memory_order_release);
 	}
+
+	if(!merged)
+		die();
+}
+
+void memory::atomic_counted::share() noexcept
+{
+	if(is_current_thread(owner))
+		merge(0);
+}
+
+void memory::atomic_counted::die() noexcept
+{
+	dispose();
+
+	// to ensure that the effects of dispose() are observed
+	// in the thread that runs destroy().
+	std::atomic_thread_fence(std::memory_order_acq_rel);
+
+	if(1 == weak_refs.fetch_sub(1, std::memory_order_relaxed))
+		destroy();
 }
 
 bool memory::atomic_counted::weak_acquire() noexcept
@@ -315,7 +730,7 @@ bool memory::atomic_counted::weak_acquire() noexcept
 	do {
 		if(count <= 0)
 			return false;
-	} while(weak_refs.compare_exchange_weak(count, count + 1,
+	} while(!weak_refs.compare_exchange_weak(count, count + 1,
 			std::memory_order_acq_rel, std::memory_order_relaxed));
 
 	return true;
@@ -335,12 +750,15 @@ void memory::atomic_counted::weak_release() noexcept
 
 bool memory::atomic_counted::unique() const noexcept
 {
-	return 1 == refs.load(std::memory_order_relaxed);
+	return 1 == use_count();
 }
 
 std::int32_t memory::atomic_counted::use_count() const noexcept
 {
-	return refs.load(std::memory_order_relaxed);
+	const auto count = refs.load(std::memory_order_relaxed);
+	if(count & refs_merged)
+		return count_of(count);
+	return count_of(count) + local_refs.load(std::memory_order_relaxed);
 }
 
 std::int32_t memory::atomic_counted::weak_count() const noexcept
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <boost/container/pmr/memory_resource.hpp>
 #include <boost/container/pmr/polymorphic_allocator.hpp>
@@ -86,6 +87,20 @@ public:
 	static void set_max_collectable_heap_size(std::size_t size);
 	static std::size_t set_collectable_free_space_divisor(std::size_t div);
 
+	/// Minor collections of the nursery of the thread
+	struct nursery_stats {
+		std::size_t nr_collections;
+		std::size_t nr_promoted;
+		std::size_t nr_died_young;
+		std::chrono::nanoseconds total_pause;
+		std::chrono::nanoseconds max_pause;
+	};
+
+	static nursery_stats get_nursery_stats();
+	/// Promote the survivors of the nursery of the thread, all of them
+	/// if @a full, the number of the promoted objects
+	static std::size_t collect_nursery(bool full = false);
+
 	static void enable_gc();
 	static void disable_gc();
 	static bool gc_enabled();
@@ -98,18 +113,34 @@ public:
 	static void detach_thread();
 
 	enum source_type {
-		default_pool, bitmap_pool, gnu_pool, mt_pool, boost_pool,
+		default_pool, bitmap_pool, gnu_pool, mt_pool, boost_pool, slab_pool,
 		collectable_gc_pool, atomic_gc_pool, uncollectable_gc_pool,
 		atomic_uncollectable_gc_pool, last_source_type
 	};
 
 	using resource_type = boost::container::pmr::memory_resource;
+	/// The default pool is replaced by the innermost region of the thread
 	static resource_type *get_source(source_type = default_pool);
-
-	class atomic_counted
+	/// Source of the type regardless of the regions. The default pool is
+	/// the default resource of boost::container::pmr, new/delete unless
+	/// replaced by set_default_resource()
+	static resource_type *get_global_source(source_type = default_pool);
+
+	class region;
+
+	/// type::rep keeps its tags in the low 4 bits of the pointers
+	/// to counted objects, all of the sources must keep them clear
+	static constexpr std::size_t counted_alignment = 16;
+
+	/// Counts are biased to the thread that created the object: it counts
+	/// its references without atomic operations, the other threads count
+	/// theirs in the shared counter. When the shared counter would turn
+	/// negative, the reference is queued to the owner, which merges both
+	/// counters and the object is counted atomically from then on.
+	class alignas(counted_alignment) atomic_counted
 	{
 	public:
-		atomic_counted() noexcept : refs(1), weak_refs(1) { }
+		atomic_counted() noexcept;
 		virtual ~atomic_counted() noexcept = default;
 		virtual atomic_counted *clone() const = 0;
 
@@ -122,6 +153,9 @@ public:
 		std::int32_t use_count() const noexcept;
 		std::int32_t weak_count() const noexcept;
 
+		/// Count atomically from now on, called by the owner
+		void share() noexcept;
+
 	protected:
 		bool weak_acquire() noexcept;
 		void weak_release() noexcept;
@@ -134,12 +168,41 @@ public:
 		atomic_counted &operator=(const atomic_counted &) = delete;
 		friend class memory;
 
-		std::atomic_int_least32_t refs, weak_refs;
+		void release_shared() noexcept;
+		void merge(std::int32_t delta) noexcept;
+		void die() noexcept;
+
+		enum : std::uint8_t { old_generation, young_generation, remembered_generation };
+
+		/// Shared count in units of 4, the low bits are the flags
+		std::atomic_int_least32_t refs;
+		std::atomic_int_least32_t weak_refs;
+		/// Id of the owner thread, 0 after the merge
+		std::atomic_uint_least32_t owner;
+		/// Biased count, only the owner accesses it
+		std::atomic_int_least32_t local_refs;
+		/// Collectable objects are young until promoted by the nursery
+		std::atomic_uint_least8_t generation;
 	};
 
+	/// Merge the objects of the thread queued by the other threads,
+	/// the number of the merged ones
+	static std::size_t merge_queued_refs();
+
 	using counted_ptr = boost::intrusive_ptr<atomic_counted>;
 
+	/// Write barrier of the stores of references, young objects stored
+	/// out of the stack are promoted by the next minor collection
+	static void record_store(const void *slot, atomic_counted *value) noexcept {
+		if(__builtin_expect(atomic_counted::young_generation
+				== value->generation.load(std::memory_order_relaxed), false))
+			remember(slot, value);
+	}
+
 private:
+	struct nursery;
+	static void make_young(atomic_counted *obj);
+	static void remember(const void *slot, atomic_counted *obj) noexcept;
 
   template <typename Tp, typename Alloc>
 	class atomic_counted_inplace final : public atomic_counted
@@ -193,6 +256,39 @@ public:
 
 }; // class memory
 
+/// Arena of the calling thread: while it's alive, get_source() returns
+/// its bump allocator instead of the default pool, and the memory is
+/// reclaimed at once on the scope exit. Blocks that outlive the scope
+/// keep their chunks, a chunk is freed with the last of its blocks.
+/// Regions nest and must be destroyed in the reverse order by the
+/// thread that created them.
+class memory::region
+{
+public:
+	region() noexcept;
+	~region();
+
+	/// Blocks allocated in the region and not freed yet
+	std::size_t live_blocks() const noexcept;
+
+	/// Source of the innermost region of the thread, null if there's none
+	static resource_type *current_source() noexcept;
+
+	struct chunk;
+
+private:
+	region(const region &) = delete;
+	region &operator=(const region &) = delete;
+	friend class region_memory_resource;
+
+	void *allocate(std::size_t bytes, std::size_t alignment);
+	static void *allocate_alone(std::size_t bytes, std::size_t alignment);
+
+	region *const outer;
+	chunk *chunks = nullptr;
+	char *bump = nullptr, *end = nullptr;
+};
+
 template <typename Tp, typename Alloc>
     template <typename... Args>
 memory::atomic_counted_inplace<Tp, Alloc>::
@@ -221,7 +317,7 @@ memory::atomic_counted_inplace<Tp, Alloc>::clone() const
 	auto *const ptr = allocate_counted<Tp>(alloc, *reinterpret_cast<const Tp *>(&s.buffer));
 
 	if(rt_allocator<Tp>(get_source(collectable_gc_pool)) == alloc)
-		register_finalizer(ptr);
+		make_young(ptr);
 	return ptr;
 }
 
@@ -259,6 +355,7 @@ memory::allocate_counted(Alloc a, Args &&...args)
 	typename ac_type::alloc_type a2(a);
 	auto guard = std::__allocate_guarded(a2);
 	ac_type *const ptr = guard.get();
+	assert(0 == reinterpret_cast<std::uintptr_t>(ptr) % counted_alignment);
 	new (ptr) ac_type(std::move(a), std::forward<Args>(args)...);
 	guard = nullptr;
 	return ptr;
@@ -280,7 +377,7 @@ memory::make_collectable(Args &&...args)
 		rt_allocator<Tp>(get_source(collectable_gc_pool)),
 			std::forward<Args>(args)...);
 
-	register_finalizer(ptr);
+	make_young(ptr);
 	return ptr;
 }
 
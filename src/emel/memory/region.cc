@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "memory.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace emel {
+
+/// Bump allocation from the innermost region of the calling thread.
+/// Outside of the regions, e.g. for the containers escaped from them,
+/// each block gets a chunk of its own.
+class region_memory_resource final : public memory::resource_type
+{
+protected:
+	virtual void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	virtual void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+	virtual bool do_is_equal(const memory::resource_type &other) const noexcept override;
+};
+
+namespace {
+
+/// Chunks are aligned by their size, so that the chunk of a block
+/// is found by its address
+constexpr std::size_t chunk_size = 64 * 1024;
+/// Larger requests get chunks of their own
+constexpr std::size_t max_bump_size = chunk_size / 4;
+/// Chunks kept by a thread for its next regions
+constexpr std::size_t max_spare_chunks = 4;
+
+region_memory_resource region_source;
+thread_local memory::region *tls_region = nullptr;
+
+char *align_up(char *ptr, std::size_t alignment) noexcept
+{
+	const auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+	return ptr + ((alignment - addr % alignment) % alignment);
+}
+
+} // anonymous namespace
+
+/// Blocks of a chunk are counted by the region, while it's alive, and
+/// the frees are subtracted from live by any thread. The region adds its
+/// count at the scope exit, so live turns zero only after that, when all
+/// of the blocks are freed, and the thread that zeroes it frees the chunk.
+struct alignas(memory::counted_alignment) memory::region::chunk
+{
+	std::atomic<std::ptrdiff_t> live { 0 };
+	std::size_t nr_allocated = 0;
+	chunk *next = nullptr;
+
+	static chunk *of(void *ptr) noexcept {
+		return reinterpret_cast<chunk *>(
+			reinterpret_cast<std::uintptr_t>(ptr) & ~std::uintptr_t(chunk_size - 1));
+	}
+
+	static chunk *make(std::size_t size)
+	{
+		void *mem;
+		if(posix_memalign(&mem, chunk_size, size))
+			throw std::bad_alloc();
+		return new (mem) chunk;
+	}
+
+	void destroy() noexcept {
+		this->~chunk();
+		std::free(this);
+	}
+
+	char *begin() noexcept { return reinterpret_cast<char *>(this + 1); }
+	char *end() noexcept { return reinterpret_cast<char *>(this) + chunk_size; }
+
+	void release() noexcept {
+		if(1 == live.fetch_sub(1, std::memory_order_acq_rel))
+			destroy();
+	}
+};
+
+namespace {
+
+/// Chunks of the exited regions of the thread, their blocks are all freed
+struct spare_chunks
+{
+	memory::region::chunk *head = nullptr;
+	std::size_t count = 0;
+
+	~spare_chunks() {
+		while(head) {
+			memory::region::chunk *const next = head->next;
+			head->destroy();
+			head = next;
+		}
+	}
+};
+
+thread_local spare_chunks tls_spares;
+
+} // anonymous namespace
+
+memory::region::region() noexcept : outer(tls_region)
+{
+	tls_region = this;
+}
+
+memory::region::~region()
+{
+	assert(this == tls_region);
+	tls_region = outer;
+
+	// references released by the other threads may free more blocks
+	memory::merge_queued_refs();
+
+	for(chunk *c = chunks; c; ) {
+		chunk *const next = c->next;
+		const auto count = std::ptrdiff_t(c->nr_allocated);
+
+		// otherwise there are escaped blocks, the last of them frees the chunk
+		if(0 == count + c->live.fetch_add(count, std::memory_order_acq_rel)) {
+			if(tls_spares.count < max_spare_chunks) {
+				c->~chunk();
+				c = new (c) chunk;
+				c->next = tls_spares.head;
+				tls_spares.head = c;
+				++tls_spares.count;
+			}
+			else
+				c->destroy();
+		}
+
+		c = next;
+	}
+}
+
+std::size_t memory::region::live_blocks() const noexcept
+{
+	std::ptrdiff_t res = 0;
+	for(chunk *c = chunks; c; c = c->next)
+		res += std::ptrdiff_t(c->nr_allocated) + c->live.load(std::memory_order_relaxed);
+	return std::size_t(res);
+}
+
+/*static*/
+memory::resource_type *memory::region::current_source() noexcept
+{
+	return tls_region ? &region_source : nullptr;
+}
+
+void *memory::region::allocate(std::size_t bytes, std::size_t alignment)
+{
+	char *ptr = align_up(bump, alignment);
+
+	if(!chunks || std::size_t(end - ptr) < bytes || end < ptr) {
+		if(bytes > max_bump_size || alignment > max_bump_size)
+			return allocate_alone(bytes, alignment);
+
+		chunk *c = tls_spares.head;
+		if(c) {
+			tls_spares.head = c->next;
+			--tls_spares.count;
+			c->next = nullptr;
+		}
+		else
+			c = chunk::make(chunk_size);
+
+		c->next = chunks;
+		chunks = c;
+		end = c->end();
+		ptr = align_up(c->begin(), alignment);
+	}
+
+	++chunks->nr_allocated;
+	bump = ptr + bytes;
+	return ptr;
+}
+
+/*static*/
+void *memory::region::allocate_alone(std::size_t bytes, std::size_t alignment)
+{
+	// the block must start in the first chunk_size bytes to find the header
+	if(alignment >= chunk_size)
+		throw std::bad_alloc();
+
+	chunk *const c = chunk::make(sizeof(chunk) + alignment + bytes);
+	c->live.store(1, std::memory_order_relaxed);
+	return align_up(c->begin(), alignment);
+}
+
+void *region_memory_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	if(memory::region *const r = tls_region)
+		return r->allocate(bytes, alignment);
+	return memory::region::allocate_alone(bytes, alignment);
+}
+
+void region_memory_resource::do_deallocate(void *ptr, std::size_t /*bytes*/, std::size_t /*alignment*/)
+{
+	memory::region::chunk::of(ptr)->release();
+}
+
+bool region_memory_resource::do_is_equal(const memory::resource_type &other) const noexcept
+{
+	return this == &other;
+}
+
+} // namespace emel
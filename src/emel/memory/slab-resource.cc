@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "slab-resource.h"
+
+#include <boost/container/pmr/global_resource.hpp>
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <typeinfo>
+
+namespace emel {
+
+namespace {
+
+constexpr std::size_t block_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+constexpr std::size_t nr_classes = sizeof block_sizes / sizeof block_sizes[0];
+constexpr std::size_t granule = memory::counted_alignment;
+
+static_assert(slab_memory_resource::max_block_size == block_sizes[nr_classes - 1],
+	"the largest size class must be max_block_size");
+
+/// Size class of the request, by the table of the granules
+std::size_t class_of(std::size_t bytes) noexcept
+{
+	static const auto table = [] {
+		std::array<std::uint8_t, slab_memory_resource::max_block_size / granule + 1> res { };
+		std::size_t cls = 0;
+		for(std::size_t idx = 0; idx < res.size(); ++idx) {
+			while(block_sizes[cls] < idx * granule)
+				++cls;
+			res[idx] = std::uint8_t(cls);
+		}
+		return res;
+	}();
+
+	return table[(bytes + granule - 1) / granule];
+}
+
+bool is_small(std::size_t bytes, std::size_t alignment) noexcept
+{
+	return bytes <= slab_memory_resource::max_block_size && alignment <= granule;
+}
+
+struct free_block {
+	free_block *next;
+};
+
+struct heap;
+
+/// Header at the beginning of each slab. The fields written by other
+/// threads are on a separate cache line from the ones of the owner.
+struct slab
+{
+	std::atomic<heap *> owner;
+	std::atomic<free_block *> remote_free { nullptr };
+
+	alignas(64) free_block *local_free = nullptr;
+	char *bump, *end;
+	std::size_t cls;
+	std::size_t used = 0;
+	slab *prev = nullptr, *next = nullptr;
+
+	slab(heap *h, std::size_t cls) noexcept
+		: owner(h), bump(reinterpret_cast<char *>(this) + sizeof(slab))
+		, end(reinterpret_cast<char *>(this) + slab_memory_resource::slab_size), cls(cls)
+	{
+	}
+
+	static slab *of(void *ptr) noexcept {
+		return reinterpret_cast<slab *>(
+			reinterpret_cast<std::uintptr_t>(ptr) & ~(slab_memory_resource::slab_size - 1));
+	}
+
+	static slab *make(heap *h, std::size_t cls)
+	{
+		void *mem = nullptr;
+		if(posix_memalign(&mem, slab_memory_resource::slab_size, slab_memory_resource::slab_size))
+			throw std::bad_alloc();
+		return new (mem) slab(h, cls);
+	}
+
+	void destroy() noexcept
+	{
+		this->~slab();
+		std::free(this);
+	}
+
+	void *pop() noexcept
+	{
+		if(free_block *const b = local_free) {
+			local_free = b->next;
+			++used;
+			return b;
+		}
+
+		if(bump + block_sizes[cls] <= end) {
+			void *const res = bump;
+			bump += block_sizes[cls];
+			++used;
+			return res;
+		}
+
+		return nullptr;
+	}
+
+	/// Take the blocks freed by the other threads
+	void collect() noexcept
+	{
+		free_block *b = remote_free.exchange(nullptr, std::memory_order_acquire);
+		while(b) {
+			free_block *const next = b->next;
+			b->next = local_free;
+			local_free = b;
+			--used;
+			b = next;
+		}
+	}
+
+	void push_remote(void *ptr) noexcept
+	{
+		auto *const b = static_cast<free_block *>(ptr);
+		b->next = remote_free.load(std::memory_order_relaxed);
+		while(!remote_free.compare_exchange_weak(b->next, b,
+				std::memory_order_release, std::memory_order_relaxed)) { }
+	}
+};
+
+static_assert(0 == sizeof(slab) % granule, "blocks must be aligned by the granule");
+
+/// Slabs left with the live blocks by the exited threads
+struct orphans
+{
+	std::mutex lock;
+	std::array<slab *, nr_classes> slabs { };
+
+	static orphans &get() {
+		// never destroyed, threads may exit after the static storage
+		static orphans *const instance = new orphans();
+		return *instance;
+	}
+};
+
+struct heap
+{
+	std::array<slab *, nr_classes> active { }, slabs { };
+	std::array<std::size_t, nr_classes> nr_slabs { }, nr_scanned { };
+
+	/// Slabs at the front are scanned for free blocks first
+	void link(slab *s) noexcept
+	{
+		++nr_slabs[s->cls];
+		s->prev = nullptr;
+		s->next = slabs[s->cls];
+		if(s->next)
+			s->next->prev = s;
+		slabs[s->cls] = s;
+	}
+
+	void unlink(slab *s) noexcept
+	{
+		--nr_slabs[s->cls];
+		(s->prev ? s->prev->next : slabs[s->cls]) = s->next;
+		if(s->next)
+			s->next->prev = s->prev;
+	}
+
+	void *allocate(std::size_t cls)
+	{
+		if(slab *const s = active[cls])
+			if(void *const res = s->pop())
+				return res;
+
+		// the slabs freed by the owner are at the front, all of them are
+		// scanned for the frees of the other threads, when their number
+		// doubles, so that a new slab costs amortized constant time
+		std::size_t limit = 8;
+		if(nr_slabs[cls] >= 2 * nr_scanned[cls]) {
+			nr_scanned[cls] = nr_slabs[cls];
+			limit = nr_slabs[cls];
+		}
+
+		for(slab *s = slabs[cls]; s && limit; s = s->next, --limit) {
+			s->collect();
+			if(void *const res = s->pop()) {
+				active[cls] = s;
+				return res;
+			}
+		}
+
+		slab *s = adopt(cls);
+		if(!s) {
+			s = slab::make(this, cls);
+			link(s);
+		}
+
+		active[cls] = s;
+		return s->pop();
+	}
+
+	void deallocate(slab *s, void *ptr) noexcept
+	{
+		auto *const b = static_cast<free_block *>(ptr);
+		b->next = s->local_free;
+		s->local_free = b;
+
+		if(active[s->cls] == s)
+			--s->used;
+
+		// empty slabs go back to the system, but the active one
+		else if(!--s->used) {
+			unlink(s);
+			s->destroy();
+		} else if(slabs[s->cls] != s) {
+			unlink(s);
+			link(s);
+		}
+	}
+
+	slab *adopt(std::size_t cls)
+	{
+		orphans &o = orphans::get();
+		std::lock_guard<std::mutex> lk(o.lock);
+
+		slab *const s = o.slabs[cls];
+		if(!s)
+			return nullptr;
+
+		o.slabs[cls] = s->next;
+		s->owner.store(this, std::memory_order_release);
+		s->collect();
+		link(s);
+		return s;
+	}
+
+	~heap()
+	{
+		orphans &o = orphans::get();
+		std::lock_guard<std::mutex> lk(o.lock);
+
+		for(slab *s : slabs)
+			while(s) {
+				slab *const next = s->next;
+				s->owner.store(nullptr, std::memory_order_release);
+				s->collect();
+
+				// no blocks are left to free, even by the other threads
+				if(!s->used)
+					s->destroy();
+				else {
+					s->next = o.slabs[s->cls];
+					o.slabs[s->cls] = s;
+				}
+				s = next;
+			}
+	}
+};
+
+thread_local heap *tls_heap = nullptr;
+
+struct heap_guard {
+	~heap_guard() {
+		delete tls_heap;
+		tls_heap = nullptr;
+	}
+};
+
+heap &local_heap()
+{
+	if(__builtin_expect(!tls_heap, false)) {
+		// a heap made after the thread-local storage is gone is left
+		// to the exit of the process
+		static thread_local heap_guard guard;
+		(void) guard;
+		tls_heap = new heap();
+	}
+
+	return *tls_heap;
+}
+
+} // anonymous namespace
+
+void *slab_memory_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	if(!is_small(bytes, alignment))
+		return boost::container::pmr::new_delete_resource()->allocate(bytes, alignment);
+	return local_heap().allocate(class_of(bytes));
+}
+
+void slab_memory_resource::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment)
+{
+	if(!is_small(bytes, alignment)) {
+		boost::container::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+		return;
+	}
+
+	slab *const s = slab::of(ptr);
+	heap *const h = tls_heap;
+
+	if(h && h == s->owner.load(std::memory_order_relaxed))
+		h->deallocate(s, ptr);
+	else
+		s->push_remote(ptr);
+}
+
+bool slab_memory_resource::do_is_equal(const memory::resource_type &other) const noexcept
+{
+	// any instance frees the blocks of the others
+	return typeid(other) == typeid(slab_memory_resource);
+}
+
+} // namespace emel
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "memory.h"
+
+namespace emel {
+
+/// Memory of short-lived objects from per-thread slabs of size classes.
+/// The thread owning a slab allocates and frees without atomics, other
+/// threads push their frees to a separate list of the slab, taken by
+/// the owner when it runs out of the blocks. Slabs of exited threads
+/// are adopted by the next thread in need of the same size class.
+class slab_memory_resource final : public memory::resource_type
+{
+protected:
+	virtual void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	virtual void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+	virtual bool do_is_equal(const memory::resource_type &other) const noexcept override;
+
+public:
+	/// Slabs are aligned by their size, so that the slab of a block
+	/// is found by its address
+	static constexpr std::size_t slab_size = 64 * 1024;
+	/// Larger or more aligned requests go to new/delete
+	static constexpr std::size_t max_block_size = 2048;
+};
+
+} // namespace emel
@@ -73,7 +73,13 @@ const char *opcode_name(opcode op)
         OPCODE_NAME(opcode::brb_true, "brb-true")
         OPCODE_NAME(opcode::brb_false, "brb-false")
         OPCODE_NAME(opcode::br_table, "branch-table")
+        OPCODE_NAME(opcode::amake, "amake")
+        OPCODE_NAME(opcode::astore, "astore")
+        OPCODE_NAME(opcode::aload, "aload")
         OPCODE_NAME(opcode::ret, "ret")
+        OPCODE_NAME(opcode::call_op_const, "call-op-const")
+        OPCODE_NAME(opcode::call_op_local, "call-op-local")
+        OPCODE_NAME(opcode::call_op_store, "call-op-store")
 
         default:
             break;
@@ -124,6 +130,13 @@ std::string insn_to_string(insn_type insn)
     oss << opcode_name(pair.first) << ' ';
     if(opcode::call_op == pair.first)
         oss << opkind_name(static_cast<op_kind>(pair.second));
+    else if(opcode::call_op_const == pair.first || opcode::call_op_local == pair.first)
+        oss << opkind_name(fused_arg::kind(pair.second)) << ' '
+            << fused_arg::operand(pair.second);
+    else if(opcode::call_op_store == pair.first)
+        oss << opkind_name(fused_arg::kind(pair.second)) << ' '
+            << fused_arg::store_operand(pair.second) << ' '
+            << fused_arg::store_target(pair.second);
     else
         oss << pair.second;
     return oss.str();
@@ -56,10 +56,10 @@ enum class opcode : unsigned char {
     brb_true, ///< Conditional backward branch, if top of the stack is true
     brb_false, ///< Conditional backward branch, if top of the stack is false
     br_table, ///< Make branch table
-    amake, ///< Make array
+    amake, ///< Make array or map of the values on the stack, see amake_arg
 
-    astore, ///< Store value to array
-    aload, ///< Load value from array
+    astore, ///< Store value to the element of array or map in the local variable
+    aload, ///< Load element of array or map on the stack
     push_frame, // Создать новый кадр
     drop_frame, // Выйти из текущего кадра
     raise, // Бросить исключение
@@ -68,9 +68,15 @@ enum class opcode : unsigned char {
     end_try, // Конец блока try
     call, // Вызов функции по имени
     fcall, // Вызов функции по номеру
+    call_op_const, ///< Fused push_const and call_op, constant is the left operand
+
+    call_op_local, ///< Fused push_local and call_op, local is the left operand
+    call_op_store, ///< Fused push_local, call_op and load_local
     max_opcode
 };
 
+static_assert(static_cast<int>(opcode::max_opcode) <= 32, "opcode must fit into 5 bits");
+
 using insn_array = std::deque<insn_type>;
 extern struct empty_value_type {} empty_value;
 using value_type = boost::variant<empty_value_type, std::string, double, bool>;
@@ -80,6 +86,60 @@ enum class op_kind {
     or_ = 201, xor_, and_, eq, ne, lt, gt, lte, gte, add, sub, mul, div
 };
 
+/// Argument of the fused call_op_* instructions: compact operator kind
+/// in the low 4 bits, then the index of the pushed operand. call_op_store
+/// splits the rest into 11 bits of the pushed local and 12 bits of the stored one.
+struct fused_arg {
+    static constexpr std::uint32_t kind_bits = 4;
+    static constexpr std::uint32_t operand_bits = 23;
+    static constexpr std::uint32_t store_operand_bits = 11;
+    static constexpr std::uint32_t store_target_bits = 12;
+
+    static constexpr std::uint32_t kind_index(op_kind k) {
+        return static_cast<std::uint32_t>(k) < static_cast<std::uint32_t>(op_kind::or_)
+            ? static_cast<std::uint32_t>(k) - static_cast<std::uint32_t>(op_kind::not_)
+            : static_cast<std::uint32_t>(k) - static_cast<std::uint32_t>(op_kind::or_) + 2;
+    }
+
+    static constexpr op_kind kind(std::uint32_t arg) {
+        return (arg & 0xF) < 2
+            ? static_cast<op_kind>(static_cast<std::uint32_t>(op_kind::not_) + (arg & 0xF))
+            : static_cast<op_kind>(static_cast<std::uint32_t>(op_kind::or_) + (arg & 0xF) - 2);
+    }
+
+    static constexpr std::uint32_t operand(std::uint32_t arg) {
+        return arg >> kind_bits;
+    }
+
+    static constexpr std::uint32_t store_operand(std::uint32_t arg) {
+        return (arg >> kind_bits) & ((1u << store_operand_bits) - 1);
+    }
+
+    static constexpr std::uint32_t store_target(std::uint32_t arg) {
+        return arg >> (kind_bits + store_operand_bits);
+    }
+
+    static constexpr std::uint32_t make(op_kind k, std::uint32_t operand) {
+        return kind_index(k) | (operand << kind_bits);
+    }
+
+    static constexpr std::uint32_t make(op_kind k, std::uint32_t operand, std::uint32_t target) {
+        return kind_index(k) | (operand << kind_bits)
+            | (target << (kind_bits + store_operand_bits));
+    }
+};
+
+/// Argument of amake: the number of elements, which are popped in order
+/// of their pushing, for map they are pairs of the key and the value
+struct amake_arg {
+    static constexpr std::uint32_t make(std::uint32_t count, bool is_map = false) {
+        return (count << 1) | (is_map ? 1u : 0u);
+    }
+
+    static constexpr std::uint32_t count(std::uint32_t arg) { return arg >> 1; }
+    static constexpr bool is_map(std::uint32_t arg) { return 0 != (arg & 1); }
+};
+
 EMEL_EXPORT std::pair<opcode, std::uint32_t> insn_decode(insn_type insn);
 EMEL_EXPORT insn_type insn_encode(opcode op, std::uint32_t idx = 0);
 EMEL_EXPORT insn_type insn_encode(opcode op, op_kind k);
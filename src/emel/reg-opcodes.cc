@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "reg-opcodes.h"
+
+#include <sstream>
+
+namespace emel {
+
+const char *reg_opcode_name(reg_opcode op)
+{
+    const char *result = "undefined-opcode";
+
+# define OPCODE_NAME(OP, STR) \
+    case OP: result = STR; break;
+
+    switch (op) {
+        OPCODE_NAME(reg_opcode::move, "move")
+        OPCODE_NAME(reg_opcode::swap, "swap")
+        OPCODE_NAME(reg_opcode::ret, "ret")
+        OPCODE_NAME(reg_opcode::not_, "logical-not")
+        OPCODE_NAME(reg_opcode::neg, "neg")
+        OPCODE_NAME(reg_opcode::or_, "or")
+        OPCODE_NAME(reg_opcode::xor_, "xor")
+        OPCODE_NAME(reg_opcode::and_, "and")
+        OPCODE_NAME(reg_opcode::eq, "equals")
+        OPCODE_NAME(reg_opcode::ne, "not-equals")
+        OPCODE_NAME(reg_opcode::lt, "less-than")
+        OPCODE_NAME(reg_opcode::gt, "greater-than")
+        OPCODE_NAME(reg_opcode::lte, "less-or-equals")
+        OPCODE_NAME(reg_opcode::gte, "greater-or-equals")
+        OPCODE_NAME(reg_opcode::add, "add")
+        OPCODE_NAME(reg_opcode::sub, "sub")
+        OPCODE_NAME(reg_opcode::mul, "mul")
+        OPCODE_NAME(reg_opcode::div, "div")
+        OPCODE_NAME(reg_opcode::jmp, "jmp")
+        OPCODE_NAME(reg_opcode::jt, "jmp-true")
+        OPCODE_NAME(reg_opcode::jf, "jmp-false")
+
+        default:
+            break;
+    }
+
+# undef OPCODE_NAME
+
+    return result;
+}
+
+static void print_operand(std::ostream &os, std::uint32_t op)
+{
+    switch (reg_operand::kind_of(op)) {
+        case reg_operand::reg: os << 'r'; break;
+        case reg_operand::constant: os << 'k'; break;
+        case reg_operand::immediate: os << '#'; break;
+    }
+
+    os << reg_operand::index_of(op);
+}
+
+std::string reg_insn_to_string(const reg_insn &insn)
+{
+    std::ostringstream oss;
+    oss << reg_opcode_name(insn.op) << ' ';
+
+    switch (insn.op) {
+        case reg_opcode::jmp:
+            oss << static_cast<std::int32_t>(insn.b);
+            break;
+
+        case reg_opcode::jt:
+        case reg_opcode::jf:
+            print_operand(oss, insn.a);
+            oss << ", " << static_cast<std::int32_t>(insn.b);
+            break;
+
+        case reg_opcode::ret:
+            if(insn.b)
+                print_operand(oss, insn.a);
+            break;
+
+        case reg_opcode::move:
+        case reg_opcode::swap:
+        case reg_opcode::not_:
+        case reg_opcode::neg:
+            print_operand(oss, insn.a);
+            oss << ", ";
+            print_operand(oss, insn.b);
+            break;
+
+        default:
+            print_operand(oss, insn.a);
+            oss << ", ";
+            print_operand(oss, insn.b);
+            oss << ", ";
+            print_operand(oss, insn.c);
+            break;
+    }
+
+    return oss.str();
+}
+
+std::ostream &operator <<(std::ostream &os, const reg_code &code)
+{
+    for(const auto &insn : code.insns)
+        os << reg_insn_to_string(insn) << std::endl;
+    return os;
+}
+
+} // namespace emel
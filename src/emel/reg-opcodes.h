@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "opcodes.h"
+
+#include <vector>
+
+namespace emel {
+
+/// Three-address instructions of the register tier.
+/// Registers are frame slots: locals first, then temporaries
+/// in place of the operand stack of the stack code.
+enum class reg_opcode : unsigned char {
+    move, ///< a = b
+    swap, ///< Exchange registers a and b
+    ret, ///< Return a, if b is not zero
+
+    not_, ///< a = !b
+    neg, ///< a = -b
+
+    or_, ///< a = b || c
+    xor_, ///< a = !b != !c
+    and_, ///< a = b && c
+    eq, ///< a = b == c
+    ne, ///< a = b != c
+    lt, ///< a = b < c
+    gt, ///< a = b > c
+    lte, ///< a = b <= c
+    gte, ///< a = b >= c
+    add, ///< a = b + c
+    sub, ///< a = b - c
+    mul, ///< a = b * c
+    div, ///< a = b / c
+
+    jmp, ///< Unconditional branch by signed offset b
+    jt, ///< Branch by signed offset b, if a is true
+    jf, ///< Branch by signed offset b, if a is false
+    max_opcode
+};
+
+/// Operand of the register instruction: register,
+/// index in the const pool or small immediate number.
+struct reg_operand {
+    enum kind : std::uint32_t {
+        reg = 0, constant = 1u << 30, immediate = 2u << 30
+    };
+
+    static constexpr std::uint32_t kind_mask = 3u << 30;
+
+    static constexpr std::uint32_t make(kind k, std::uint32_t idx) { return k | idx; }
+    static constexpr kind kind_of(std::uint32_t op) { return static_cast<kind>(op & kind_mask); }
+    static constexpr std::uint32_t index_of(std::uint32_t op) { return op & ~kind_mask; }
+};
+
+struct reg_insn {
+    reg_opcode op;
+    std::uint32_t a, b, c;
+};
+
+struct reg_code {
+    std::vector<reg_insn> insns;
+    std::uint32_t nr_locals = 0, nr_regs = 0;
+};
+
+const char *reg_opcode_name(reg_opcode op);
+
+std::string reg_insn_to_string(const reg_insn &insn);
+
+EMEL_EXPORT std::ostream &operator <<(std::ostream &os, const reg_code &code);
+
+} // namespace emel
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "branch-table.h"
+#include "../type-system/context.h"
+#include "../type-system/str-kernels.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+namespace emel { namespace runtime {
+
+namespace {
+
+/// Sort the pairs by their keys, of the equal keys the last one in the code
+/// wins, as for the unsealed br_table searching from the top of the stack
+template <typename Pairs, typename Less>
+void sort_keys(Pairs &pairs, Less less)
+{
+    std::stable_sort(pairs.begin(), pairs.end(), less);
+
+    auto out = pairs.begin();
+    for(auto it = pairs.begin(); it != pairs.end(); ++it) {
+        if(out != pairs.begin() && !less(out[-1], *it))
+            out[-1].second = it->second;
+        else {
+            if(out != it)
+                *out = std::move(*it);
+            ++out;
+        }
+    }
+
+    pairs.erase(out, pairs.end());
+}
+
+} // anonymous namespace
+
+branch_table::branch_table(const linked_insn *pairs, std::uint32_t nr_pairs,
+                           const std::vector<value_type> &const_pool)
+{
+    bool integral = true;
+
+    for(std::uint32_t idx = 0; idx < nr_pairs; ++idx, pairs += 2) {
+        assert(opcode::push == pairs[0].op && opcode::push_const == pairs[1].op);
+        const std::uint32_t offset = pairs[0].arg;
+        const value_type &key = const_pool.at(pairs[1].arg);
+
+        if(const double *num = boost::get<double>(&key)) {
+            integral = integral && std::trunc(*num) == *num
+                && std::fabs(*num) < double(std::int64_t(1) << 52);
+            nums.emplace_back(*num, offset);
+        } else if(const std::string *str = boost::get<std::string>(&key))
+            strings.emplace_back(*str, offset);
+        else
+            throw std::runtime_error("branch table key must be a number or a string");
+    }
+
+    sort_keys(nums,
+        [](const std::pair<double, std::uint32_t> &lhs,
+           const std::pair<double, std::uint32_t> &rhs) {
+            return lhs.first < rhs.first;
+        });
+    sort_keys(strings,
+        [](const std::pair<std::string, std::uint32_t> &lhs,
+           const std::pair<std::string, std::uint32_t> &rhs) {
+            return str_compare(lhs.first, rhs.first) < 0;
+        });
+
+    if(integral && !nums.empty()) {
+        const auto first = std::int64_t(nums.front().first);
+        const auto last = std::int64_t(nums.back().first);
+
+        if(std::uint64_t(last - first) < 2 * nums.size()) {
+            min_key = first;
+            dense.assign(std::size_t(last - first + 1), 0);
+            for(const auto &entry : nums)
+                dense[std::size_t(std::int64_t(entry.first) - first)] = entry.second;
+        }
+    }
+}
+
+std::uint32_t branch_table::lookup_num(double num) const
+{
+    auto it = std::lower_bound(nums.begin(), nums.end(), num,
+        [](const std::pair<double, std::uint32_t> &entry, double key) {
+            return entry.first < key;
+        });
+
+    return (nums.end() != it && it->first == num) ? it->second : 0;
+}
+
+std::uint32_t branch_table::lookup_string(const object &value) const
+{
+    if(strings.empty())
+        return 0;
+
+    // compared in place, without copying the switch value
+    const boost::string_ref str = str_view(value.get_rep());
+    auto it = std::lower_bound(strings.begin(), strings.end(), str,
+        [](const std::pair<std::string, std::uint32_t> &entry, boost::string_ref key) {
+            return str_compare(entry.first, key) < 0;
+        });
+
+    return (strings.end() != it && str_equal(it->first, str)) ? it->second : 0;
+}
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "code.h"
+#include "object.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+/// Lookup structure of a sealed br_table, maps the switch value
+/// to the branch offset of its case. Integral keys covering at least
+/// a half of their range go to an index table, other numbers and
+/// strings to sorted arrays searched by bisection.
+class EMEL_EXPORT branch_table
+{
+    std::int64_t min_key = 0;
+    std::vector<std::uint32_t> dense; ///< Offsets by key - min_key, 0 for holes
+    std::vector<std::pair<double, std::uint32_t>> nums;
+    std::vector<std::pair<std::string, std::uint32_t>> strings;
+
+public:
+    /// Build the table of the (push offset, push_const key) pairs,
+    /// which follow the sealed br_table instruction in the code
+    branch_table(const linked_insn *pairs, std::uint32_t nr_pairs,
+                 const std::vector<value_type> &const_pool);
+
+    /// Offset of the case matching @a value, 0 if there is no such case
+    std::uint32_t lookup(const object &value) const
+    {
+        const type::rep &r = value.get_rep();
+        double num;
+
+        if(__builtin_expect(r.is_local_num(), true))
+            num = r.local_num();
+        else if(r.is_local_int())
+            num = double(r.local_int());
+        else if(type::kind::str == value.get_type())
+            return lookup_string(value);
+        else if(type::kind::num == value.get_type() || type::kind::int_ == value.get_type())
+            num = r.ops().get_num(r); // boxed out of the local ranges
+        else
+            return 0;
+
+        if(!dense.empty()) {
+            const double rel = num - double(min_key);
+            if(!(rel >= 0 && rel < double(dense.size())))
+                return 0;
+
+            const std::size_t idx = std::size_t(rel);
+            return double(idx) == rel ? dense[idx] : 0;
+        }
+
+        return lookup_num(num);
+    }
+
+    bool is_dense() const noexcept { return !dense.empty(); }
+
+private:
+    std::uint32_t lookup_num(double num) const;
+    std::uint32_t lookup_string(const object &value) const;
+};
+
+} // namespace runtime
+
+} // namespace emel
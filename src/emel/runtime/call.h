@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../type-system/context.h"
+#include "code.h"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+/// Method in the function table of the interpreter.
+/// Its parameters are the first locals of the frame.
+struct function
+{
+    const linked_insn *start_pc, *end_pc;
+    std::uint32_t nr_params, locals_size, stack_size;
+    const context_info *whois; ///< Class of the method, null for a free function
+};
+
+/// Fill the vtable of the class: funcs_offsets maps the method slot,
+/// numbered by codegen from the methods_offset of the class, to the index
+/// in the function table, funcs_map maps the name to the slot.
+/// Slots of the base class come first; a method named as one of the base
+/// methods also takes over its slot, except the constructor.
+inline void build_vtable(context_info &cls, const context_info *base,
+    const std::vector<std::pair<std::string, std::uint32_t>> &methods)
+{
+    cls.funcs_offsets.clear();
+    cls.funcs_map.clear();
+
+    if(base) {
+        cls.funcs_offsets.assign(base->funcs_offsets.begin(), base->funcs_offsets.end());
+        cls.funcs_map = base->funcs_map;
+    }
+
+    for(const auto &method : methods) {
+        const offset_t slot = offset_t(cls.funcs_offsets.size());
+        cls.funcs_offsets.push_back(method.second);
+
+        auto it = cls.funcs_map.find(method.first);
+        if(cls.funcs_map.end() == it)
+            cls.funcs_map.emplace(method.first, slot);
+        else {
+            if("~init" != method.first)
+                cls.funcs_offsets[std::size_t(it->second)] = method.second;
+            it->second = slot;
+        }
+    }
+}
+
+/// Cache of a call site: the callee resolved for the class
+/// of the last receiver, or of the calling method for call by name.
+struct call_cache
+{
+    const context_info *whois = nullptr;
+    std::uint32_t callee = 0;
+    std::uint32_t hits = 0, misses = 0;
+
+    bool empty() const noexcept { return !whois; }
+};
+
+/// Totals of the call caches of an interpreter
+struct call_cache_stats
+{
+    std::size_t hits = 0, misses = 0;
+};
+
+/// Index in the function table of the method at @a slot of the vtable
+inline std::uint32_t vtable_lookup(const context_info &whois, std::uint32_t slot)
+{
+    if(slot >= whois.funcs_offsets.size())
+        throw std::out_of_range("method slot " + std::to_string(slot)
+            + " is out of range of " + whois.name.get());
+    return std::uint32_t(whois.funcs_offsets[slot]);
+}
+
+/// Slot of the method named @a name in the vtable of the class
+inline std::uint32_t vtable_slot(const context_info &whois, const std::string &name)
+{
+    auto it = whois.funcs_map.find(name);
+    if(whois.funcs_map.end() == it)
+        throw std::runtime_error("method " + name + " not found in " + whois.name.get());
+    return std::uint32_t(it->second);
+}
+
+} // namespace runtime
+
+} // namespace emel
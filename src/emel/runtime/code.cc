@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "code.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+void code_object::deleter::operator()(linked_insn *ptr) const noexcept
+{
+    std::free(ptr);
+}
+
+code_object::code_object(const insn_array &code)
+    : code_object(code.cbegin(), code.cend())
+{
+}
+
+code_object::code_object(insn_array::const_iterator first, insn_array::const_iterator last)
+    : nr_insns(std::size_t(last - first))
+{
+    if(!nr_insns)
+        return;
+
+    // round up to whole cache lines, so no other data shares the last one
+    const auto bytes = (nr_insns * sizeof(linked_insn) + alignment - 1) & ~(alignment - 1);
+
+    void *mem = nullptr;
+    if(0 != ::posix_memalign(&mem, alignment, bytes))
+        throw std::bad_alloc();
+
+    insns.reset(static_cast<linked_insn *>(mem));
+
+    for(auto *ptr = insns.get(); first != last; ++first, ++ptr) {
+        const auto pair = insn_decode(*first);
+        ptr->op = pair.first;
+        ptr->arg = pair.second;
+    }
+
+    seal_branch_tables();
+}
+
+void code_object::seal_branch_tables()
+{
+    std::vector<bool> targets;
+
+    for(std::size_t idx = 0; idx < nr_insns; ++idx) {
+        const std::uint32_t nr_pairs = insns[idx].arg;
+
+        if(opcode::br_table != insns[idx].op || !nr_pairs || 2 * std::size_t(nr_pairs) > idx)
+            continue;
+
+        const std::size_t first = idx - 2 * std::size_t(nr_pairs);
+        bool pairs = true;
+
+        for(std::size_t pos = first; pairs && pos < idx; pos += 2)
+            pairs = opcode::push == insns[pos].op && opcode::push_const == insns[pos + 1].op;
+
+        if(!pairs)
+            continue;
+
+        if(targets.empty()) {
+            targets.assign(nr_insns + 1, false);
+
+            for(std::size_t pos = 0; pos < nr_insns; ++pos) {
+                const auto op = insns[pos].op;
+                const auto arg = insns[pos].arg;
+
+                if((opcode::brf == op || opcode::brf_true == op || opcode::brf_false == op)
+                        && pos + arg <= nr_insns)
+                    targets[pos + arg] = true;
+                else if((opcode::brb == op || opcode::brb_true == op || opcode::brb_false == op)
+                        && arg <= pos)
+                    targets[pos - arg] = true;
+            }
+        }
+
+        // a branch into the pairs needs them pushed as they are
+        if(std::any_of(targets.begin() + std::ptrdiff_t(first) + 1,
+                       targets.begin() + std::ptrdiff_t(idx) + 1, [](bool b) { return b; }))
+            continue;
+
+        std::rotate(insns.get() + first, insns.get() + idx, insns.get() + idx + 1);
+        insns[first].arg |= br_table_sealed;
+    }
+}
+
+std::ostream &operator <<(std::ostream &os, const code_object &code)
+{
+    for(const auto &insn : code)
+        os << insn_to_string(insn_encode(insn.op, opcode::br_table == insn.op
+            ? insn.arg & ~br_table_sealed : insn.arg)) << std::endl;
+    return os;
+}
+
+} // namespace runtime
+
+} // namespace emel
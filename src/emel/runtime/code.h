@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../opcodes.h"
+
+#include <memory>
+
+namespace emel { namespace runtime {
+
+/// Decoded instruction of the linked code
+struct linked_insn {
+    opcode op;
+    std::uint32_t arg;
+};
+
+static_assert(sizeof(linked_insn) == 8, "linked instruction must fit in 8 bytes");
+
+/// Flag of the br_table argument, set when code_object moved the instruction
+/// in front of its (push offset, push_const key) pairs. Such table is never
+/// pushed on the stack, the interpreter reads the pairs from the code.
+static constexpr std::uint32_t br_table_sealed = 1u << 31;
+
+/// Immutable flat code buffer which codegen output is sealed into
+/// before execution. Instructions are decoded once and stored in
+/// cache-line aligned memory, so the interpreter walks them
+/// with plain pointers. Branch tables are sealed on the way,
+/// see br_table_sealed.
+class EMEL_EXPORT code_object
+{
+    struct deleter {
+        void operator()(linked_insn *ptr) const noexcept;
+    };
+
+    std::unique_ptr<linked_insn[], deleter> insns;
+    std::size_t nr_insns = 0;
+
+public:
+    static constexpr std::size_t alignment = 64;
+
+    code_object() = default;
+    explicit code_object(const insn_array &code);
+    code_object(insn_array::const_iterator first, insn_array::const_iterator last);
+
+    code_object(code_object &&) = default;
+    code_object &operator =(code_object &&) = default;
+
+    const linked_insn *begin() const noexcept { return insns.get(); }
+    const linked_insn *end() const noexcept { return insns.get() + nr_insns; }
+    const linked_insn &operator[](std::size_t idx) const noexcept { return insns[idx]; }
+    std::size_t size() const noexcept { return nr_insns; }
+    bool empty() const noexcept { return 0 == nr_insns; }
+
+private:
+    void seal_branch_tables();
+};
+
+EMEL_EXPORT std::ostream &operator <<(std::ostream &os, const code_object &code);
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../type-system/context.h"
+#include "object.h"
+
+#include <cassert>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+/// New object holding the value of the constant
+inline object make_object(const value_type &value)
+{
+    switch(value.which()) {
+        case 0: return object();
+        case 1: {
+            // equal literals of all modules share one string_data
+            const auto &str = boost::get<std::string>(value);
+            return object(string_data::intern(str.data(), str.size()));
+        }
+        case 2: return boost::get<double>(value);
+        case 3: return boost::get<bool>(value);
+        default: assert(false);
+    }
+
+    return object();
+}
+
+/// Constants of the code converted into objects once, when the code is
+/// loaded. Objects share the interned storage of long strings, so pushing
+/// a constant copies the rep or bumps its refcount and never allocates.
+/// The objects are immutable, the pool is never changed after loading.
+class materialized_pool
+{
+    std::vector<object> objects;
+
+public:
+    explicit materialized_pool(const std::vector<value_type> &const_pool)
+    {
+        objects.reserve(const_pool.size());
+        for(const auto &value : const_pool)
+            objects.push_back(make_object(value));
+    }
+
+    const object &operator[](std::size_t idx) const noexcept
+    {
+        assert(idx < objects.size());
+        return objects[idx];
+    }
+
+    const object *data() const noexcept { return objects.data(); }
+    std::size_t size() const noexcept { return objects.size(); }
+};
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../opcodes.h"
+#include "object.h"
+
+namespace emel { namespace runtime {
+
+/// Operators on unboxed numbers and booleans, computed inline on the
+/// tag bits of the operands without the virtual object operators.
+/// Ints are computed as nums, the same as by the generic operators.
+/// Returns false, if the operands need the generic path.
+inline bool eval_fast_op(op_kind kind, const object &lhs, const object &rhs, object &res)
+{
+    const type::rep &l = lhs.get_rep();
+    const type::rep &r = rhs.get_rep();
+
+    switch(kind) {
+        case op_kind::not_:
+            if(!l.is_bool())
+                return false;
+            res = !l.local_bool();
+            return true;
+
+        case op_kind::neg:
+            if(l.is_local_num())
+                res = -l.local_num();
+            else if(l.is_local_int())
+                res = -double(l.local_int());
+            else
+                return false;
+            return true;
+
+        case op_kind::or_:
+        case op_kind::xor_:
+        case op_kind::and_:
+            if(!l.is_bool() || !r.is_bool())
+                return false;
+            switch(kind) {
+                case op_kind::or_: res = l.local_bool() || r.local_bool(); break;
+                case op_kind::xor_: res = l.local_bool() != r.local_bool(); break;
+                default: res = l.local_bool() && r.local_bool(); break;
+            }
+            return true;
+
+        default:
+            break;
+    }
+
+    if(l.is_bool() && r.is_bool()) {
+        switch(kind) {
+            case op_kind::eq: res = l.local_bool() == r.local_bool(); return true;
+            case op_kind::ne: res = l.local_bool() != r.local_bool(); return true;
+            default: return false;
+        }
+    }
+
+    double a, b;
+
+    if(__builtin_expect(l.is_local_num(), true))
+        a = l.local_num();
+    else if(l.is_local_int())
+        a = double(l.local_int());
+    else
+        return false;
+
+    if(__builtin_expect(r.is_local_num(), true))
+        b = r.local_num();
+    else if(r.is_local_int())
+        b = double(r.local_int());
+    else
+        return false;
+
+    switch(kind) {
+        case op_kind::eq: res = a == b; break;
+        case op_kind::ne: res = a != b; break;
+        case op_kind::lt: res = a < b; break;
+        case op_kind::gt: res = a > b; break;
+        case op_kind::lte: res = a <= b; break;
+        case op_kind::gte: res = a >= b; break;
+        case op_kind::add: res = a + b; break;
+        case op_kind::sub: res = a - b; break;
+        case op_kind::mul: res = a * b; break;
+        case op_kind::div: res = a / b; break;
+        default: return false;
+    }
+
+    return true;
+}
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../type-system/context.h"
+#include "../type-system/type-builtins.h"
+#include "object.h"
+
+#include <stdexcept>
+
+namespace emel { namespace runtime {
+
+/// Make new instance of the class with @a nr_fields empty fields
+inline object make_instance(const memory_ptr<context_info> &whois, std::size_t nr_fields)
+{
+    type::rep r;
+    r.set(memory::counted_ptr(memory::make_counted<instance_data>(whois, nr_fields), false));
+    return object(std::move(r));
+}
+
+/// Instance data of the object, or null if it is not an instance
+inline instance_data *get_instance(const object &obj) noexcept
+{
+    const type::rep &r = obj.get_rep();
+    if(!r.is_ptr())
+        return nullptr;
+
+    auto *const info = r.get_counted_unchecked()->get<object_info>();
+    return (info && inst::get() == info->t)
+        ? reinterpret_cast<instance_data *>(info) : nullptr;
+}
+
+/// Inline cache of a field access site. Keeps offsets of the field
+/// resolved for up to max_entries classes; after that the site
+/// is megamorphic and resolves the offset on every access.
+struct field_cache
+{
+    static constexpr std::size_t max_entries = 4;
+
+    struct entry {
+        const context_info *whois;
+        offset_t offset;
+    };
+
+    entry entries[max_entries];
+    std::uint32_t nr_entries = 0;
+    std::uint32_t hits = 0, misses = 0;
+    bool megamorphic = false;
+
+    offset_t lookup(const context_info &whois, std::uint32_t field_idx)
+    {
+        for(std::uint32_t idx = 0; idx < nr_entries; ++idx) {
+            if(__builtin_expect(entries[idx].whois == &whois, true)) {
+                ++hits;
+                return entries[idx].offset;
+            }
+        }
+
+        ++misses;
+        const offset_t offset = resolve(whois, field_idx);
+
+        if(nr_entries < max_entries)
+            entries[nr_entries++] = { &whois, offset };
+        else
+            megamorphic = true;
+
+        return offset;
+    }
+
+    bool empty() const noexcept { return 0 == nr_entries; }
+    bool monomorphic() const noexcept { return 1 == nr_entries; }
+    bool polymorphic() const noexcept { return nr_entries > 1 && !megamorphic; }
+
+    static offset_t resolve(const context_info &whois, std::uint32_t field_idx)
+    {
+        if(field_idx >= whois.fields_offsets.size())
+            throw std::out_of_range("field index " + std::to_string(field_idx)
+                + " is out of range of " + whois.name.get());
+        return whois.fields_offsets[field_idx];
+    }
+};
+
+/// Totals of the field caches of an interpreter
+struct field_cache_stats
+{
+    std::size_t hits = 0, misses = 0;
+    std::size_t monomorphic = 0, polymorphic = 0, megamorphic = 0;
+};
+
+} // namespace runtime
+
+} // namespace emel
@@ -20,257 +20,963 @@
 #pragma once
 
 #include "../opcodes.h"
+#include "../type-system/map-data.h"
+#include "branch-table.h"
+#include "call.h"
+#include "code.h"
+#include "const-pool.h"
+#include "fast-ops.h"
+#include "inline-cache.h"
+#include "jit.h"
 #include "object.h"
+#include "profiler.h"
+#include "stack.h"
 
+#include <cstring>
+#include <unordered_map>
 #include <vector>
-#include <stack>
-#include <array>
 
 namespace emel { namespace runtime {
 
-struct frame : public object {
+struct frame {
     const std::vector<value_type> &const_pool;
-    insn_array::const_iterator pc;
-    const insn_array::const_iterator start_pc, end_pc;
-    std::vector<object> locals, stack;
-    std::shared_ptr<frame> super_frame, caller_frame;
+    const object *consts = nullptr; ///< Materialized const_pool
+    const linked_insn *pc;
+    const linked_insn *const start_pc, *const end_pc;
+    object *locals;
+    object *const stack_base, *const stack_limit;
+    object *sp;
+    const std::size_t locals_size, segment_idx;
+    /// Enclosing frame, it's below this one on the frame stack
+    frame *const super_frame, *const caller_frame;
+    const context_info *whois = nullptr;
+    field_cache *field_caches = nullptr;
+    call_cache *call_caches = nullptr;
+    jit_method *jit = nullptr;
 
     frame(const std::vector<value_type> &const_pool,
-          insn_array::const_iterator start_pc,
-          insn_array::const_iterator end_pc,
-          std::size_t locals_size, std::size_t stack_size,
-          std::shared_ptr<frame> super_frame = std::shared_ptr<frame>())
+          const linked_insn *start_pc,
+          const linked_insn *end_pc,
+          object *window, object *window_limit,
+          std::size_t locals_size, std::size_t segment_idx,
+          frame *super_frame, frame *caller_frame)
         : const_pool(const_pool), pc(start_pc), start_pc(start_pc), end_pc(end_pc)
-        , locals(locals_size)
-        , super_frame(super_frame)
+        , locals(window), stack_base(window + locals_size), stack_limit(window_limit)
+        , sp(stack_base), locals_size(locals_size), segment_idx(segment_idx)
+        , super_frame(super_frame), caller_frame(caller_frame)
     {
-        stack.reserve(stack_size);
     }
 
-    void set_caller(std::shared_ptr<frame> caller) {
-        caller_frame = std::move(caller);
+    std::size_t depth() const noexcept { return std::size_t(sp - stack_base); }
+    bool empty() const noexcept { return sp == stack_base; }
+
+    object &back() noexcept {
+        assert(!empty());
+        return sp[-1];
+    }
+
+    void push(object value) {
+        assert(sp < stack_limit);
+        *sp++ = std::move(value);
     }
 
-    void drop_caller() {
-        caller_frame.reset();
+    object pop() {
+        assert(!empty());
+        return std::move(*--sp);
     }
+
+    void drop(std::size_t count = 1) {
+        assert(depth() >= count);
+        while(count--)
+            *--sp = object();
+    }
+};
+
+#if defined(__GNUC__) && !defined(EMEL_NO_COMPUTED_GOTO)
+# define EMEL_HAS_COMPUTED_GOTO 1
+#endif
+
+enum class dispatch_mode {
+    switch_, ///< Decode each instruction and dispatch it through one switch
+    threaded ///< Pre-translate code into a stream of handler addresses
+};
+
+#if defined(EMEL_HAS_COMPUTED_GOTO) && defined(EMEL_THREADED_DISPATCH)
+static constexpr dispatch_mode default_dispatch_mode = dispatch_mode::threaded;
+#else
+static constexpr dispatch_mode default_dispatch_mode = dispatch_mode::switch_;
+#endif
+
+/// Direct-threaded instruction: address of the handler and its inline operand
+struct threaded_insn {
+    const void *handler;
+    std::uint32_t arg;
 };
 
+using threaded_code = std::vector<threaded_insn>;
+
 class interp
 {
 protected:
-    std::shared_ptr<frame> top_frame;
+    value_stack values;
+    bump_arena<frame> frames;
+    frame *top_frame = nullptr;
+    dispatch_mode mode = default_dispatch_mode;
+    std::unordered_map<const linked_insn *, threaded_code> threaded_cache;
+    std::unordered_map<const std::vector<value_type> *, materialized_pool> const_pools;
+    std::unordered_map<const linked_insn *, std::vector<field_cache>> field_caches;
+    std::unordered_map<const linked_insn *, std::vector<call_cache>> call_caches;
+    std::unordered_map<const linked_insn *, branch_table> branch_tables;
+    std::vector<function> functions;
+    std::unordered_map<const linked_insn *, jit_method> jit_methods;
+    std::vector<double> jit_slots;
+    std::uint32_t jit_threshold = 0;
+    profiler *prof = nullptr;
 
 public:
-  template <typename... Args>
-    explicit interp(Args &&...args) {
-        top_frame = std::make_shared<frame>(std::forward<Args>(args)...);
+    interp(const std::vector<value_type> &const_pool,
+           const linked_insn *start_pc, const linked_insn *end_pc,
+           std::size_t locals_size, std::size_t stack_size)
+    {
+        push_frame(const_pool, start_pc, end_pc, locals_size, stack_size);
+    }
+
+    /// Start from the function @a entry of the table with @a args as its parameters
+    interp(const std::vector<value_type> &const_pool, std::vector<function> funcs,
+           std::uint32_t entry, std::vector<object> args = { })
+        : functions(std::move(funcs))
+    {
+        const function &fn = functions.at(entry);
+        if(args.size() != fn.nr_params)
+            throw std::runtime_error("wrong number of arguments");
+
+        push_frame(const_pool, fn.start_pc, fn.end_pc, fn.locals_size, fn.stack_size);
+        top_frame->whois = fn.whois;
+
+        for(std::size_t idx = 0; idx < args.size(); ++idx)
+            top_frame->locals[idx] = std::move(args[idx]);
+    }
+
+    interp(const interp &) = delete;
+    interp &operator =(const interp &) = delete;
+
+    /// Open the window of the callee right above the operand stack of the caller
+    void push_frame(const std::vector<value_type> &const_pool,
+                    const linked_insn *start_pc, const linked_insn *end_pc,
+                    std::size_t locals_size, std::size_t stack_size,
+                    frame *super_frame = nullptr)
+    {
+        std::size_t segment_idx;
+        object *const window = values.reserve(top_frame ? top_frame->sp : nullptr,
+            locals_size + stack_size, segment_idx);
+
+        top_frame = frames.emplace(const_pool, start_pc, end_pc,
+            window, values.segment_end(segment_idx), locals_size,
+            segment_idx, super_frame, top_frame);
+        top_frame->consts = materialize(const_pool);
     }
 
-  template <typename... Args>
-    void push_frame(Args &&...args) {
-        auto callee_frame = std::make_shared<frame>(std::forward<Args>(args)...);
-        callee_frame->set_caller(std::move(top_frame));
-        top_frame = callee_frame;
+    /// Enter the function with the arguments on top of the stack of the
+    /// current frame. The callee window starts at the first argument,
+    /// so the arguments become its first locals without copying.
+    void call_function(const function &fn)
+    {
+        frame *const caller_frame = top_frame;
+        assert(fn.locals_size >= fn.nr_params);
+        assert(caller_frame->depth() >= fn.nr_params);
+
+        object *const args = caller_frame->sp - fn.nr_params;
+        caller_frame->sp = args;
+
+        std::size_t segment_idx;
+        object *const window = values.reserve(args,
+            fn.locals_size + fn.stack_size, segment_idx);
+
+        // the window didn't fit, it is at the beginning of the next segment
+        if(__builtin_expect(window != args, false))
+            for(std::size_t idx = 0; idx < fn.nr_params; ++idx)
+                window[idx].swap(args[idx]);
+
+        top_frame = frames.emplace(caller_frame->const_pool, fn.start_pc, fn.end_pc,
+            window, values.segment_end(segment_idx), fn.locals_size,
+            segment_idx, nullptr, caller_frame);
+        top_frame->consts = caller_frame->consts;
+        top_frame->whois = fn.whois;
+    }
+
+    /// Register the method in the function table, returns its index
+    std::uint32_t add_function(const function &fn)
+    {
+        assert(fn.locals_size >= fn.nr_params);
+        functions.push_back(fn);
+        return std::uint32_t(functions.size() - 1);
     }
 
+    const function &get_function(std::uint32_t idx) const { return functions.at(idx); }
+
     void drop_frame()
     {
-        auto callee_frame = top_frame;
-        top_frame = top_frame->caller_frame;
-        callee_frame->drop_caller();
+        frame *const callee_frame = top_frame;
+
+        // values of the window are released now, the slots stay for reuse
+        for(std::size_t idx = 0; idx < callee_frame->locals_size; ++idx)
+            callee_frame->locals[idx] = object();
+
+        callee_frame->drop(callee_frame->depth());
+
+        top_frame = callee_frame->caller_frame;
+        values.release(top_frame ? top_frame->segment_idx : 0);
+        frames.pop();
+    }
+
+    std::size_t frames_count() const noexcept { return frames.size(); }
+
+    /// Hit and miss counters and states of all field access sites
+    field_cache_stats get_field_cache_stats() const
+    {
+        field_cache_stats stats;
+
+        for(const auto &pair : field_caches) {
+            for(const auto &cache : pair.second) {
+                stats.hits += cache.hits;
+                stats.misses += cache.misses;
+                if(cache.megamorphic)
+                    ++stats.megamorphic;
+                else if(cache.polymorphic())
+                    ++stats.polymorphic;
+                else if(cache.monomorphic())
+                    ++stats.monomorphic;
+            }
+        }
+
+        return stats;
+    }
+
+    /// Hit and miss counters of all call sites
+    call_cache_stats get_call_cache_stats() const
+    {
+        call_cache_stats stats;
+
+        for(const auto &pair : call_caches) {
+            for(const auto &cache : pair.second) {
+                stats.hits += cache.hits;
+                stats.misses += cache.misses;
+            }
+        }
+
+        return stats;
+    }
+
+    dispatch_mode get_dispatch_mode() const { return mode; }
+
+    /// Select the dispatch engine; threaded mode needs labels-as-values
+    /// support, without it the interpreter stays on the switch loop.
+    void set_dispatch_mode(dispatch_mode m) {
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        mode = m;
+#else
+        (void) m;
+#endif
+    }
+
+    /// Compile methods to native code after @a threshold entries and
+    /// backward branches; 0 disables the JIT. Without the JIT support
+    /// for the target, the interpreter keeps running all of the code.
+    void set_jit_threshold(std::uint32_t threshold) {
+#if defined(EMEL_HAS_JIT)
+        jit_threshold = threshold;
+#else
+        (void) threshold;
+#endif
+    }
+
+    jit_stats get_jit_stats() const
+    {
+        jit_stats stats;
+
+        for(const auto &pair : jit_methods) {
+            const jit_method &m = pair.second;
+            stats.compiled += m.code ? 1 : 0;
+            stats.failed += m.failed ? 1 : 0;
+            stats.native_runs += m.native_runs;
+            stats.deopts += m.deopts;
+        }
+
+        return stats;
     }
 
+    /// Attach the profiler, null detaches it. The profiler must outlive
+    /// the runs of the interpreter; without it the loop is not instrumented.
+    void set_profiler(profiler *p) { prof = p; }
+    profiler *get_profiler() const noexcept { return prof; }
+
     object run() {
-        object ret_value;
+        if(__builtin_expect(nullptr != prof, false)) {
+            const std::size_t depth = prof->depth();
+            try {
+                return run_profiled();
+            } catch(...) {
+                prof->unwind(depth);
+                throw;
+            }
+        }
 
-        while(true) {
-            frame &top = *top_frame;
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        if(dispatch_mode::threaded == mode)
+            return run_loop<true, false>();
+#endif
+        return run_loop<false, false>();
+    }
 
-            assert(top.start_pc <= top.pc);
-            assert(top.pc < top.end_pc);
+protected:
+    object run_profiled() {
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        if(dispatch_mode::threaded == mode)
+            return run_loop<true, true>();
+#endif
+        return run_loop<false, true>();
+    }
 
-            opcode op;
-            std::uint32_t arg;
+    /// Translate the code of the frame into the threaded form once
+    /// and return the beginning of the translated code.
+    const threaded_insn *enter_threaded(const frame &f, const void *const *handlers)
+    {
+        const linked_insn *const key = f.start_pc;
+        auto it = threaded_cache.find(key);
 
-            std::tie(op, arg) = insn_decode(*top.pc);
+        if(threaded_cache.end() == it) {
+            threaded_code code;
+            code.reserve(std::size_t(f.end_pc - f.start_pc));
 
-            switch (op) {
-                case opcode::pop:
-                    if(!arg) arg = 1;
-                    assert(top.stack.size() >= arg);
-                    while(arg--)
-                        top.stack.pop_back();
-                    break;
+            for(auto pc = f.start_pc; pc != f.end_pc; ++pc) {
+                assert(pc->op < opcode::max_opcode);
+                code.push_back({ handlers[static_cast<std::size_t>(pc->op)], pc->arg });
+            }
 
-                case opcode::dup:
-                    assert(!top.stack.empty());
-                    if(!arg) arg = 1;
-                    while(arg--)
-                        top.stack.push_back(top.stack.back());
-                    break;
+            it = threaded_cache.emplace(key, std::move(code)).first;
+        }
 
-                case opcode::swap:
-                    assert(top.stack.size() > 1);
-                    std::swap(top.stack.back(), *(top.stack.end() - 2));
-                    break;
+        assert(it->second.size() == std::size_t(f.end_pc - f.start_pc));
+        return it->second.data();
+    }
 
-                case opcode::ret:
-                    if(arg > 0) {
-                        assert(!top.stack.empty());
-                        ret_value = std::move(top.stack.back());
-                    }
+    enum class jit_status { interpreted, returned, deoptimized };
 
-                    drop_frame();
+    /// Count the entry of the frame's method and run it natively, if it
+    /// is hot. Locals are unboxed into the slots of the native code,
+    /// which requires all of them to be numbers or not assigned yet.
+    /// The code leaves with the result in @a value, or with the frame
+    /// filled up to resume in the interpreter.
+    jit_status enter_jit(frame &f, object &value)
+    {
+        jit_method &m = jit_methods[f.start_pc];
+        f.jit = &m;
 
-                    if(!top_frame)
-                        return ret_value;
-                    else
-                        top_frame->stack.push_back(std::move(ret_value));
+        if(f.pc != f.start_pc || f.locals_size > jit_compiler::max_locals)
+            return jit_status::interpreted;
 
-                    break;
+        std::uint64_t assigned = 0;
 
-                case opcode::push:
-                    top.stack.push_back(object(double(arg)));
-                    break;
+        for(std::size_t idx = 0; idx < f.locals_size; ++idx) {
+            const type::rep &r = f.locals[idx].get_rep();
+            if(r.is_local_num())
+                assigned |= std::uint64_t(1) << idx;
+            else if(!r.is_none())
+                return jit_status::interpreted;
+        }
 
-                case opcode::push_const: {
-                    assert(top.const_pool.size() > arg);
-                    const auto &value = top.const_pool[arg];
-                    switch(value.which()) {
-                        case 0: top.stack.push_back(object()); break;
-                        case 1: top.stack.push_back(boost::get<std::string>(value)); break;
-                        case 2: top.stack.push_back(boost::get<double>(value)); break;
-                        case 3: top.stack.push_back(boost::get<bool>(value)); break;
-                        default: assert(false);
-                    }
-                }
-                    break;
+        if(!m.code) {
+            if(m.failed || ++m.counter < jit_threshold)
+                return jit_status::interpreted;
 
-                case opcode::push_local:
-                    assert(top.locals.size() > arg);
-                    top.stack.push_back(top.locals[arg]);
-                    break;
+            m.code = jit_compiler::compile(f.start_pc, f.end_pc,
+                f.locals_size, assigned, f.const_pool);
+            m.assigned = assigned;
 
-                case opcode::load_local:
-                    assert(!top.stack.empty());
-                    assert(top.locals.size() > arg);
-                    top.locals[arg] = std::move(top.stack.back());
-                    top.stack.pop_back();
-                    break;
+            if(!m.code) {
+                m.failed = true;
+                return jit_status::interpreted;
+            }
+        }
 
-                case opcode::call_op: {
-                    const auto kind = static_cast<op_kind>(arg);
-                    if(op_kind::not_ == kind || op_kind::neg == kind) {
-                        assert(!top.stack.empty());
-                        const object top_object = std::move(top.stack.back());
-                        top.stack.pop_back();
-
-                        switch(static_cast<op_kind>(arg)) {
-                            case op_kind::not_: top.stack.push_back(!top_object); break;
-                            case op_kind::neg: top.stack.push_back(- (double) top_object); break;
-                            default: assert(false);
-                        }
-
-                    } else {
-                        assert(top.stack.size() > 1);
-                        const object lhs = std::move(top.stack.back());
-                        top.stack.pop_back();
-                        const object rhs = std::move(top.stack.back());
-                        top.stack.pop_back();
-
-                        object res;
-
-                        switch(static_cast<op_kind>(arg)) {
-                            case op_kind::or_: res = lhs || rhs; break;
-                            case op_kind::xor_: res = !lhs != !rhs; break;
-                            case op_kind::and_: res = lhs && rhs; break;
-                            case op_kind::eq: res = lhs == rhs; break;
-                            case op_kind::ne: res = lhs != rhs; break;
-                            case op_kind::lt: res = lhs < rhs; break;
-                            case op_kind::gt: res = lhs > rhs; break;
-                            case op_kind::lte: res = lhs <= rhs; break;
-                            case op_kind::gte: res = lhs >= rhs; break;
-                            case op_kind::add: res = lhs + rhs; break;
-                            case op_kind::sub: res = lhs - rhs; break;
-                            case op_kind::mul: res = lhs * rhs; break;
-                            case op_kind::div: res = lhs / rhs; break;
-                            default: assert(false);
-                        }
-
-                        if(!res.empty())
-                            top.stack.push_back(std::move(res));
-                    }
-                }
-                    break;
+        // the code is specialized on the assigned locals
+        if(m.assigned != assigned) {
+            ++m.deopts;
+            return jit_status::interpreted;
+        }
 
-                case opcode::brf:
-                    assert(top.pc + arg < top.end_pc);
-                    top.pc += arg;
-                    continue;
-
-                case opcode::brb:
-                    assert(top.start_pc <= top.pc - arg);
-                    top.pc -= arg;
-                    continue;
-
-                case opcode::brf_true:
-                    assert(!top.stack.empty());
-                    assert(top.pc + arg < top.end_pc);
-                    if(static_cast<bool>(top.stack.back())) {
-                        top.pc += arg;
-                        top.stack.pop_back();
-                        continue;
-                    }
-
-                    top.stack.pop_back();
-                    break;
+        const jit_code &code = *m.code;
+        jit_slots.resize(code.slots_count());
+        double *const slots = jit_slots.data();
 
-                case opcode::brf_false:
-                    assert(!top.stack.empty());
-                    assert(top.pc + arg < top.end_pc);
-                    if(!static_cast<bool>(top.stack.back())) {
-                        top.pc += arg;
-                        top.stack.pop_back();
-                        continue;
-                    }
+        for(std::size_t idx = 0; idx < f.locals_size; ++idx) {
+            if(assigned & (std::uint64_t(1) << idx))
+                slots[idx] = f.locals[idx].get_rep().local_num();
+            else
+                std::memcpy(&slots[idx], &jit_code::unassigned, sizeof(double));
+        }
 
-                    top.stack.pop_back();
-                    break;
+        ++m.native_runs;
+        const jit_code::exit_info &exit = code.get_exit(code.run(slots));
 
-                case opcode::brb_true:
-                    assert(!top.stack.empty());
-                    assert(top.start_pc <= top.pc - arg);
-                    if(static_cast<bool>(top.stack.back())) {
-                        top.pc -= arg;
-                        top.stack.pop_back();
-                        continue;
-                    }
+        for(std::size_t idx = 0; idx < f.locals_size; ++idx)
+            if(0 != std::memcmp(&slots[idx], &jit_code::unassigned, sizeof(double)))
+                f.locals[idx] = object(slots[idx]);
 
-                    top.stack.pop_back();
-                    break;
+        double *const stack = slots + f.locals_size;
+        auto make_value = [&](std::size_t depth) {
+            return exit.bools[depth] ? object(0.0 != stack[depth]) : object(stack[depth]);
+        };
 
-                case opcode::brb_false:
-                    assert(!top.stack.empty());
-                    assert(top.start_pc <= top.pc - arg);
-                    if(!static_cast<bool>(top.stack.back())) {
-                        top.pc -= arg;
-                        top.stack.pop_back();
-                        continue;
-                    }
+        if(exit.ret) {
+            value = exit.has_value ? make_value(exit.depth - 1) : object();
+            return jit_status::returned;
+        }
 
-                    top.stack.pop_back();
+        for(std::size_t depth = 0; depth < exit.depth; ++depth)
+            f.push(make_value(depth));
+
+        f.pc = f.start_pc + exit.pc;
+        ++m.deopts;
+        return jit_status::deoptimized;
+    }
+
+    /// Inline cache of the field access site at @a site of the frame's code
+    field_cache &site_cache(frame &f, std::size_t site)
+    {
+        if(__builtin_expect(!f.field_caches, false)) {
+            auto &caches = field_caches[f.start_pc];
+            if(caches.empty())
+                caches.resize(std::size_t(f.end_pc - f.start_pc));
+            f.field_caches = caches.data();
+        }
+
+        return f.field_caches[site];
+    }
+
+    /// Cache of the call site at @a site of the frame's code
+    call_cache &call_site(frame &f, std::size_t site)
+    {
+        if(__builtin_expect(!f.call_caches, false)) {
+            auto &caches = call_caches[f.start_pc];
+            if(caches.empty())
+                caches.resize(std::size_t(f.end_pc - f.start_pc));
+            f.call_caches = caches.data();
+        }
+
+        return f.call_caches[site];
+    }
+
+    /// Class which vtable dispatches a call with @a nr_args arguments:
+    /// of the receiver, if the first argument is an instance,
+    /// or of the calling method otherwise
+    static const context_info *dispatch_class(const frame &f, std::uint32_t nr_args)
+    {
+        assert(f.depth() >= nr_args);
+        if(nr_args)
+            if(instance_data *const inst = get_instance(f.sp[-std::ptrdiff_t(nr_args)]))
+                return &*inst->whois;
+        return f.whois;
+    }
+
+    /// Callee of fcall by the vtable slot. All overrides of a slot take
+    /// the same number of arguments, so it is known before the receiver.
+    const function &resolve_fcall(const frame &f, call_cache &cache, std::uint32_t slot)
+    {
+        if(__builtin_expect(!cache.empty(), true)) {
+            const function &fn = functions[cache.callee];
+            if(__builtin_expect(dispatch_class(f, fn.nr_params) == cache.whois, true)) {
+                ++cache.hits;
+                return fn;
+            }
+        }
+
+        ++cache.misses;
+
+        if(!f.whois)
+            throw std::runtime_error("fcall outside of a method");
+
+        const std::uint32_t nr_args = functions[vtable_lookup(*f.whois, slot)].nr_params;
+        const context_info *const whois = dispatch_class(f, nr_args);
+        const std::uint32_t callee = vtable_lookup(*whois, slot);
+
+        if(functions[callee].nr_params != nr_args)
+            throw std::runtime_error("override of the method changes the number of parameters");
+
+        cache.whois = whois;
+        cache.callee = callee;
+        return functions[callee];
+    }
+
+    /// Callee of call by the name from the const pool, looked up
+    /// in the class of the calling method once per call site
+    const function &resolve_call(const frame &f, call_cache &cache, std::uint32_t name_idx)
+    {
+        if(__builtin_expect(f.whois == cache.whois && !cache.empty(), true)) {
+            ++cache.hits;
+            return functions[cache.callee];
+        }
+
+        ++cache.misses;
+
+        if(!f.whois)
+            throw std::runtime_error("call by name outside of a method");
+
+        assert(f.const_pool.size() > name_idx);
+        const std::string *const name = boost::get<std::string>(&f.const_pool[name_idx]);
+        if(!name)
+            throw std::runtime_error("name of the callee is not a string");
+
+        cache.whois = f.whois;
+        cache.callee = vtable_lookup(*f.whois, vtable_slot(*f.whois, *name));
+        return functions[cache.callee];
+    }
+
+    /// Lookup table of the sealed br_table at @a insn, built on the first use
+    const branch_table &site_table(const frame &f, const linked_insn *insn, std::uint32_t nr_pairs)
+    {
+        auto it = branch_tables.find(insn);
+
+        if(__builtin_expect(branch_tables.end() == it, false))
+            it = branch_tables.emplace(insn, branch_table(insn + 1, nr_pairs, f.const_pool)).first;
+
+        return it->second;
+    }
+
+    static instance_data &receiver(const object &obj)
+    {
+        instance_data *const inst = get_instance(obj);
+        if(!inst)
+            throw std::runtime_error("field access on a non-instance value");
+        return *inst;
+    }
+
+    /// Objects of the constants, converted on the first load of the pool
+    const object *materialize(const std::vector<value_type> &const_pool)
+    {
+        auto it = const_pools.find(&const_pool);
+        if(const_pools.end() == it)
+            it = const_pools.emplace(&const_pool, materialized_pool(const_pool)).first;
+        return it->second.data();
+    }
+
+    static bool unary_op(op_kind kind) {
+        return op_kind::not_ == kind || op_kind::neg == kind;
+    }
+
+    static object eval_op(op_kind kind, const object &lhs, const object &rhs)
+    {
+        object res;
+        if(__builtin_expect(eval_fast_op(kind, lhs, rhs, res), true))
+            return res;
+
+        switch(kind) {
+            case op_kind::not_: return !lhs;
+            case op_kind::neg: return - (double) lhs;
+            case op_kind::or_: return lhs || rhs;
+            case op_kind::xor_: return !lhs != !rhs;
+            case op_kind::and_: return lhs && rhs;
+            case op_kind::eq: return lhs == rhs;
+            case op_kind::ne: return lhs != rhs;
+            case op_kind::lt: return lhs < rhs;
+            case op_kind::gt: return lhs > rhs;
+            case op_kind::lte: return lhs <= rhs;
+            case op_kind::gte: return lhs >= rhs;
+            case op_kind::add: return lhs + rhs;
+            case op_kind::sub: return lhs - rhs;
+            case op_kind::mul: return lhs * rhs;
+            case op_kind::div: return lhs / rhs;
+            default: assert(false);
+        }
+
+        return object();
+    }
+
+    /// Apply the operator to @a lhs and, for binary ones,
+    /// to the value popped from the stack, then push the result
+    static void call_op(frame &f, op_kind kind, const object &lhs)
+    {
+        if(unary_op(kind)) {
+            f.push(eval_op(kind, lhs, lhs));
+            return;
+        }
+
+        object res = eval_op(kind, lhs, f.pop());
+        if(!res.empty())
+            f.push(std::move(res));
+    }
+
+    /// Make array of the values or map of the key and value pairs
+    /// on the top of the stack, see amake_arg
+    static object make_container(frame &f, std::uint32_t arg)
+    {
+        const std::uint32_t count = amake_arg::count(arg);
+        const bool is_map = amake_arg::is_map(arg);
+        const std::size_t nr_values = is_map ? 2 * std::size_t(count) : count;
+        assert(f.depth() >= nr_values);
+
+        const object *const first = f.sp - nr_values;
+        type::rep r;
+
+        if(is_map) {
+            r = make_map();
+            map_data *const md = r.get_counted_unchecked()->get<map_data>();
+            md->reserve(count);
+            for(std::size_t idx = 0; idx < nr_values; idx += 2)
+                md->set(first[idx].get_rep(), first[idx + 1].get_rep());
+        } else {
+            std::vector<type::rep> values;
+            values.reserve(count);
+            for(std::size_t idx = 0; idx < nr_values; ++idx)
+                values.push_back(first[idx].get_rep());
+            r.set(std::move(values));
+        }
+
+        f.drop(nr_values);
+        return object(std::move(r));
+    }
+
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+// labels as values are a GNU extension
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+  template <bool Threaded, bool Profiled>
+    object run_loop() {
+        object ret_value;
+        frame *top = top_frame;
+        std::uint32_t arg;
+
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        // must follow the order of the opcode enum
+        static const void *const handlers[] = {
+            &&op_nop, &&op_pop, &&op_dup, &&op_swap, &&op_ret,
+            &&op_push, &&op_push_const, &&op_push_local, &&op_load_local, &&op_call_op,
+            &&op_push_field, &&op_load_field, &&op_brf, &&op_brb, &&op_brf_true,
+            &&op_brf_false, &&op_brb_true, &&op_brb_false, &&op_br_table, &&op_amake,
+            &&op_astore, &&op_aload, &&op_nop, &&op_nop, &&op_nop,
+            &&op_nop, &&op_nop, &&op_call, &&op_fcall, &&op_call_op_const,
+            &&op_call_op_local, &&op_call_op_store
+        };
+
+        static_assert(sizeof(handlers) / sizeof(*handlers)
+            == static_cast<std::size_t>(opcode::max_opcode), "handler for each opcode");
+
+        const threaded_insn *tbase = Threaded ? enter_threaded(*top, handlers) : nullptr;
+        const threaded_insn *tpc = Threaded ? tbase + (top->pc - top->start_pc) : nullptr;
+
+# define EMEL_DISPATCH() \
+        do { \
+            if(Threaded) { \
+                if(Profiled) prof->count(top->start_pc + (tpc - tbase)); \
+                arg = tpc->arg; goto *tpc->handler; \
+            } \
+            goto dispatch; \
+        } while(0)
+# define EMEL_BRANCH(OFFSET) \
+        do { if(Threaded) tpc += (OFFSET); else top->pc += (OFFSET); } while(0)
+# define EMEL_SITE() \
+        (Threaded ? std::size_t(tpc - tbase) : std::size_t(top->pc - top->start_pc))
+#else
+# define EMEL_DISPATCH() goto dispatch
+# define EMEL_BRANCH(OFFSET) top->pc += (OFFSET)
+# define EMEL_SITE() std::size_t(top->pc - top->start_pc)
+#endif
+
+# define EMEL_NEXT() do { EMEL_BRANCH(1); EMEL_DISPATCH(); } while(0)
+# define EMEL_BACKEDGE() do { if(top->jit) ++top->jit->counter; } while(0)
+
+    enter_frame:
+        if(Profiled)
+            prof->enter(top->start_pc);
+
+        if(__builtin_expect(0 != jit_threshold, false)) {
+            switch(enter_jit(*top, ret_value)) {
+                case jit_status::returned:
+                    goto leave_frame;
+
+                case jit_status::deoptimized:
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+                    if(Threaded)
+                        tpc = tbase + (top->pc - top->start_pc);
+#endif
                     break;
 
                 default:
                     break;
             }
+        }
 
-            ++top.pc;
+        EMEL_DISPATCH();
+
+    dispatch:
+        assert(top->start_pc <= top->pc);
+        assert(top->pc < top->end_pc);
+
+        arg = top->pc->arg;
+        if(Profiled)
+            prof->count(top->pc);
+
+        switch (top->pc->op) {
+            case opcode::pop: goto op_pop;
+            case opcode::dup: goto op_dup;
+            case opcode::swap: goto op_swap;
+            case opcode::ret: goto op_ret;
+            case opcode::push: goto op_push;
+            case opcode::push_const: goto op_push_const;
+            case opcode::push_local: goto op_push_local;
+            case opcode::load_local: goto op_load_local;
+            case opcode::call_op: goto op_call_op;
+            case opcode::push_field: goto op_push_field;
+            case opcode::load_field: goto op_load_field;
+            case opcode::brf: goto op_brf;
+            case opcode::brb: goto op_brb;
+            case opcode::brf_true: goto op_brf_true;
+            case opcode::brf_false: goto op_brf_false;
+            case opcode::brb_true: goto op_brb_true;
+            case opcode::brb_false: goto op_brb_false;
+            case opcode::br_table: goto op_br_table;
+            case opcode::amake: goto op_amake;
+            case opcode::astore: goto op_astore;
+            case opcode::aload: goto op_aload;
+            case opcode::call: goto op_call;
+            case opcode::fcall: goto op_fcall;
+            case opcode::call_op_const: goto op_call_op_const;
+            case opcode::call_op_local: goto op_call_op_local;
+            case opcode::call_op_store: goto op_call_op_store;
+            default: goto op_nop;
         }
 
-        return ret_value;
+    op_nop:
+        EMEL_NEXT();
+
+    op_pop:
+        if(!arg) arg = 1;
+        top->drop(arg);
+        EMEL_NEXT();
+
+    op_dup:
+        if(!arg) arg = 1;
+        while(arg--)
+            top->push(top->back());
+        EMEL_NEXT();
+
+    op_swap:
+        assert(top->depth() > 1);
+        top->back().swap(top->sp[-2]);
+        EMEL_NEXT();
+
+    op_ret:
+        if(arg > 0)
+            ret_value = top->pop();
+
+    leave_frame:
+        if(Profiled)
+            prof->leave();
+        drop_frame();
+
+        if(!top_frame)
+            return ret_value;
+
+        // resume the caller from its current pc
+        top = top_frame;
+        top->push(std::move(ret_value));
+
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        if(Threaded) {
+            tbase = enter_threaded(*top, handlers);
+            tpc = tbase + (top->pc - top->start_pc);
+        }
+#endif
+        EMEL_DISPATCH();
+
+    op_push:
+        top->push(object(double(arg)));
+        EMEL_NEXT();
+
+    op_push_const:
+        assert(top->const_pool.size() > arg);
+        top->push(top->consts[arg]);
+        EMEL_NEXT();
+
+    op_push_local:
+        assert(top->locals_size > arg);
+        top->push(top->locals[arg]);
+        EMEL_NEXT();
+
+    op_load_local:
+        assert(top->locals_size > arg);
+        top->locals[arg] = top->pop();
+        EMEL_NEXT();
+
+    op_call_op: {
+        const object lhs = top->pop();
+        call_op(*top, static_cast<op_kind>(arg), lhs);
+    }
+        EMEL_NEXT();
+
+    op_call_op_const:
+        assert(top->const_pool.size() > fused_arg::operand(arg));
+        call_op(*top, fused_arg::kind(arg), top->consts[fused_arg::operand(arg)]);
+        EMEL_NEXT();
+
+    op_call_op_local:
+        assert(top->locals_size > fused_arg::operand(arg));
+        call_op(*top, fused_arg::kind(arg), top->locals[fused_arg::operand(arg)]);
+        EMEL_NEXT();
+
+    op_call_op_store: {
+        assert(top->locals_size > fused_arg::store_operand(arg));
+        assert(top->locals_size > fused_arg::store_target(arg));
+        const auto kind = fused_arg::kind(arg);
+        const object &lhs = top->locals[fused_arg::store_operand(arg)];
+        object res = unary_op(kind) ? eval_op(kind, lhs, lhs) : eval_op(kind, lhs, top->pop());
+        top->locals[fused_arg::store_target(arg)] = std::move(res);
+    }
+        EMEL_NEXT();
+
+    op_push_field: {
+        const object obj = top->pop();
+        instance_data &inst = receiver(obj);
+        const offset_t offset = site_cache(*top, EMEL_SITE()).lookup(*inst.whois, arg);
+        assert(offset >= 0 && std::size_t(offset) < inst.fields.size());
+        top->push(object(inst.fields[offset]));
     }
+        EMEL_NEXT();
+
+    op_load_field: {
+        const object obj = top->pop();
+        instance_data &inst = receiver(obj);
+        const offset_t offset = site_cache(*top, EMEL_SITE()).lookup(*inst.whois, arg);
+        assert(offset >= 0 && std::size_t(offset) < inst.fields.size());
+        inst.fields[offset] = top->pop().get_rep();
+    }
+        EMEL_NEXT();
+
+    op_call:
+        call_function(resolve_call(*top, call_site(*top, EMEL_SITE()), arg));
+        goto enter_callee;
+
+    op_fcall:
+        call_function(resolve_fcall(*top, call_site(*top, EMEL_SITE()), arg));
+
+    enter_callee:
+        // the caller resumes after the call instruction
+        EMEL_BRANCH(1);
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+        if(Threaded) {
+            top->pc = top->start_pc + (tpc - tbase);
+            tbase = tpc = enter_threaded(*top_frame, handlers);
+        }
+#endif
+        top = top_frame;
+        goto enter_frame;
+
+    op_brf:
+        EMEL_BRANCH(arg);
+        EMEL_DISPATCH();
+
+    op_brb:
+        EMEL_BACKEDGE();
+        EMEL_BRANCH(-std::ptrdiff_t(arg));
+        EMEL_DISPATCH();
+
+    op_brf_true: {
+        const bool cond = static_cast<bool>(top->pop());
+        if(cond) {
+            EMEL_BRANCH(arg);
+            EMEL_DISPATCH();
+        }
+    }
+        EMEL_NEXT();
+
+    op_brf_false: {
+        const bool cond = static_cast<bool>(top->pop());
+        if(!cond) {
+            EMEL_BRANCH(arg);
+            EMEL_DISPATCH();
+        }
+    }
+        EMEL_NEXT();
+
+    op_brb_true: {
+        const bool cond = static_cast<bool>(top->pop());
+        if(cond) {
+            EMEL_BACKEDGE();
+            EMEL_BRANCH(-std::ptrdiff_t(arg));
+            EMEL_DISPATCH();
+        }
+    }
+        EMEL_NEXT();
+
+    op_brb_false: {
+        const bool cond = static_cast<bool>(top->pop());
+        if(!cond) {
+            EMEL_BACKEDGE();
+            EMEL_BRANCH(-std::ptrdiff_t(arg));
+            EMEL_DISPATCH();
+        }
+    }
+        EMEL_NEXT();
+
+    op_br_table:
+        if(__builtin_expect(arg & br_table_sealed, true)) {
+            const std::uint32_t nr_pairs = arg & ~br_table_sealed;
+            const branch_table &table = site_table(*top, top->start_pc + EMEL_SITE(), nr_pairs);
+            const std::uint32_t offset = table.lookup(top->back());
+            top->drop();
+
+            // offsets are counted from the place of br_table behind the pairs
+            EMEL_BRANCH(2 * nr_pairs + (offset ? offset : 1));
+            EMEL_DISPATCH();
+        } else {
+            // the pairs are on the stack, the key above its offset
+            assert(top->depth() > 2 * arg);
+            const object &value = top->sp[-2 * std::ptrdiff_t(arg) - 1];
+            std::uint32_t offset = 1;
+
+            for(std::uint32_t idx = 0; idx < arg; ++idx) {
+                if(value == top->sp[-2 * std::ptrdiff_t(idx) - 1]) {
+                    offset = std::uint32_t(static_cast<double>(top->sp[-2 * std::ptrdiff_t(idx) - 2]));
+                    break;
+                }
+            }
+
+            top->drop(2 * arg + 1);
+            EMEL_BRANCH(offset);
+            EMEL_DISPATCH();
+        }
+
+    op_amake:
+        top->push(make_container(*top, arg));
+        EMEL_NEXT();
+
+    op_astore:
+        // the key is beneath the value
+        assert(top->locals_size > arg && top->depth() > 1);
+        top->locals[arg].store(top->sp[-2], top->sp[-1]);
+        top->drop(2);
+        EMEL_NEXT();
+
+    op_aload: {
+        assert(top->depth() > 1);
+        object value = top->sp[-2].load(top->sp[-1]);
+        top->drop(2);
+        top->push(std::move(value));
+    }
+        EMEL_NEXT();
+
+# undef EMEL_BACKEDGE
+# undef EMEL_NEXT
+# undef EMEL_SITE
+# undef EMEL_BRANCH
+# undef EMEL_DISPATCH
+    }
+
+#if defined(EMEL_HAS_COMPUTED_GOTO)
+# pragma GCC diagnostic pop
+#endif
 };
 
 } // namespace runtime
@@ -0,0 +1,754 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "jit.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+
+#if defined(EMEL_HAS_JIT)
+# include <sys/mman.h>
+#endif
+
+namespace emel { namespace runtime {
+
+constexpr std::uint64_t jit_code::unassigned;
+
+void jit_code::deleter::operator()(void *mem) const noexcept
+{
+#if defined(EMEL_HAS_JIT)
+    ::munmap(mem, size);
+#else
+    (void) mem;
+#endif
+}
+
+jit_code::jit_code(std::unique_ptr<void, deleter> mem, std::size_t size)
+    : mem(std::move(mem)), size(size)
+{
+}
+
+#if defined(EMEL_HAS_JIT)
+
+namespace {
+
+/// Types of the stack slots and assigned locals before the instruction
+struct insn_state {
+    bool reached = false;
+    std::vector<bool> bools;
+    std::uint64_t assigned = 0;
+
+    std::uint32_t depth() const { return std::uint32_t(bools.size()); }
+};
+
+/// What the compiled instruction does with the control
+struct action {
+    enum kind_type { exit, ret, next, jump, cond_jump } kind = exit;
+    std::size_t target = 0;
+};
+
+std::uint64_t double_bits(double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+const std::uint64_t true_bits = double_bits(1.0);
+
+bool unary_kind(op_kind kind) {
+    return op_kind::not_ == kind || op_kind::neg == kind;
+}
+
+/// Type of the result of the operator on typed operands,
+/// false if it has no inline form
+bool op_result(op_kind kind, bool lhs_bool, bool rhs_bool, bool &res_bool)
+{
+    switch(kind) {
+        case op_kind::not_: res_bool = true; return lhs_bool;
+        case op_kind::neg: res_bool = false; return !lhs_bool;
+
+        case op_kind::or_:
+        case op_kind::xor_:
+        case op_kind::and_:
+            res_bool = true;
+            return lhs_bool && rhs_bool;
+
+        case op_kind::eq:
+        case op_kind::ne:
+            res_bool = true;
+            return lhs_bool == rhs_bool;
+
+        case op_kind::lt:
+        case op_kind::gt:
+        case op_kind::lte:
+        case op_kind::gte:
+            res_bool = true;
+            return !lhs_bool && !rhs_bool;
+
+        case op_kind::add:
+        case op_kind::sub:
+        case op_kind::mul:
+        case op_kind::div:
+            res_bool = false;
+            return !lhs_bool && !rhs_bool;
+
+        default:
+            return false;
+    }
+}
+
+/// Typing rules of the instructions. Mutates the state into the state
+/// after the instruction; any instruction, which can't be typed, leaves
+/// the native code for the interpreter.
+class typer
+{
+    const std::vector<value_type> &const_pool;
+    const std::size_t locals_size, code_size;
+
+public:
+    typer(const std::vector<value_type> &const_pool, std::size_t locals_size, std::size_t code_size)
+        : const_pool(const_pool), locals_size(locals_size), code_size(code_size)
+    {
+    }
+
+    bool const_type(std::uint32_t idx, bool &is_bool) const
+    {
+        if(idx >= const_pool.size())
+            return false;
+
+        switch(const_pool[idx].which()) {
+            case 2: is_bool = false; return true;
+            case 3: is_bool = true; return true;
+            default: return false;
+        }
+    }
+
+    bool local_assigned(const insn_state &st, std::uint32_t idx) const {
+        return idx < locals_size && 0 != (st.assigned & (std::uint64_t(1) << idx));
+    }
+
+    /// Apply the operator with the left operand of type @a lhs_bool,
+    /// the right one is popped from the stack, if the operator is binary
+    bool apply_op(insn_state &st, op_kind kind, bool lhs_bool, bool &res_bool) const
+    {
+        if(unary_kind(kind))
+            return op_result(kind, lhs_bool, lhs_bool, res_bool);
+
+        if(!st.depth() || !op_result(kind, lhs_bool, st.bools.back(), res_bool))
+            return false;
+
+        st.bools.pop_back();
+        return true;
+    }
+
+    action apply(std::size_t pc, const linked_insn &insn, insn_state &st) const
+    {
+        action act;
+        const std::uint32_t arg = insn.arg;
+        bool lhs_bool, res_bool;
+
+        switch(insn.op) {
+            case opcode::spec:
+            case opcode::push_frame:
+            case opcode::drop_frame:
+                act.kind = action::next;
+                break;
+
+            case opcode::pop: {
+                const std::uint32_t count = arg ? arg : 1;
+                if(st.depth() < count)
+                    break;
+                st.bools.resize(st.depth() - count);
+                act.kind = action::next;
+                break;
+            }
+
+            case opcode::dup: {
+                const std::uint32_t count = arg ? arg : 1;
+                if(!st.depth())
+                    break;
+                st.bools.insert(st.bools.end(), count, st.bools.back());
+                act.kind = action::next;
+                break;
+            }
+
+            case opcode::swap:
+                if(st.depth() < 2)
+                    break;
+                std::vector<bool>::swap(st.bools[st.depth() - 1], st.bools[st.depth() - 2]);
+                act.kind = action::next;
+                break;
+
+            case opcode::ret:
+                if(!arg || st.depth())
+                    act.kind = action::ret;
+                break;
+
+            case opcode::push:
+                st.bools.push_back(false);
+                act.kind = action::next;
+                break;
+
+            case opcode::push_const:
+                if(!const_type(arg, lhs_bool))
+                    break;
+                st.bools.push_back(lhs_bool);
+                act.kind = action::next;
+                break;
+
+            case opcode::push_local:
+                if(!local_assigned(st, arg))
+                    break;
+                st.bools.push_back(false);
+                act.kind = action::next;
+                break;
+
+            case opcode::load_local:
+                // locals hold numbers only
+                if(arg >= locals_size || !st.depth() || st.bools.back())
+                    break;
+                st.bools.pop_back();
+                st.assigned |= std::uint64_t(1) << arg;
+                act.kind = action::next;
+                break;
+
+            case opcode::call_op: {
+                const auto kind = static_cast<op_kind>(arg);
+                if(!st.depth())
+                    break;
+                insn_state res = st;
+                lhs_bool = res.bools.back();
+                res.bools.pop_back();
+                if(!apply_op(res, kind, lhs_bool, res_bool))
+                    break;
+                res.bools.push_back(res_bool);
+                st = std::move(res);
+                act.kind = action::next;
+                break;
+            }
+
+            case opcode::call_op_const:
+            case opcode::call_op_local: {
+                const bool local = opcode::call_op_local == insn.op;
+                const auto idx = fused_arg::operand(arg);
+                if(local ? !local_assigned(st, idx) : !const_type(idx, lhs_bool))
+                    break;
+                if(local)
+                    lhs_bool = false;
+                insn_state res = st;
+                if(!apply_op(res, fused_arg::kind(arg), lhs_bool, res_bool))
+                    break;
+                res.bools.push_back(res_bool);
+                st = std::move(res);
+                act.kind = action::next;
+                break;
+            }
+
+            case opcode::call_op_store: {
+                if(!local_assigned(st, fused_arg::store_operand(arg))
+                        || fused_arg::store_target(arg) >= locals_size)
+                    break;
+                insn_state res = st;
+                if(!apply_op(res, fused_arg::kind(arg), false, res_bool) || res_bool)
+                    break;
+                res.assigned |= std::uint64_t(1) << fused_arg::store_target(arg);
+                st = std::move(res);
+                act.kind = action::next;
+                break;
+            }
+
+            case opcode::brf:
+            case opcode::brb:
+                if(opcode::brf == insn.op ? pc + arg >= code_size : arg > pc)
+                    break;
+                act.kind = action::jump;
+                act.target = opcode::brf == insn.op ? pc + arg : pc - arg;
+                break;
+
+            case opcode::brf_true:
+            case opcode::brf_false:
+            case opcode::brb_true:
+            case opcode::brb_false: {
+                const bool forward = opcode::brf_true == insn.op || opcode::brf_false == insn.op;
+                if(!st.depth() || (forward ? pc + arg >= code_size : arg > pc))
+                    break;
+                st.bools.pop_back();
+                act.kind = action::cond_jump;
+                act.target = forward ? pc + arg : pc - arg;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        return act;
+    }
+};
+
+/// Emitter of the few x86-64 instructions used by the templates.
+/// Slots are addressed relative to rdi, the only argument of the code.
+class assembler
+{
+    std::vector<std::uint8_t> bytes;
+
+public:
+    enum reg { rax = 0, rcx = 1 };
+    enum xmm { xmm0 = 0, xmm1 = 1 };
+    enum cond {
+        cc_e = 0x4, cc_ne = 0x5, cc_ae = 0x3, cc_a = 0x7, cc_p = 0xa, cc_np = 0xb
+    };
+
+    const std::vector<std::uint8_t> &code() const { return bytes; }
+    std::size_t size() const { return bytes.size(); }
+
+    void emit(std::initializer_list<std::uint8_t> list) {
+        bytes.insert(bytes.end(), list);
+    }
+
+    void imm32(std::uint32_t value) {
+        for(int idx = 0; idx < 4; ++idx)
+            bytes.push_back(std::uint8_t(value >> (8 * idx)));
+    }
+
+    void imm64(std::uint64_t value) {
+        imm32(std::uint32_t(value));
+        imm32(std::uint32_t(value >> 32));
+    }
+
+    void patch32(std::size_t at, std::uint32_t value) {
+        for(int idx = 0; idx < 4; ++idx)
+            bytes[at + idx] = std::uint8_t(value >> (8 * idx));
+    }
+
+    /// Instruction with the [rdi + disp32] memory operand
+    void mem(std::initializer_list<std::uint8_t> opcode, int reg, std::size_t slot) {
+        emit(opcode);
+        bytes.push_back(std::uint8_t(0x87 | (reg << 3)));
+        imm32(std::uint32_t(slot * sizeof(double)));
+    }
+
+    void load(reg r, std::size_t slot) { mem({ 0x48, 0x8b }, r, slot); }
+    void store(std::size_t slot, reg r) { mem({ 0x48, 0x89 }, r, slot); }
+    void load_imm(reg r, std::uint64_t value) { emit({ 0x48, std::uint8_t(0xb8 + r) }); imm64(value); }
+    void movsd_load(xmm x, std::size_t slot) { mem({ 0xf2, 0x0f, 0x10 }, x, slot); }
+    void movsd_store(std::size_t slot, xmm x) { mem({ 0xf2, 0x0f, 0x11 }, x, slot); }
+
+    /// addsd, subsd, mulsd or divsd of xmm0 and the slot
+    void arith(std::uint8_t op, std::size_t slot) { mem({ 0xf2, 0x0f, op }, xmm0, slot); }
+
+    /// and, or or xor of rax and the slot
+    void logic(std::uint8_t op, std::size_t slot) { mem({ 0x48, op }, rax, slot); }
+
+    void ucomisd(xmm a, xmm b) { emit({ 0x66, 0x0f, 0x2e, std::uint8_t(0xc0 | (a << 3) | b) }); }
+    void setcc(cond cc, reg r) { emit({ 0x0f, std::uint8_t(0x90 | cc), std::uint8_t(0xc0 | r) }); }
+    void and_al_cl() { emit({ 0x20, 0xc8 }); }
+    void or_al_cl() { emit({ 0x08, 0xc8 }); }
+    void xor_rax_rcx() { emit({ 0x48, 0x31, 0xc8 }); }
+
+    /// xmm0 = double(al)
+    void bool_to_double() {
+        emit({ 0x0f, 0xb6, 0xc0 }); // movzx eax, al
+        emit({ 0xf2, 0x0f, 0x2a, 0xc0 }); // cvtsi2sd xmm0, eax
+    }
+
+    void zero_xmm1() { emit({ 0x66, 0x0f, 0x57, 0xc9 }); } // xorpd xmm1, xmm1
+    void test_al() { emit({ 0x84, 0xc0 }); }
+    void flip_sign() { emit({ 0x48, 0x0f, 0xba, 0xf8, 0x3f }); } // btc rax, 63
+    void test_rax() { emit({ 0x48, 0x85, 0xc0 }); }
+
+    /// Jump with the rel32 to be patched, returns its position
+    std::size_t jmp() { emit({ 0xe9 }); imm32(0); return size() - 4; }
+    std::size_t jcc(cond cc) { emit({ 0x0f, std::uint8_t(0x80 | cc) }); imm32(0); return size() - 4; }
+
+    void leave(std::uint32_t exit_idx) {
+        emit({ 0xb8 }); // mov eax, imm32
+        imm32(exit_idx);
+        emit({ 0xc3 }); // ret
+    }
+};
+
+/// Expands the typed instructions into the templates
+class emitter
+{
+    assembler &as;
+    const std::vector<value_type> &const_pool;
+    const std::size_t locals_size;
+
+public:
+    emitter(assembler &as, const std::vector<value_type> &const_pool, std::size_t locals_size)
+        : as(as), const_pool(const_pool), locals_size(locals_size)
+    {
+    }
+
+    void copy(std::size_t dst, std::size_t src) {
+        as.load(assembler::rax, src);
+        as.store(dst, assembler::rax);
+    }
+
+    void push_const(std::size_t dst, std::uint32_t idx)
+    {
+        const value_type &value = const_pool[idx];
+        const std::uint64_t bits = 2 == value.which()
+            ? double_bits(boost::get<double>(value))
+            : (boost::get<bool>(value) ? true_bits : 0);
+        as.load_imm(assembler::rax, bits);
+        as.store(dst, assembler::rax);
+    }
+
+    /// dst = lhs <op> rhs, lhs of the unary operators only
+    void op(op_kind kind, bool lhs_bool, std::size_t lhs, std::size_t rhs, std::size_t dst)
+    {
+        switch(kind) {
+            case op_kind::not_:
+                as.load(assembler::rax, lhs);
+                as.load_imm(assembler::rcx, true_bits);
+                as.xor_rax_rcx();
+                as.store(dst, assembler::rax);
+                break;
+
+            case op_kind::neg:
+                as.load(assembler::rax, lhs);
+                as.flip_sign();
+                as.store(dst, assembler::rax);
+                break;
+
+            case op_kind::or_:
+            case op_kind::and_:
+            case op_kind::xor_:
+                as.load(assembler::rax, lhs);
+                as.logic(op_kind::or_ == kind ? 0x0b : op_kind::and_ == kind ? 0x23 : 0x33, rhs);
+                as.store(dst, assembler::rax);
+                break;
+
+            case op_kind::add:
+            case op_kind::sub:
+            case op_kind::mul:
+            case op_kind::div: {
+                static const std::uint8_t ops[] = { 0x58, 0x5c, 0x59, 0x5e };
+                as.movsd_load(assembler::xmm0, lhs);
+                as.arith(ops[static_cast<int>(kind) - static_cast<int>(op_kind::add)], rhs);
+                as.movsd_store(dst, assembler::xmm0);
+                break;
+            }
+
+            case op_kind::eq:
+            case op_kind::ne:
+                if(lhs_bool) {
+                    as.load(assembler::rax, lhs);
+                    as.logic(0x33, rhs);
+                    if(op_kind::eq == kind) {
+                        as.load_imm(assembler::rcx, true_bits);
+                        as.xor_rax_rcx();
+                    }
+                    as.store(dst, assembler::rax);
+                    break;
+                }
+
+                // unordered operands are not equal
+                as.movsd_load(assembler::xmm0, lhs);
+                as.movsd_load(assembler::xmm1, rhs);
+                as.ucomisd(assembler::xmm0, assembler::xmm1);
+                if(op_kind::eq == kind) {
+                    as.setcc(assembler::cc_e, assembler::rax);
+                    as.setcc(assembler::cc_np, assembler::rcx);
+                    as.and_al_cl();
+                } else {
+                    as.setcc(assembler::cc_ne, assembler::rax);
+                    as.setcc(assembler::cc_p, assembler::rcx);
+                    as.or_al_cl();
+                }
+                as.bool_to_double();
+                as.movsd_store(dst, assembler::xmm0);
+                break;
+
+            default: {
+                // lt and lte compare the swapped operands, so NaN gives false
+                const bool swapped = op_kind::lt == kind || op_kind::lte == kind;
+                as.movsd_load(assembler::xmm0, lhs);
+                as.movsd_load(assembler::xmm1, rhs);
+                if(swapped)
+                    as.ucomisd(assembler::xmm1, assembler::xmm0);
+                else
+                    as.ucomisd(assembler::xmm0, assembler::xmm1);
+                as.setcc((op_kind::lt == kind || op_kind::gt == kind)
+                    ? assembler::cc_a : assembler::cc_ae, assembler::rax);
+                as.bool_to_double();
+                as.movsd_store(dst, assembler::xmm0);
+                break;
+            }
+        }
+    }
+
+    /// Template of the instruction, which was typed as native
+    void insn(const linked_insn &insn, const insn_state &st)
+    {
+        const std::uint32_t arg = insn.arg;
+        const std::size_t top = locals_size + st.depth();
+
+        switch(insn.op) {
+            case opcode::dup:
+                for(std::uint32_t idx = 0; idx < (arg ? arg : 1); ++idx)
+                    copy(top + idx, top - 1);
+                break;
+
+            case opcode::swap:
+                as.load(assembler::rax, top - 1);
+                as.load(assembler::rcx, top - 2);
+                as.store(top - 1, assembler::rcx);
+                as.store(top - 2, assembler::rax);
+                break;
+
+            case opcode::push:
+                as.load_imm(assembler::rax, double_bits(double(arg)));
+                as.store(top, assembler::rax);
+                break;
+
+            case opcode::push_const:
+                push_const(top, arg);
+                break;
+
+            case opcode::push_local:
+                copy(top, arg);
+                break;
+
+            case opcode::load_local:
+                copy(arg, top - 1);
+                break;
+
+            case opcode::call_op: {
+                const auto kind = static_cast<op_kind>(arg);
+                if(unary_kind(kind))
+                    op(kind, st.bools.back(), top - 1, top - 1, top - 1);
+                else
+                    op(kind, st.bools.back(), top - 1, top - 2, top - 2);
+                break;
+            }
+
+            case opcode::call_op_const: {
+                const auto kind = fused_arg::kind(arg);
+                push_const(top, fused_arg::operand(arg));
+                const bool lhs_bool = 3 == const_pool[fused_arg::operand(arg)].which();
+                if(unary_kind(kind))
+                    op(kind, lhs_bool, top, top, top);
+                else
+                    op(kind, lhs_bool, top, top - 1, top - 1);
+                break;
+            }
+
+            case opcode::call_op_local: {
+                const auto kind = fused_arg::kind(arg);
+                const std::size_t lhs = fused_arg::operand(arg);
+                if(unary_kind(kind))
+                    op(kind, false, lhs, lhs, top);
+                else
+                    op(kind, false, lhs, top - 1, top - 1);
+                break;
+            }
+
+            case opcode::call_op_store: {
+                const auto kind = fused_arg::kind(arg);
+                const std::size_t lhs = fused_arg::store_operand(arg);
+                op(kind, false, lhs, unary_kind(kind) ? lhs : top - 1, fused_arg::store_target(arg));
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+};
+
+} // anonymous namespace
+
+std::unique_ptr<jit_code> jit_compiler::compile(
+    const linked_insn *start_pc, const linked_insn *end_pc,
+    std::size_t locals_size, std::uint64_t assigned,
+    const std::vector<value_type> &const_pool)
+{
+    const std::size_t size = std::size_t(end_pc - start_pc);
+    if(!size || locals_size > max_locals)
+        return nullptr;
+
+    // infer the stack types, they must agree at every join
+    const typer types(const_pool, locals_size, size);
+    std::vector<insn_state> states(size);
+    std::deque<std::size_t> work { 0 };
+    std::size_t max_depth = 0;
+
+    states[0].reached = true;
+    states[0].assigned = assigned;
+
+    auto merge = [&](std::size_t pc, const insn_state &st) {
+        insn_state &target = states[pc];
+        max_depth = std::max<std::size_t>(max_depth, st.depth());
+
+        if(!target.reached) {
+            target = st;
+            work.push_back(pc);
+            return true;
+        }
+
+        if(target.bools != st.bools)
+            return false;
+
+        if((target.assigned & st.assigned) != target.assigned) {
+            target.assigned &= st.assigned;
+            work.push_back(pc);
+        }
+
+        return true;
+    };
+
+    while(!work.empty()) {
+        const std::size_t pc = work.front();
+        work.pop_front();
+
+        insn_state st = states[pc];
+        // the fused operators use a slot above the stack
+        max_depth = std::max<std::size_t>(max_depth, st.depth() + 1);
+        const action act = types.apply(pc, start_pc[pc], st);
+
+        switch(act.kind) {
+            case action::next:
+                if(pc + 1 < size && !merge(pc + 1, st))
+                    return nullptr;
+                break;
+
+            case action::jump:
+                if(!merge(act.target, st))
+                    return nullptr;
+                break;
+
+            case action::cond_jump:
+                if(!merge(act.target, st) || (pc + 1 < size && !merge(pc + 1, st)))
+                    return nullptr;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    assembler as;
+    emitter emit(as, const_pool, locals_size);
+    std::vector<std::size_t> labels(size, 0);
+    std::vector<std::pair<std::size_t, std::size_t>> fixups;
+    std::vector<jit_code::exit_info> exits;
+
+    auto leave = [&](std::size_t pc, const insn_state &st, bool ret, bool has_value) {
+        as.leave(std::uint32_t(exits.size()));
+        exits.push_back({ std::uint32_t(pc), st.depth(), ret, has_value, st.bools });
+    };
+
+    for(std::size_t pc = 0; pc < size; ++pc) {
+        labels[pc] = as.size();
+        if(!states[pc].reached)
+            continue;
+
+        const insn_state &st = states[pc];
+        insn_state after = st;
+        const action act = types.apply(pc, start_pc[pc], after);
+
+        switch(act.kind) {
+            case action::exit:
+                leave(pc, st, false, false);
+                break;
+
+            case action::ret:
+                leave(pc, st, true, 0 != start_pc[pc].arg);
+                break;
+
+            case action::next:
+                emit.insn(start_pc[pc], st);
+                // falling off the end resumes in the interpreter
+                if(pc + 1 == size)
+                    leave(size, after, false, false);
+                break;
+
+            case action::jump:
+                fixups.emplace_back(as.jmp(), act.target);
+                break;
+
+            case action::cond_jump: {
+                const bool on_true = opcode::brf_true == start_pc[pc].op
+                    || opcode::brb_true == start_pc[pc].op;
+                const std::size_t cond = locals_size + st.depth() - 1;
+
+                if(st.bools.back()) {
+                    as.load(assembler::rax, cond);
+                    as.test_rax();
+                } else {
+                    // a number is true, unless it is zero
+                    as.movsd_load(assembler::xmm0, cond);
+                    as.zero_xmm1();
+                    as.ucomisd(assembler::xmm0, assembler::xmm1);
+                    as.setcc(assembler::cc_ne, assembler::rax);
+                    as.setcc(assembler::cc_p, assembler::rcx);
+                    as.or_al_cl();
+                    as.test_al();
+                }
+
+                fixups.emplace_back(as.jcc(on_true ? assembler::cc_ne : assembler::cc_e), act.target);
+                if(pc + 1 == size)
+                    leave(size, after, false, false);
+                break;
+            }
+        }
+    }
+
+    for(const auto &fixup : fixups)
+        as.patch32(fixup.first, std::uint32_t(labels[fixup.second] - (fixup.first + 4)));
+
+    // write the code, then make it executable and read-only
+    const std::size_t mem_size = (as.size() + 4095) & ~std::size_t(4095);
+    void *mem = ::mmap(nullptr, mem_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(MAP_FAILED == mem)
+        return nullptr;
+
+    std::unique_ptr<void, jit_code::deleter> guard(mem, jit_code::deleter { mem_size });
+    std::memcpy(mem, as.code().data(), as.size());
+
+    if(0 != ::mprotect(mem, mem_size, PROT_READ | PROT_EXEC))
+        return nullptr;
+
+    std::unique_ptr<jit_code> code(new jit_code(std::move(guard), as.size()));
+    code->exits = std::move(exits);
+    code->nr_slots = locals_size + max_depth + 1;
+    return code;
+}
+
+#else
+
+std::unique_ptr<jit_code> jit_compiler::compile(
+    const linked_insn *, const linked_insn *, std::size_t, std::uint64_t,
+    const std::vector<value_type> &)
+{
+    return nullptr;
+}
+
+#endif // EMEL_HAS_JIT
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "code.h"
+
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(EMEL_NO_JIT)
+# define EMEL_HAS_JIT 1
+#endif
+
+namespace emel { namespace runtime {
+
+/// Native code of a method. It works on a flat array of unboxed
+/// doubles, the locals followed by the operand stack, and leaves
+/// through one of its exits: the return from the method or a transfer
+/// to the interpreter at the instruction, which it can't execute.
+class EMEL_EXPORT jit_code
+{
+public:
+    struct exit_info {
+        std::uint32_t pc; ///< Index of the instruction to resume at
+        std::uint32_t depth; ///< Depth of the operand stack
+        bool ret, has_value;
+        std::vector<bool> bools; ///< Stack slots holding booleans
+    };
+
+    /// Bits of the slot of a local, which wasn't assigned yet
+    static constexpr std::uint64_t unassigned = 0x7ff4deadbeef0000UL;
+
+private:
+    struct deleter {
+        std::size_t size;
+        void operator()(void *mem) const noexcept;
+    };
+
+    std::unique_ptr<void, deleter> mem;
+    std::vector<exit_info> exits;
+    std::size_t nr_slots = 0, size = 0;
+
+    friend class jit_compiler;
+    jit_code(std::unique_ptr<void, deleter> mem, std::size_t size);
+
+public:
+    /// Run the code on @a slots, returns the index of the exit taken
+    std::uint32_t run(double *slots) const {
+        using entry_type = std::uint32_t (*)(double *);
+        return reinterpret_cast<entry_type>(mem.get())(slots);
+    }
+
+    const exit_info &get_exit(std::uint32_t idx) const { return exits.at(idx); }
+    std::size_t slots_count() const noexcept { return nr_slots; }
+    std::size_t code_size() const noexcept { return size; }
+};
+
+/// Baseline template compiler of the stack code into x86-64 machine code.
+/// Each instruction is expanded into a fixed sequence on the slots array;
+/// types of the stack slots are inferred statically, numbers and booleans
+/// are computed inline, everything else leaves to the interpreter.
+/// The code is specialized on the set of locals assigned at the entry.
+class EMEL_EXPORT jit_compiler
+{
+public:
+    static constexpr std::size_t max_locals = 64;
+
+    /// Compile the method, returns null if the JIT is not available
+    /// or the stack of the method can't be typed statically
+    static std::unique_ptr<jit_code> compile(
+        const linked_insn *start_pc, const linked_insn *end_pc,
+        std::size_t locals_size, std::uint64_t assigned,
+        const std::vector<value_type> &const_pool);
+};
+
+/// Hotness counter and native code of a method
+struct jit_method
+{
+    std::uint32_t counter = 0; ///< Entries and backward branches
+    std::uint32_t native_runs = 0, deopts = 0;
+    std::uint64_t assigned = 0; ///< Entry state the code was compiled for
+    bool failed = false;
+    std::unique_ptr<jit_code> code;
+};
+
+struct jit_stats
+{
+    std::size_t compiled = 0, failed = 0;
+    std::size_t native_runs = 0, deopts = 0;
+};
+
+} // namespace runtime
+
+} // namespace emel
@@ -19,8 +19,12 @@
  */
 #include "object.h"
 #include "../type-system/context.h"
+#include "../type-system/map-data.h"
+#include "../type-system/str-kernels.h"
 
+#include <cmath>
 #include <cstring>
+#include <stdexcept>
 
 namespace emel { namespace runtime {
 
@@ -108,40 +112,74 @@ void object::swap(object &other) noexcept
 
 void object::detach()
 {
-//	if(type::local != d.get_state())
-//	{
-//		void *ptr = nullptr;
-//		const auto res = d.get(ptr);
-//		assert(res);
-//		auto *const ac = static_cast<memory::atomic_counted *>(ptr);
-//		auto *const od = static_cast<object_data *>(ac->get());
-//
-//		bool maybe_local = true;
-//		switch(d.get_kind())
-//		{
-//			case type::none: d.set(nullptr); break;
-//			case type::bool_: d.set(od->get_bool()); break;
-//			case type::int_: d.set(od->get_int()); break;
-//			case type::num: d.set(od->get_num()); break;
-//
-//			case type::str: {
-//				auto str = od->get_str();
-//				if (str.size() <= type::rep::local_bytes_count) {
-//					d.set(str);
-//					break;
-//				}
-//
-//				// fall through
-//			}
-//
-//			default: maybe_local = false; break;
-//		}
-//
-//		if(!maybe_local && !ac->unique()) {
-//			d.set(ac->clone());
-//			ac->release();
-//		}
-//	}
+	// other values are immutable or have the reference semantics
+	if(d.is_arr())
+		detach_arr(d);
+	else if(get_map(d))
+		detach_map(d);
+}
+
+void object::set(std::size_t i, const object &value)
+{
+	if(!d.is_arr())
+		throw std::invalid_argument("object: elements of non-array can't be set");
+	detach_arr(d)->set(i, value.d);
+}
+
+void object::push_back(const object &value)
+{
+	if(!d.is_arr())
+		throw std::invalid_argument("object: can't append to non-array");
+	detach_arr(d)->push_back(value.d);
+}
+
+/// Index of arr element, given as a non-negative integral number
+static std::size_t element_index(const type::rep &key)
+{
+	double idx;
+	if(key.is_local_int())
+		idx = double(key.local_int());
+	else if(key.is_local_num())
+		idx = key.local_num();
+	else
+		throw std::invalid_argument("object: index of array must be a number");
+
+	if(!(idx >= 0) || std::trunc(idx) != idx)
+		throw std::out_of_range("object: index of array must be a non-negative integer");
+	return std::size_t(idx);
+}
+
+object object::load(const object &key) const
+{
+	if(d.is_arr())
+		return object(d.get_counted_unchecked()->get<array_data>()->at(element_index(key.d)));
+
+	if(const map_data *const md = get_map(d)) {
+		const type::rep *const value = md->find(key.d);
+		return value ? object(*value) : object();
+	}
+
+	throw std::invalid_argument("object: elements of non-container can't be loaded");
+}
+
+void object::store(const object &key, const object &value)
+{
+	if(d.is_arr()) {
+		array_data *const ad = detach_arr(d);
+		const std::size_t idx = element_index(key.d);
+		if(ad->size() == idx)
+			ad->push_back(value.d);
+		else
+			ad->set(idx, value.d);
+		return;
+	}
+
+	if(get_map(d)) {
+		detach_map(d)->set(key.d, value.d);
+		return;
+	}
+
+	throw std::invalid_argument("object: elements of non-container can't be stored");
 }
 
 object &object::operator =(const std::string &s)
@@ -171,37 +209,43 @@ object &object::operator =(reference ref)
 
 type::kind object::get_type() const
 {
-	return d.get_type()->get_kind();
+	return d.get_kind();
 }
 
 bool object::empty() const
 {
-//	return d->empty();
+	return d.ops().empty(d);
 }
 
 std::size_t object::size() const
 {
-//	return d->size();
+	return d.ops().size(d);
 }
 
 object::operator bool() const
 {
-//	return d->get_bool();
+	return d.ops().get_bool(d);
 }
 
 object::operator std::int64_t () const
 {
-//	return d->get_int();
+	return d.ops().get_int(d);
 }
 
 object::operator double() const
 {
-//	return d->get_num();
+	return d.ops().get_num(d);
 }
 
 object::operator std::string() const
 {
-//	return d->get_str();
+	return d.ops().get_str(d);
+}
+
+/// Booleans, ints and nums are compared and computed as nums
+static bool is_numeric(type::kind k) noexcept
+{
+	return type::num == k || type::int_ == k || type::bool_ == k;
 }
 
 object::operator reference() const
@@ -211,6 +255,14 @@ object::operator reference() const
 
 bool object::operator ==(const object &other) const
 {
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs)
+		return str_equal(str_view(d), str_view(other.d));
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return d.ops().get_num(d) == other.d.ops().get_num(other.d);
+	if(type::none == lhs || type::none == rhs)
+		return lhs == rhs;
+
 //    switch(d.get_kind())
 //	{
 //        case type::none:
@@ -242,6 +294,12 @@ bool object::operator !=(const object &other) const
 
 bool object::operator <(const object &other) const
 {
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs)
+		return str_compare(str_view(d), str_view(other.d)) < 0;
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return d.ops().get_num(d) < other.d.ops().get_num(other.d);
+
 //    switch(d.get_kind())
 //	{
 //        case type::none: return false;
@@ -264,6 +322,12 @@ bool object::operator <(const object &other) const
 
 bool object::operator >(const object &other) const
 {
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs)
+		return str_compare(str_view(d), str_view(other.d)) > 0;
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return d.ops().get_num(d) > other.d.ops().get_num(other.d);
+
 //    switch(d.get_kind())
 //	{
 //        case type::none: return false;
@@ -286,6 +350,12 @@ bool object::operator >(const object &other) const
 
 bool object::operator <=(const object &other) const
 {
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs)
+		return str_compare(str_view(d), str_view(other.d)) <= 0;
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return d.ops().get_num(d) <= other.d.ops().get_num(other.d);
+
 //	switch(d.get_kind())
 //	{
 //		case type::none: return false;
@@ -308,6 +378,12 @@ bool object::operator <=(const object &other) const
 
 bool object::operator >=(const object &other) const
 {
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs)
+		return str_compare(str_view(d), str_view(other.d)) >= 0;
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return d.ops().get_num(d) >= other.d.ops().get_num(other.d);
+
 //	switch(d.get_kind())
 //	{
 //		case type::none: return false;
@@ -330,6 +406,18 @@ bool object::operator >=(const object &other) const
 
 object object::operator +(const object &other) const
 {
+	// strings are concatenated lazily, see string_data::concat
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs || type::str == rhs) {
+		const auto to_str = [](const type::rep &r) {
+			return type::str == r.get_kind() ? r : type::rep(r.ops().get_str(r));
+		};
+		return object(string_data::concat(to_str(d), to_str(other.d)));
+	}
+
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return object(d.ops().get_num(d) + other.d.ops().get_num(other.d));
+
 //    switch(d.get_kind())
 //	{
 //        case type::none:
@@ -362,6 +450,24 @@ object object::operator +(const object &other) const
 
 object object::operator -(const object &other) const
 {
+	// removes the first occurrence of the substring
+	const type::kind lhs = get_type(), rhs = other.get_type();
+	if(type::str == lhs && type::str == rhs) {
+		const auto str = str_view(d), sub = str_view(other.d);
+		const std::size_t pos = str_find(str, sub);
+		if(sub.empty() || str_kernels::npos == pos)
+			return *this;
+
+		std::string res;
+		res.reserve(str.size() - sub.size());
+		res.append(str.data(), pos);
+		res.append(str.data() + pos + sub.size(), str.size() - pos - sub.size());
+		return object(res);
+	}
+
+	if(is_numeric(lhs) && is_numeric(rhs))
+		return object(d.ops().get_num(d) - other.d.ops().get_num(other.d));
+
 //    switch(d.get_kind())
 //	{
 //        case type::none:
@@ -405,6 +511,23 @@ object object::operator -(const object &other) const
 
 object object::operator *(const object &other) const
 {
+	if(is_numeric(get_type()) && is_numeric(other.get_type()))
+		return object(d.ops().get_num(d) * other.d.ops().get_num(other.d));
+
+	// strings are repeated up to 1000 times, otherwise kept as is
+	if(type::str == get_type() && is_numeric(other.get_type())) {
+		const auto count = other.d.ops().get_num(other.d);
+		if(!(count >= 0 && count < 1000))
+			return *this;
+
+		const std::string str = d.ops().get_str(d);
+		std::string res;
+		res.reserve(str.size() * std::size_t(count));
+		for(auto i = std::size_t(count); i > 0; --i)
+			res.append(str);
+		return object(res);
+	}
+
 //	switch(d.get_kind())
 //	{
 //        case type::none:
@@ -446,6 +569,9 @@ object object::operator *(const object &other) const
 
 object object::operator /(const object &other) const
 {
+	if(is_numeric(get_type()) && is_numeric(other.get_type()))
+		return object(d.ops().get_num(d) / other.d.ops().get_num(other.d));
+
 //    switch(d.get_kind())
 //	{
 //        case type::none:
@@ -486,24 +612,24 @@ object object::operator[](std::size_t i) const
 boost::optional<bool> object::as_bool() const
 {
     boost::optional<bool> ret;
-//    if(type::bool_ == d.get_kind())
-//		ret = d->get_bool();
+    if(type::bool_ == d.get_kind())
+		ret = d.ops().get_bool(d);
     return ret;
 }
 
 boost::optional<double> object::as_number() const
 {
     boost::optional<double> ret;
-//    if(type::num == d.get_kind())
-//		ret = d->get_num();
+    if(type::num == d.get_kind() || type::int_ == d.get_kind())
+		ret = d.ops().get_num(d);
     return ret;
 }
 
 boost::optional<std::string> object::as_string() const
 {
     boost::optional<std::string> ret;
-//    if(type::str == d.get_kind())
-//		ret = d->get_str();
+    if(type::str == d.get_kind())
+		ret = d.ops().get_str(d);
     return ret;
 }
 
@@ -33,9 +33,9 @@ class object
 {
 protected:
 	type::rep d;
-    explicit object(type::rep d);
 
 public:
+    explicit object(type::rep d);
     object();
     object(const std::vector<object> &vec);
     object(std::vector<object> &&vec);
@@ -54,8 +54,22 @@ public:
     object &operator =(object &&other);
 
     void swap(object &other) noexcept;
+
+	/// Copies of arrays and maps share the elements until the first
+	/// mutation, take an own copy of them now
 	void detach();
 
+	/// Mutate the array, detaching it from its copies first
+	void set(std::size_t i, const object &value);
+	void push_back(const object &value);
+
+	/// Element of array at the index @a key or value of map at @a key,
+	/// empty object if the map has no such key
+	object load(const object &key) const;
+	/// Store to array or map, detaching it from its copies first.
+	/// Storing to the index past the end of array appends.
+	void store(const object &key, const object &value);
+
     object &operator =(const std::string &s);
     object &operator =(const char *s);
     object &operator =(double num);
@@ -66,6 +80,8 @@ public:
     bool empty() const;
     std::size_t size() const;
 
+    const type::rep &get_rep() const noexcept { return d; }
+
     virtual operator bool() const;
     virtual operator std::int64_t() const;
     virtual operator double() const;
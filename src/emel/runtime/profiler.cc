@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "profiler.h"
+#include "../semantic.h"
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+
+#include <signal.h>
+#include <sys/time.h>
+
+namespace emel { namespace runtime {
+
+static std::atomic<profiler *> s_sampling { nullptr };
+static struct sigaction s_old_action;
+
+profiler::profiler(const linked_insn *code_base)
+    : code_base(code_base), profiles(1), active(1)
+{
+    profiles.back().name = "<code>";
+}
+
+profiler::~profiler()
+{
+    if(this == s_sampling.load())
+        stop_sampling();
+}
+
+void profiler::add_method(const semantic::function &fn, std::string name, ast::position pos)
+{
+    add_method(std::move(name), fn.code_range.first, fn.code_range.second, std::move(pos));
+}
+
+void profiler::add_method(std::string name, std::size_t first, std::size_t last, ast::position pos)
+{
+    if(first >= last)
+        throw std::runtime_error("empty code range of method " + name);
+    if(!activations.empty())
+        throw std::runtime_error("methods can't be added while profiling");
+
+    auto it = std::lower_bound(methods.begin(), methods.end(), first,
+        [](const method_info &info, std::size_t pc) { return info.first < pc; });
+
+    methods.insert(it, method_info { std::move(name), first, last, std::move(pos) });
+    method_cache.clear();
+
+    // keep the unnamed method the last one
+    profiles.assign(methods.size() + 1, method_profile());
+    for(std::size_t idx = 0; idx < methods.size(); ++idx) {
+        profiles[idx].name = methods[idx].name;
+        profiles[idx].pos = methods[idx].pos;
+    }
+    profiles.back().name = "<code>";
+    active.assign(profiles.size(), 0);
+}
+
+void profiler::add_position(std::size_t pc, ast::position pos)
+{
+    auto it = std::lower_bound(lines.begin(), lines.end(), pc,
+        [](const std::pair<std::size_t, ast::position> &line, std::size_t key) {
+            return line.first < key;
+        });
+
+    if(lines.end() != it && it->first == pc)
+        it->second = std::move(pos);
+    else
+        lines.emplace(it, pc, std::move(pos));
+}
+
+std::uint32_t profiler::find_method(const linked_insn *start_pc)
+{
+    auto cached = method_cache.find(start_pc);
+    if(method_cache.end() != cached)
+        return cached->second;
+
+    const std::size_t pc = std::size_t(start_pc - code_base);
+    auto it = std::upper_bound(methods.begin(), methods.end(), pc,
+        [](std::size_t key, const method_info &info) { return key < info.first; });
+
+    std::uint32_t method = std::uint32_t(methods.size());
+    if(methods.begin() != it && pc < (--it)->last)
+        method = std::uint32_t(it - methods.begin());
+
+    method_cache.emplace(start_pc, method);
+    return method;
+}
+
+void profiler::enter(const linked_insn *start_pc)
+{
+    const std::uint32_t method = find_method(start_pc);
+    const std::uint32_t depth = std::uint32_t(activations.size());
+
+    ++profiles[method].calls;
+    ++active[method];
+    activations.push_back(activation { method, std::chrono::steady_clock::now() });
+
+    if(depth < max_depth) {
+        // the caller stays at its call instruction
+        if(depth)
+            stack_pcs[depth - 1] = current_pc.load(std::memory_order_relaxed);
+        stack_methods[depth] = method;
+        stack_pcs[depth] = start_pc;
+        current_pc.store(start_pc, std::memory_order_relaxed);
+        stack_depth.store(depth + 1, std::memory_order_release);
+    }
+}
+
+void profiler::leave()
+{
+    // frames entered before the profiler was attached
+    if(activations.empty())
+        return;
+
+    const activation &act = activations.back();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - act.start);
+
+    method_profile &profile = profiles[act.method];
+    profile.exclusive += elapsed - act.callees;
+
+    // time of recursive calls is already in the outermost activation
+    if(!--active[act.method])
+        profile.inclusive += elapsed;
+
+    activations.pop_back();
+    if(!activations.empty())
+        activations.back().callees += elapsed;
+
+    const std::uint32_t depth = std::uint32_t(activations.size());
+    if(depth < max_depth) {
+        stack_depth.store(depth, std::memory_order_release);
+        current_pc.store(depth ? stack_pcs[depth - 1] : nullptr, std::memory_order_relaxed);
+    }
+}
+
+void profiler::unwind(std::size_t depth)
+{
+    while(activations.size() > depth)
+        leave();
+}
+
+void profiler::on_signal(int)
+{
+    profiler *const self = s_sampling.load(std::memory_order_acquire);
+    if(!self)
+        return;
+
+    const std::uint32_t depth = self->stack_depth.load(std::memory_order_acquire);
+    if(!depth)
+        return;
+
+    const std::size_t idx = self->nr_samples.fetch_add(1, std::memory_order_relaxed);
+    if(idx >= self->samples.size())
+        return;
+
+    sample &s = self->samples[idx];
+    s.depth = depth;
+    std::copy_n(self->stack_methods.begin(), depth, s.methods.begin());
+    std::copy_n(self->stack_pcs.begin(), depth, s.pcs.begin());
+    s.pcs[depth - 1] = self->current_pc.load(std::memory_order_relaxed);
+}
+
+void profiler::start_sampling(std::chrono::microseconds interval, std::size_t capacity)
+{
+    profiler *expected = nullptr;
+    if(!s_sampling.compare_exchange_strong(expected, this))
+        throw std::runtime_error("another profiler is sampling already");
+
+    samples.assign(capacity, sample());
+    nr_samples.store(0);
+
+    struct sigaction action;
+    action.sa_handler = &profiler::on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if(sigaction(SIGPROF, &action, &s_old_action)) {
+        s_sampling.store(nullptr);
+        throw std::runtime_error("can't install the SIGPROF handler");
+    }
+
+    const auto usecs = std::max<std::int64_t>(interval.count(), 1);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = timer.it_value.tv_sec = usecs / 1000000;
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = usecs % 1000000;
+
+    if(setitimer(ITIMER_PROF, &timer, nullptr)) {
+        sigaction(SIGPROF, &s_old_action, nullptr);
+        s_sampling.store(nullptr);
+        throw std::runtime_error("can't start the profiling timer");
+    }
+}
+
+void profiler::stop_sampling()
+{
+    if(this != s_sampling.load())
+        return;
+
+    struct itimerval timer { };
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &s_old_action, nullptr);
+    s_sampling.store(nullptr);
+}
+
+std::vector<method_profile> profiler::get_method_profiles() const
+{
+    return profiles;
+}
+
+std::size_t profiler::samples_count() const noexcept
+{
+    return std::min(nr_samples.load(), samples.size());
+}
+
+ast::position profiler::position_of(const linked_insn *pc) const
+{
+    const std::size_t idx = std::size_t(pc - code_base);
+    auto it = std::upper_bound(lines.begin(), lines.end(), idx,
+        [](std::size_t key, const std::pair<std::size_t, ast::position> &line) {
+            return key < line.first;
+        });
+
+    auto method = std::upper_bound(methods.begin(), methods.end(), idx,
+        [](std::size_t key, const method_info &info) { return key < info.first; });
+
+    const method_info *info = nullptr;
+    if(methods.begin() != method && idx < (--method)->last)
+        info = &*method;
+
+    // the line must be inside of the method of the instruction
+    if(lines.begin() != it) {
+        --it;
+        if(!info || it->first >= info->first)
+            return it->second;
+    }
+
+    return info ? info->pos : ast::position();
+}
+
+std::string profiler::frame_name(std::uint32_t method, const linked_insn *pc) const
+{
+    std::string name = profiles.at(method).name;
+    if(!pc)
+        return name;
+
+    const ast::position pos = position_of(pc);
+    if(pos.file)
+        name += " (" + *pos.file + ':' + std::to_string(pos.line) + ')';
+    return name;
+}
+
+void profiler::write_folded(std::ostream &os) const
+{
+    std::map<std::string, std::size_t> stacks;
+
+    for(std::size_t idx = 0, count = samples_count(); idx < count; ++idx) {
+        const sample &s = samples[idx];
+        std::string stack;
+
+        for(std::uint32_t level = 0; level < s.depth; ++level) {
+            if(level)
+                stack += ';';
+            stack += frame_name(s.methods[level], s.pcs[level]);
+        }
+
+        ++stacks[stack];
+    }
+
+    for(const auto &pair : stacks)
+        os << pair.first << ' ' << pair.second << '\n';
+}
+
+void profiler::write_opcode_counts(std::ostream &os) const
+{
+    for(std::size_t idx = 0; idx < opcode_counts.size(); ++idx)
+        if(opcode_counts[idx])
+            os << opcode_name(static_cast<opcode>(idx)) << ' ' << opcode_counts[idx] << '\n';
+}
+
+} // namespace runtime
+
+} // namespace emel
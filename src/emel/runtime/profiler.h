@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../ast.h"
+#include "code.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace emel { namespace semantic { struct function; } }
+
+namespace emel { namespace runtime {
+
+/// Profile of a method: entries, time spent in the method with its
+/// callees (inclusive) and in its own code only (exclusive)
+struct method_profile
+{
+    std::string name;
+    ast::position pos;
+    std::uint64_t calls = 0;
+    std::chrono::nanoseconds inclusive { 0 }, exclusive { 0 };
+};
+
+/// Profiler attached to the interpreter by interp::set_profiler.
+/// Counts dispatched instructions by opcode, times the methods
+/// and samples the current pc of the interpreter by a timer signal.
+/// Methods are the code ranges of semantic::function counted from
+/// the beginning of the code object, code outside of them is
+/// accounted to an unnamed method.
+class EMEL_EXPORT profiler
+{
+public:
+    static constexpr std::size_t max_depth = 64; ///< Deeper frames are not sampled
+    static constexpr std::uint32_t no_method = ~std::uint32_t(0);
+
+    /// Sampled stack of methods, the outermost first
+    struct sample {
+        std::uint32_t depth;
+        std::array<std::uint32_t, max_depth> methods;
+        std::array<const linked_insn *, max_depth> pcs;
+    };
+
+private:
+    struct method_info {
+        std::string name;
+        std::size_t first, last;
+        ast::position pos;
+    };
+
+    struct activation {
+        std::uint32_t method;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds callees { 0 };
+    };
+
+    const linked_insn *const code_base;
+    std::array<std::uint64_t, static_cast<std::size_t>(opcode::max_opcode)> opcode_counts { };
+
+    std::vector<method_info> methods; ///< Sorted by the code range
+    std::vector<method_profile> profiles; ///< The last one for the unnamed method
+    std::vector<std::uint32_t> active; ///< Activations of each method on the stack
+    std::vector<std::pair<std::size_t, ast::position>> lines; ///< Sorted by pc
+    std::unordered_map<const linked_insn *, std::uint32_t> method_cache;
+    std::vector<activation> activations;
+
+    // read by the signal handler
+    std::array<std::uint32_t, max_depth> stack_methods { };
+    std::array<const linked_insn *, max_depth> stack_pcs { };
+    std::atomic<std::uint32_t> stack_depth { 0 };
+    std::atomic<const linked_insn *> current_pc { nullptr };
+    std::vector<sample> samples;
+    std::atomic<std::size_t> nr_samples { 0 };
+
+    static void on_signal(int);
+
+public:
+    explicit profiler(const linked_insn *code_base);
+    ~profiler();
+
+    profiler(const profiler &) = delete;
+    profiler &operator =(const profiler &) = delete;
+
+    /// Register the method, whose code_range was filled by codegen.
+    /// @a pos is the position of the method declaration.
+    void add_method(const semantic::function &fn, std::string name, ast::position pos);
+    void add_method(std::string name, std::size_t first, std::size_t last, ast::position pos);
+
+    /// Map instructions from @a pc up to the next mapped one to @a pos
+    void add_position(std::size_t pc, ast::position pos);
+
+    /// Called on each dispatched instruction
+    void count(const linked_insn *pc) noexcept
+    {
+        ++opcode_counts[static_cast<std::size_t>(pc->op)];
+        current_pc.store(pc, std::memory_order_relaxed);
+    }
+
+    /// Called on the entry to the frame of the code at @a start_pc
+    void enter(const linked_insn *start_pc);
+
+    /// Called when the current frame returns
+    void leave();
+
+    /// Drop activations above @a depth, left by an exception
+    void unwind(std::size_t depth);
+
+    std::size_t depth() const noexcept { return activations.size(); }
+
+    /// Sample the interpreter every @a interval of the process CPU time,
+    /// keeping at most @a capacity samples. Only one profiler samples
+    /// at a time, it must run on the thread of the interpreter.
+    void start_sampling(std::chrono::microseconds interval, std::size_t capacity = 1 << 16);
+    void stop_sampling();
+
+    std::uint64_t opcode_count(opcode op) const {
+        return opcode_counts.at(static_cast<std::size_t>(op));
+    }
+
+    /// Profiles of all methods, the unnamed method is the last one
+    std::vector<method_profile> get_method_profiles() const;
+
+    std::size_t samples_count() const noexcept;
+    const sample &get_sample(std::size_t idx) const { return samples.at(idx); }
+
+    /// Position of the instruction at @a pc
+    ast::position position_of(const linked_insn *pc) const;
+
+    /// Write samples in the folded stacks format of flamegraph.pl:
+    /// "method (file:line);callee (file:line) count" per line
+    void write_folded(std::ostream &os) const;
+
+    /// Write the dispatch counters, one "opcode count" per line
+    void write_opcode_counts(std::ostream &os) const;
+
+private:
+    std::uint32_t find_method(const linked_insn *start_pc);
+    std::string frame_name(std::uint32_t method, const linked_insn *pc) const;
+};
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../reg-opcodes.h"
+#include "const-pool.h"
+#include "fast-ops.h"
+#include "object.h"
+
+#include <cassert>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+/// Executor of the register code, produced by compiler::reg_translator.
+/// Registers are the locals followed by the temporaries of the method.
+class reg_interp
+{
+protected:
+    const reg_code &code;
+    const materialized_pool consts;
+    std::vector<object> regs;
+
+public:
+    reg_interp(const std::vector<value_type> &const_pool, const reg_code &code)
+        : code(code), consts(const_pool), regs(code.nr_regs)
+    {
+    }
+
+    reg_interp(const reg_interp &) = delete;
+    reg_interp &operator =(const reg_interp &) = delete;
+
+    object run()
+    {
+        const reg_insn *pc = code.insns.data();
+        const reg_insn *const end_pc = pc + code.insns.size();
+        object scratch_b, scratch_c;
+
+        while(pc != end_pc) {
+            assert(reg_operand::reg == reg_operand::kind_of(pc->a)
+                   || reg_opcode::ret == pc->op || reg_opcode::jt == pc->op
+                   || reg_opcode::jf == pc->op || reg_opcode::jmp == pc->op);
+
+            switch(pc->op) {
+                case reg_opcode::move:
+                    regs[pc->a] = fetch(pc->b, scratch_b);
+                    break;
+
+                case reg_opcode::swap:
+                    regs[pc->a].swap(regs[pc->b]);
+                    break;
+
+                case reg_opcode::ret:
+                    return pc->b ? fetch(pc->a, scratch_b) : object();
+
+                case reg_opcode::not_: {
+                    const object &operand = fetch(pc->b, scratch_b);
+                    object res;
+                    if(__builtin_expect(!eval_fast_op(op_kind::not_, operand, operand, res), false))
+                        res = !operand;
+                    regs[pc->a] = std::move(res);
+                    break;
+                }
+
+                case reg_opcode::neg: {
+                    const object &operand = fetch(pc->b, scratch_b);
+                    object res;
+                    if(__builtin_expect(!eval_fast_op(op_kind::neg, operand, operand, res), false))
+                        res = - (double) operand;
+                    regs[pc->a] = std::move(res);
+                    break;
+                }
+
+# define BINARY_OP(OP, EXPR) \
+                case reg_opcode::OP: { \
+                    const object &lhs = fetch(pc->b, scratch_b); \
+                    const object &rhs = fetch(pc->c, scratch_c); \
+                    object res; \
+                    if(__builtin_expect(!eval_fast_op(op_kind::OP, lhs, rhs, res), false)) \
+                        res = EXPR; \
+                    regs[pc->a] = std::move(res); \
+                    break; \
+                }
+
+                BINARY_OP(or_, lhs || rhs)
+                BINARY_OP(xor_, !lhs != !rhs)
+                BINARY_OP(and_, lhs && rhs)
+                BINARY_OP(eq, lhs == rhs)
+                BINARY_OP(ne, lhs != rhs)
+                BINARY_OP(lt, lhs < rhs)
+                BINARY_OP(gt, lhs > rhs)
+                BINARY_OP(lte, lhs <= rhs)
+                BINARY_OP(gte, lhs >= rhs)
+                BINARY_OP(add, lhs + rhs)
+                BINARY_OP(sub, lhs - rhs)
+                BINARY_OP(mul, lhs * rhs)
+                BINARY_OP(div, lhs / rhs)
+
+# undef BINARY_OP
+
+                case reg_opcode::jmp:
+                    pc += static_cast<std::int32_t>(pc->b);
+                    continue;
+
+                case reg_opcode::jt:
+                    if(static_cast<bool>(fetch(pc->a, scratch_b))) {
+                        pc += static_cast<std::int32_t>(pc->b);
+                        continue;
+                    }
+                    break;
+
+                case reg_opcode::jf:
+                    if(!static_cast<bool>(fetch(pc->a, scratch_b))) {
+                        pc += static_cast<std::int32_t>(pc->b);
+                        continue;
+                    }
+                    break;
+
+                default:
+                    assert(false);
+            }
+
+            ++pc;
+        }
+
+        return object();
+    }
+
+protected:
+    const object &fetch(std::uint32_t operand, object &scratch)
+    {
+        const auto idx = reg_operand::index_of(operand);
+
+        switch(reg_operand::kind_of(operand)) {
+            case reg_operand::reg:
+                assert(regs.size() > idx);
+                return regs[idx];
+
+            case reg_operand::constant:
+                assert(consts.size() > idx);
+                return consts[idx];
+
+            default:
+                scratch = double(idx);
+                return scratch;
+        }
+    }
+};
+
+} // namespace runtime
+
+} // namespace emel
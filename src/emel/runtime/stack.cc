@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "stack.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace emel { namespace runtime {
+
+value_stack::value_stack(std::size_t initial_size)
+{
+    segments.push_back({ std::unique_ptr<object[]>(new object[initial_size]), initial_size });
+}
+
+std::size_t value_stack::capacity() const noexcept
+{
+    return std::accumulate(segments.cbegin(), segments.cend(), std::size_t(0),
+        [](std::size_t sum, const segment &seg) { return sum + seg.size; });
+}
+
+object *value_stack::next_segment(std::size_t size, std::size_t &segment_idx)
+{
+    ++current;
+
+    // drop cached segment, if it is too small for the window
+    if(current < segments.size() && segments[current].size < size)
+        segments.erase(segments.begin() + current, segments.end());
+
+    if(current == segments.size()) {
+        const auto new_size = std::max(size, segments.back().size * 2);
+        segments.push_back({ std::unique_ptr<object[]>(new object[new_size]), new_size });
+    }
+
+    segment_idx = current;
+    return segments[current].slots.get();
+}
+
+} // namespace runtime
+
+} // namespace emel
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "object.h"
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+namespace emel { namespace runtime {
+
+/// Contiguous stack of values shared by all frames of an interpreter.
+/// Every frame is a window of it: locals followed by the operand stack.
+/// The stack grows by segments, so windows never move; a window which
+/// doesn't fit into the current segment starts the next one.
+class EMEL_EXPORT value_stack
+{
+    struct segment {
+        std::unique_ptr<object[]> slots;
+        std::size_t size;
+    };
+
+    std::vector<segment> segments;
+    std::size_t current = 0;
+
+public:
+    static constexpr std::size_t default_segment_size = 1024;
+
+    explicit value_stack(std::size_t initial_size = default_segment_size);
+
+    /// Reserve window of @a size slots at @a base, or at the beginning
+    /// of the next segment, if the current one is too small.
+    object *reserve(object *base, std::size_t size, std::size_t &segment_idx)
+    {
+        const segment &seg = segments[current];
+
+        if(!base)
+            base = seg.slots.get();
+
+        if(__builtin_expect(base + size <= seg.slots.get() + seg.size, true)) {
+            segment_idx = current;
+            return base;
+        }
+
+        return next_segment(size, segment_idx);
+    }
+
+    /// Return back to the segment of the caller's window
+    void release(std::size_t segment_idx) noexcept {
+        assert(segment_idx <= current);
+        current = segment_idx;
+    }
+
+    object *segment_end(std::size_t segment_idx) const noexcept {
+        return segments[segment_idx].slots.get() + segments[segment_idx].size;
+    }
+
+    std::size_t capacity() const noexcept;
+
+private:
+    object *next_segment(std::size_t size, std::size_t &segment_idx);
+};
+
+/// Bump allocator for objects with strict LIFO lifetime.
+/// Memory is taken by chunks, which are kept for reuse until
+/// the arena itself is destroyed.
+template <typename Tp>
+class bump_arena
+{
+    using storage_type = typename std::aligned_storage<sizeof(Tp),
+        std::alignment_of<Tp>::value>::type;
+
+    std::vector<std::unique_ptr<storage_type[]>> chunks;
+    std::size_t chunk_idx = 0, offset = 0, count = 0;
+
+public:
+    static constexpr std::size_t chunk_size = 256;
+
+    bump_arena() = default;
+    bump_arena(const bump_arena &) = delete;
+    bump_arena &operator =(const bump_arena &) = delete;
+
+    ~bump_arena() {
+        while(count)
+            pop();
+    }
+
+  template <typename... Args>
+    Tp *emplace(Args &&...args)
+    {
+        if(offset == chunk_size) {
+            ++chunk_idx;
+            offset = 0;
+        }
+
+        if(chunk_idx == chunks.size())
+            chunks.emplace_back(new storage_type[chunk_size]);
+
+        Tp *const ptr = reinterpret_cast<Tp *>(&chunks[chunk_idx][offset]);
+        new (ptr) Tp(std::forward<Args>(args)...);
+        ++offset;
+        ++count;
+        return ptr;
+    }
+
+    void pop() noexcept
+    {
+        assert(count);
+
+        if(!offset) {
+            assert(chunk_idx);
+            --chunk_idx;
+            offset = chunk_size;
+        }
+
+        --offset;
+        --count;
+        reinterpret_cast<Tp *>(&chunks[chunk_idx][offset])->~Tp();
+    }
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return 0 == count; }
+};
+
+} // namespace runtime
+
+} // namespace emel
@@ -18,6 +18,8 @@
  * <http://www.gnu.org/licenses/>.
  */
 #include "context.h"
+#include "type-builtins.h"
+#include "str-kernels.h"
 
 #include <boost/algorithm/string/split.hpp>
 
@@ -29,8 +31,12 @@
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/random_access_index.hpp>
 
-#include <codecvt>
-#include <locale>
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
 
 namespace emel { inline namespace type_system {
 
@@ -179,76 +185,697 @@ context_info_storage::get_ti(const std::string &name)
 	return std::make_pair(*it, true);
 }
 
-struct string_codec : std::codecvt<char_type, char, std::mbstate_t> { };
-
-using conv_type = std::wstring_convert<string_codec,
-	char_type, rt_allocator<char_type>>;
-
 string_data::string_data(const char *str, std::size_t len)
-	: u(get_alloc())
+	: u(get_alloc()), offsets(get_alloc())
 {
 	set(str, len);
 }
 
+/// Sizes of the str rep, without flattening it
+static void measure(const type::rep &r, std::size_t &length, std::size_t &bytes, bool &ascii)
+{
+	if(r.is_counted_str()) {
+		const auto *const sd = r.get_counted_unchecked()->get<string_data>();
+		length = sd->length;
+		bytes = sd->bytes;
+		ascii = sd->ascii;
+		return;
+	}
+
+	if(type::str != r.get_kind())
+		throw std::invalid_argument("concatenation of non-str value");
+
+	const std::string str = r.get_str_unchecked();
+	length = string_data::count_chars(str.data(), str.size(), &ascii);
+	bytes = str.size();
+}
+
+string_data::string_data(const type::rep &lhs, const type::rep &rhs)
+	: u(get_alloc()), left(lhs), right(rhs), offsets(get_alloc())
+{
+	std::size_t rhs_length, rhs_bytes;
+	bool rhs_ascii;
+
+	measure(lhs, length, bytes, ascii);
+	measure(rhs, rhs_length, rhs_bytes, rhs_ascii);
+
+	length += rhs_length;
+	bytes += rhs_bytes;
+	ascii = ascii && rhs_ascii;
+}
+
+/// The flat copy of a concatenation is built for the copy anew
+string_data::string_data(const string_data &other)
+	: u(other.u), left(other.left), right(other.right), offsets(other.offsets)
+	, length(other.length), bytes(other.bytes), ascii(other.ascii)
+{
+}
+
+string_data::~string_data()
+{
+	delete flat.load(std::memory_order_relaxed);
+	if(!is_concat())
+		return;
+
+	// release long chains of concatenations without recursion
+	std::vector<type::rep> pending;
+	pending.push_back(std::move(left));
+	pending.push_back(std::move(right));
+
+	while(!pending.empty()) {
+		type::rep r = std::move(pending.back());
+		pending.pop_back();
+
+		if(r.is_counted_str() && r.get_counted_unchecked()->unique()) {
+			auto *const sd = r.get_counted_unchecked()->get<string_data>();
+			if(sd->is_concat()) {
+				pending.push_back(std::move(sd->left));
+				pending.push_back(std::move(sd->right));
+			}
+		}
+	}
+}
+
+/*static*/
+std::size_t string_data::count_chars(const char *utf8, std::size_t len, bool *ascii)
+{
+	std::size_t nr_chars = 0;
+	bool only_ascii = true;
+
+	for(std::size_t idx = 0; idx < len; ++idx) {
+		const auto c = static_cast<unsigned char>(utf8[idx]);
+		only_ascii = only_ascii && c < 0x80;
+		if(0x80 != (c & 0xc0))
+			++nr_chars;
+	}
+
+	if(ascii)
+		*ascii = only_ascii;
+	return nr_chars;
+}
+
+/*static*/
+type::rep string_data::concat(const type::rep &lhs, const type::rep &rhs)
+{
+	std::size_t lhs_len, rhs_len, bytes;
+	bool ascii;
+
+	measure(lhs, lhs_len, bytes, ascii);
+	measure(rhs, rhs_len, bytes, ascii);
+
+	if(!lhs_len)
+		return rhs;
+	if(!rhs_len)
+		return lhs;
+
+	if(lhs_len + rhs_len < min_concat_length)
+		return type::rep(lhs.ops().get_str(lhs) + rhs.ops().get_str(rhs));
+
+	type::rep res;
+	res.set_str(memory::counted_ptr(memory::make_counted<string_data>(lhs, rhs), false));
+	return res;
+}
+
+/*static*/
+type::rep string_data::intern(const char *str, std::size_t len)
+{
+	type::rep res(str, len);
+	if(!res.is_counted_str() || len > max_interned_length)
+		return res;
+
+	// never destroyed, interned reps may outlive the static storage
+	static std::mutex lock;
+	static auto *const table = new std::unordered_map<std::string, type::rep, str_hasher, str_equal_to>();
+
+	std::lock_guard<std::mutex> lk(lock);
+	auto pair = table->emplace(std::string(str, len), res);
+	return pair.first->second;
+}
+
+const string_data &string_data::flatten() const
+{
+	if(!is_concat())
+		return *this;
+
+	if(const auto *const done = flat.load(std::memory_order_acquire))
+		return *done;
+
+	auto *const res = new string_data("", 0);
+	string_type &buf = res->u;
+	buf.reserve(bytes);
+
+	std::vector<const type::rep *> pending { &right, &left };
+
+	// operands are kept alive by left and right and never changed
+	while(!pending.empty()) {
+		const type::rep *const r = pending.back();
+		pending.pop_back();
+
+		if(r->is_counted_str()) {
+			const auto *const sd = r->get_counted_unchecked()->get<string_data>();
+			const auto *const done = sd->is_concat()
+				? sd->flat.load(std::memory_order_acquire) : sd;
+			if(done)
+				buf.append(done->u);
+			else {
+				pending.push_back(&sd->right);
+				pending.push_back(&sd->left);
+			}
+		} else {
+			const std::string local = r->get_str_unchecked();
+			buf.append(local.data(), local.size());
+		}
+	}
+
+	res->length = length;
+	res->bytes = bytes;
+	res->ascii = ascii;
+	res->find_offsets();
+
+	// concurrent readers may flatten it as well, the first copy wins
+	const string_data *expected = nullptr;
+	if(!flat.compare_exchange_strong(expected, res,
+			std::memory_order_acq_rel, std::memory_order_acquire)) {
+		delete res;
+		return *expected;
+	}
+
+	return *res;
+}
+
+boost::string_ref string_data::view() const
+{
+	const string_data &f = flatten();
+	return boost::string_ref(f.u.data(), f.u.size());
+}
+
+std::size_t string_data::byte_offset(std::size_t i) const
+{
+	assert(i < length);
+	const string_data &f = flatten();
+	if(&f != this)
+		return f.byte_offset(i);
+
+	if(ascii)
+		return i;
+
+	std::size_t pos = offsets[i / offsets_step];
+	for(std::size_t skip = i % offsets_step; skip; --skip)
+		do ++pos; while(0x80 == (static_cast<unsigned char>(u[pos]) & 0xc0));
+
+	return pos;
+}
+
+/// Called before the flat buffer is shared, readers never change offsets
+void string_data::find_offsets()
+{
+	offsets.clear();
+	if(ascii)
+		return;
+
+	offsets.reserve(length / offsets_step + 1);
+	for(std::size_t pos = 0, nr_chars = 0; pos < u.size(); ++pos) {
+		if(0x80 != (static_cast<unsigned char>(u[pos]) & 0xc0) && 0 == nr_chars++ % offsets_step)
+			offsets.push_back(pos);
+	}
+}
+
 std::string string_data::get_str() const
 {
-	conv_type converter;
-	return converter.to_bytes(u);
+	const string_data &f = flatten();
+	return std::string(f.u.data(), f.u.size());
 }
 
 void string_data::set(const char *utf8, std::size_t len)
 {
-	conv_type converter;
-	u.assign(converter.from_bytes(utf8, utf8 + len));
+	u.assign(utf8, len);
+	left.clear();
+	right.clear();
+	delete flat.exchange(nullptr);
+	length = count_chars(utf8, len, &ascii);
+	bytes = len;
+	find_offsets();
 }
 
 bool string_data::empty() const noexcept
 {
-	return u.empty();
+	return 0 == length;
 }
 
 std::size_t string_data::size() const noexcept
 {
-	return u.size();
+	return length;
 }
 
 type::rep string_data::at(std::size_t i)
 {
-	conv_type converter;
-	return converter.to_bytes(u.at(i));
+	if(i >= length)
+		throw std::out_of_range("string_data::at");
+
+	const string_data &f = flatten();
+	const std::size_t first = f.byte_offset(i);
+	std::size_t last = first + 1;
+	while(last < f.u.size() && 0x80 == (static_cast<unsigned char>(f.u[last]) & 0xc0))
+		++last;
+
+	return type::rep(f.u.data() + first, last - first);
+}
+
+namespace {
+
+/// Common typed layout of the elements, generic if there is none
+array_data::layout common_layout(const std::vector<type::rep> &vec) noexcept
+{
+	if(vec.empty())
+		return array_data::layout::generic;
+
+	const auto kind = array_data::layout_of(vec.front());
+	for(const auto &v : vec)
+		if(array_data::layout_of(v) != kind)
+			return array_data::layout::generic;
+	return kind;
+}
+
+bool local_number(const type::rep &r, double &value) noexcept
+{
+	if(r.is_local_num())
+		value = r.local_num();
+	else if(r.is_local_int())
+		value = double(r.local_int());
+	else
+		return false;
+	return true;
+}
+
+bool is_arith(op_kind op) noexcept
+{
+	return op_kind::add == op || op_kind::sub == op
+		|| op_kind::mul == op || op_kind::div == op;
+}
+
+// The loops below have no branches and no calls inside,
+// so they are vectorized with the -O3 of release builds
+
+  template <typename Tp, typename Op>
+void map_loop(Tp *__restrict p, std::size_t n, Tp x, Op op) noexcept
+{
+	for(std::size_t i = 0; i < n; ++i)
+		p[i] = op(p[i], x);
+}
+
+  template <typename Tp>
+void map_elements(Tp *p, std::size_t n, op_kind op, Tp x)
+{
+	switch(op) {
+		case op_kind::add: map_loop(p, n, x, std::plus<Tp>()); break;
+		case op_kind::sub: map_loop(p, n, x, std::minus<Tp>()); break;
+		case op_kind::mul: map_loop(p, n, x, std::multiplies<Tp>()); break;
+		case op_kind::div: map_loop(p, n, x, std::divides<Tp>()); break;
+		default: throw std::invalid_argument("arr: not an arithmetic operator");
+	}
+}
+
+  template <typename Tp, typename Up, typename Cmp>
+void compare_loop(const Tp *__restrict p, std::size_t n, Up x,
+				  std::uint8_t *__restrict out, Cmp cmp) noexcept
+{
+	for(std::size_t i = 0; i < n; ++i)
+		out[i] = cmp(Up(p[i]), x);
+}
+
+  template <typename Tp, typename Up>
+void compare_elements(const Tp *p, std::size_t n, op_kind op, Up x, std::uint8_t *out)
+{
+	switch(op) {
+		case op_kind::eq: compare_loop(p, n, x, out, std::equal_to<Up>()); break;
+		case op_kind::ne: compare_loop(p, n, x, out, std::not_equal_to<Up>()); break;
+		case op_kind::lt: compare_loop(p, n, x, out, std::less<Up>()); break;
+		case op_kind::gt: compare_loop(p, n, x, out, std::greater<Up>()); break;
+		case op_kind::lte: compare_loop(p, n, x, out, std::less_equal<Up>()); break;
+		case op_kind::gte: compare_loop(p, n, x, out, std::greater_equal<Up>()); break;
+		default: throw std::invalid_argument("arr: not a comparison operator");
+	}
 }
 
+double sum_nums(const double *p, std::size_t n) noexcept
+{
+	// independent partial sums vectorize without reassociation
+	double acc[4] = { };
+	std::size_t i = 0;
+	for(; i + 4 <= n; i += 4)
+		for(std::size_t k = 0; k < 4; ++k)
+			acc[k] += p[i + k];
+	for(; i < n; ++i)
+		acc[i % 4] += p[i];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void int_bounds(const std::int64_t *p, std::size_t n, std::int64_t &lo, std::int64_t &hi) noexcept
+{
+	lo = hi = n ? p[0] : 0;
+	for(std::size_t i = 0; i < n; ++i) {
+		lo = std::min(lo, p[i]);
+		hi = std::max(hi, p[i]);
+	}
+}
+
+/// Whether @a op with @a x may overflow on an integer from [lo, hi]
+bool may_overflow(op_kind op, std::int64_t lo, std::int64_t hi, std::int64_t x) noexcept
+{
+	std::int64_t v;
+	switch(op) {
+		case op_kind::add:
+			return __builtin_add_overflow(lo, x, &v) || __builtin_add_overflow(hi, x, &v);
+		case op_kind::sub:
+			return __builtin_sub_overflow(lo, x, &v) || __builtin_sub_overflow(hi, x, &v);
+		default:
+			return __builtin_mul_overflow(lo, x, &v) || __builtin_mul_overflow(hi, x, &v);
+	}
+}
+
+/// Arithmetic of a generic element, integers continue in doubles on overflow
+type::rep eval_arith(op_kind op, const type::rep &l, const type::rep &r)
+{
+	if(l.is_local_int() && r.is_local_int() && op_kind::div != op) {
+		std::int64_t v = l.local_int();
+		if(!may_overflow(op, v, v, r.local_int())) {
+			map_elements(&v, 1, op, r.local_int());
+			return type::rep(v);
+		}
+	}
+
+	double a, b;
+	if(!local_number(l, a) || !local_number(r, b))
+		throw std::invalid_argument("arr: arithmetic on a non-numeric value");
+
+	map_elements(&a, 1, op, b);
+	return type::rep(a);
+}
+
+/// Comparison of a generic element, booleans are only equal or not
+bool eval_compare(op_kind op, const type::rep &l, const type::rep &r)
+{
+	std::uint8_t res;
+
+	if(l.is_bool() && r.is_bool()) {
+		if(op_kind::eq != op && op_kind::ne != op)
+			throw std::invalid_argument("arr: booleans are not ordered");
+		const bool a = l.local_bool();
+		compare_elements(&a, 1, op, r.local_bool(), &res);
+
+	} else if(l.is_local_int() && r.is_local_int()) {
+		const std::int64_t a = l.local_int();
+		compare_elements(&a, 1, op, r.local_int(), &res);
+
+	} else {
+		double a, b;
+		if(!local_number(l, a) || !local_number(r, b))
+			throw std::invalid_argument("arr: comparison of a non-numeric value");
+		compare_elements(&a, 1, op, b, &res);
+	}
+
+	return res;
+}
+
+} // anonymous namespace
+
 array_data::array_data(const std::vector<type::rep> &vec)
-	: a(get_alloc())
+	: kind(common_layout(vec)), a(get_alloc()), nums(get_typed_alloc())
+	, ints(get_typed_alloc()), bools(get_typed_alloc())
 {
-	for(auto &v : vec) a.push_back(v);
+	if(layout::generic == kind)
+		for(auto &v : vec) a.push_back(v);
+	else
+		for(auto &v : vec) push_back(v);
 }
 
 array_data::array_data(std::vector<type::rep> &&vec)
-	: a(get_alloc())
+	: kind(common_layout(vec)), a(get_alloc()), nums(get_typed_alloc())
+	, ints(get_typed_alloc()), bools(get_typed_alloc())
 {
-	for(auto &v : vec) a.push_back(std::move(v));
+	if(layout::generic == kind)
+		for(auto &v : vec) a.push_back(std::move(v));
+	else
+		for(auto &v : vec) push_back(v);
 	vec.clear();
 }
 
+array_data::array_data(layout kind)
+	: kind(kind), a(get_alloc()), nums(get_typed_alloc())
+	, ints(get_typed_alloc()), bools(get_typed_alloc())
+{
+}
+
+array_data::array_data(const array_data &other)
+	: kind(other.kind), a(get_alloc()), nums(other.nums, get_typed_alloc())
+	, ints(other.ints, get_typed_alloc()), bools(other.bools, get_typed_alloc())
+{
+	a.assign(other.a.cbegin(), other.a.cend());
+}
+
+/*static*/
+array_data::layout array_data::layout_of(const type::rep &r) noexcept
+{
+	if(r.is_local_num())
+		return layout::nums;
+	if(r.is_local_int())
+		return layout::ints;
+	if(r.is_bool())
+		return layout::bools;
+	return layout::generic;
+}
+
 std::vector<type::rep> array_data::get_arr() const
 {
-	return std::vector<type::rep>(a.cbegin(), a.cend());
+	switch(kind) {
+		case layout::nums: return std::vector<type::rep>(nums.cbegin(), nums.cend());
+		case layout::ints: return std::vector<type::rep>(ints.cbegin(), ints.cend());
+		case layout::bools: {
+			std::vector<type::rep> res;
+			res.reserve(bools.size());
+			for(auto b : bools) res.emplace_back(0 != b);
+			return res;
+		}
+		default: return std::vector<type::rep>(a.cbegin(), a.cend());
+	}
 }
 
 bool array_data::empty() const noexcept
 {
-	return a.empty();
+	return !size();
 }
 
 std::size_t array_data::size() const noexcept
 {
-	return a.size();
+	switch(kind) {
+		case layout::nums: return nums.size();
+		case layout::ints: return ints.size();
+		case layout::bools: return bools.size();
+		default: return a.size();
+	}
+}
+
+std::size_t array_data::raw_size() const noexcept
+{
+	return sizeof(array_data) + a.size() * sizeof(type::rep) + nums.size() * sizeof(double)
+		+ ints.size() * sizeof(std::int64_t) + bools.size();
 }
 
 type::rep array_data::at(std::size_t i)
 {
-	return a.at(i);
+	switch(kind) {
+		case layout::nums: return nums.at(i);
+		case layout::ints: return ints.at(i);
+		case layout::bools: return 0 != bools.at(i);
+		default: return a.at(i);
+	}
+}
+
+void array_data::set(std::size_t i, const type::rep &value)
+{
+	if(i >= size())
+		throw std::out_of_range("array_data::set");
+
+	if(layout_of(value) != kind)
+		to_generic();
+
+	switch(kind) {
+		case layout::nums: nums[i] = value.local_num(); break;
+		case layout::ints: ints[i] = value.local_int(); break;
+		case layout::bools: bools[i] = value.local_bool(); break;
+		default: a[i] = value; break;
+	}
+}
+
+void array_data::push_back(const type::rep &value)
+{
+	if(empty())
+		kind = layout_of(value);
+	else if(layout_of(value) != kind)
+		to_generic();
+
+	switch(kind) {
+		case layout::nums: nums.push_back(value.local_num()); break;
+		case layout::ints: ints.push_back(value.local_int()); break;
+		case layout::bools: bools.push_back(value.local_bool()); break;
+		default: a.push_back(value); break;
+	}
+}
+
+void array_data::fill(const type::rep &value)
+{
+	const std::size_t n = size();
+	a.clear();
+	nums.clear();
+	ints.clear();
+	bools.clear();
+
+	switch(kind = layout_of(value)) {
+		case layout::nums: nums.assign(n, value.local_num()); break;
+		case layout::ints: ints.assign(n, value.local_int()); break;
+		case layout::bools: bools.assign(n, value.local_bool()); break;
+		default: a.assign(n, value); break;
+	}
+}
+
+type::rep array_data::sum() const
+{
+	switch(kind) {
+		case layout::nums:
+			return sum_nums(nums.data(), nums.size());
+
+		case layout::ints: {
+			std::int64_t lo, hi, v;
+			int_bounds(ints.data(), ints.size(), lo, hi);
+
+			const auto n = std::int64_t(ints.size());
+			if(__builtin_mul_overflow(lo, n, &v) || __builtin_mul_overflow(hi, n, &v)) {
+				double res = 0;
+				for(auto i : ints) res += double(i);
+				return res;
+			}
+
+			return std::accumulate(ints.cbegin(), ints.cend(), std::int64_t(0));
+		}
+
+		case layout::bools:
+			return std::accumulate(bools.cbegin(), bools.cend(), std::int64_t(0));
+
+		default: {
+			type::rep res(std::int64_t(0));
+			for(const auto &v : a)
+				res = eval_arith(op_kind::add, res, v);
+			return res;
+		}
+	}
+}
+
+void array_data::map(op_kind op, const type::rep &operand)
+{
+	if(!is_arith(op))
+		throw std::invalid_argument("arr: not an arithmetic operator");
+
+	double x;
+	if(layout::generic != kind && !local_number(operand, x))
+		throw std::invalid_argument("arr: arithmetic on a non-numeric value");
+
+	switch(kind) {
+		case layout::ints:
+			if(operand.is_local_int() && op_kind::div != op) {
+				std::int64_t lo, hi;
+				int_bounds(ints.data(), ints.size(), lo, hi);
+				if(!may_overflow(op, lo, hi, operand.local_int())) {
+					map_elements(ints.data(), ints.size(), op, operand.local_int());
+					break;
+				}
+			}
+			to_nums();
+			// fall through
+
+		case layout::nums:
+			map_elements(nums.data(), nums.size(), op, x);
+			break;
+
+		case layout::bools:
+			throw std::invalid_argument("arr: arithmetic on a boolean");
+
+		default:
+			for(auto &v : a)
+				v = eval_arith(op, v, operand);
+			break;
+	}
+}
+
+type::rep array_data::compare(op_kind op, const type::rep &operand) const
+{
+	memory::counted_ptr ptr(memory::make_counted<array_data>(layout::bools), false);
+	auto *const res = ptr->get<array_data>();
+	res->bools.resize(size());
+	std::uint8_t *const out = res->bools.data();
+
+	double x;
+	switch(kind) {
+		case layout::nums:
+			if(!local_number(operand, x))
+				throw std::invalid_argument("arr: comparison of a non-numeric value");
+			compare_elements(nums.data(), nums.size(), op, x, out);
+			break;
+
+		case layout::ints:
+			if(operand.is_local_int())
+				compare_elements(ints.data(), ints.size(), op, operand.local_int(), out);
+			else if(local_number(operand, x))
+				compare_elements(ints.data(), ints.size(), op, x, out);
+			else
+				throw std::invalid_argument("arr: comparison of a non-numeric value");
+			break;
+
+		case layout::bools:
+			if(!operand.is_bool() || (op_kind::eq != op && op_kind::ne != op))
+				throw std::invalid_argument("arr: booleans are only equal or not");
+			compare_elements(bools.data(), bools.size(), op,
+				std::uint8_t(operand.local_bool()), out);
+			break;
+
+		default:
+			for(std::size_t i = 0; i < a.size(); ++i)
+				out[i] = eval_compare(op, a[i], operand);
+			break;
+	}
+
+	type::rep r;
+	r.set_arr(std::move(ptr));
+	return r;
+}
+
+void array_data::to_generic()
+{
+	if(layout::generic == kind)
+		return;
+
+	a.clear();
+	a.reserve(size());
+	for(std::size_t i = 0, n = size(); i < n; ++i)
+		a.push_back(at(i));
+
+	kind = layout::generic;
+	typed_vector<double>(get_typed_alloc()).swap(nums);
+	typed_vector<std::int64_t>(get_typed_alloc()).swap(ints);
+	typed_vector<std::uint8_t>(get_typed_alloc()).swap(bools);
+}
+
+void array_data::to_nums()
+{
+	assert(layout::ints == kind);
+	nums.assign(ints.cbegin(), ints.cend());
+	kind = layout::nums;
+	typed_vector<std::int64_t>(get_typed_alloc()).swap(ints);
+}
+
+instance_data::instance_data(const memory_ptr<context_info> &whois, std::size_t nr_fields)
+	: info { inst::get() }, whois(whois), fields(get_alloc())
+{
+	fields.resize(nr_fields);
 }
 
 } // inline namespace type_system
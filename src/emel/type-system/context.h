@@ -24,6 +24,9 @@
 
 #include <boost/container/small_vector.hpp>
 #include <boost/flyweight.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <atomic>
+#include <cassert>
 //#include <sparsehash/dense_hash_map>
 #include <unordered_map>
 
@@ -139,20 +142,76 @@ struct object_info
 	bool is_const = false;
 };
 
-using char_type = char16_t;
+/// Ints and nums out of the unboxed ranges, they have the ptr tag
+template <typename Tp>
+struct boxed_value
+{
+	object_info info; // must be the first, see type::rep::get_type()
+	Tp value;
+};
 
+using char_type = char;
+
+/// Storage of non-local str in UTF-8. It is either a flat buffer or
+/// a pending concatenation of two str reps, which is flattened into
+/// a separate flat string_data on the first indexed access or conversion
+/// to std::string, so concatenation in a loop takes linear time. Shared
+/// strings are read by many threads: the operands are never changed after
+/// construction and the flat copy is published once. Sizes and indices count
+/// code points: ASCII strings are indexed directly, others through byte
+/// offsets of every offsets_step-th character, found when the flat buffer
+/// is built.
 struct string_data
 {
 	using string_type = std::basic_string<char_type,
 		std::char_traits<char_type>, rt_allocator<char_type>>;
 
+	/// Shorter results of concatenation are built flat
+	static constexpr std::size_t min_concat_length = 32;
+	/// Longer literals are not interned
+	static constexpr std::size_t max_interned_length = 64;
+	/// Characters between the cached byte offsets
+	static constexpr std::size_t offsets_step = 16;
+
 	string_type u;
+	type::rep left, right; ///< Operands of the pending concatenation
+	std::vector<std::size_t, rt_allocator<std::size_t>> offsets;
+	/// Flattened concatenation, built by the first reader
+	mutable std::atomic<const string_data *> flat { nullptr };
+	std::size_t length = 0, bytes = 0;
+	bool ascii = true;
 
 	static inline auto get_alloc() {
 		return rt_allocator<char_type>(memory::get_source());
 	}
 
 	explicit string_data(const char *str, std::size_t len);
+	string_data(const type::rep &lhs, const type::rep &rhs);
+	string_data(const string_data &other);
+	~string_data();
+
+	/// Concatenate str reps without copying their characters
+	static type::rep concat(const type::rep &lhs, const type::rep &rhs);
+
+	/// Rep of the literal, which shares its storage with all equal
+	/// literals interned before. Interned strings are never released.
+	static type::rep intern(const char *str, std::size_t len);
+
+	/// Number of code points in @a len bytes of UTF-8
+	static std::size_t count_chars(const char *utf8, std::size_t len, bool *ascii = nullptr);
+
+	bool is_concat() const noexcept { return !left.is_none(); }
+	bool is_flattened() const noexcept {
+		return !is_concat() || flat.load(std::memory_order_acquire);
+	}
+
+	/// Flat string of the same characters, this one if not a concatenation
+	const string_data &flatten() const;
+
+	/// Bytes of the flattened string, valid while the storage is alive
+	boost::string_ref view() const;
+	std::size_t byte_offset(std::size_t i) const;
+	void find_offsets();
 
 	std::string get_str() const;
 	void set(const char *utf8, std::size_t len);
@@ -161,22 +220,103 @@ struct string_data
 	type::rep at(std::size_t i);
 };
 
+/// Bytes of the str rep @a r, not copied for both local and
+/// non-local str. Valid while @a r is alive and not changed.
+inline boost::string_ref str_view(const type::rep &r)
+{
+	if(r.is_counted_str())
+		return r.get_counted_unchecked()->get<string_data>()->view();
+
+	assert(r.is_local_str());
+	return boost::string_ref(r.local_str_data(), r.local_str_size());
+}
+
+/// Elements of arr. Arrays of only unboxed numbers, integers or booleans,
+/// as found on construction, keep them unboxed and contiguous in the typed
+/// storage, which the bulk operations process in vectorizable loops.
+/// Storing an element of another type converts the array to generic reps.
+/// Copies of arr reps share the storage, it's cloned by detach_arr
+/// before the first mutation of a shared array.
 struct array_data
 {
-	small_vector<type::rep, 16, rt_allocator<type::rep>> a;
+	enum class layout : std::uint8_t { generic, nums, ints, bools };
+
+  template <typename Tp>
+	using typed_vector = std::vector<Tp, rt_allocator<Tp>>;
+
+	layout kind = layout::generic;
+	small_vector<type::rep, 16, rt_allocator<type::rep>> a; ///< Generic elements
+	typed_vector<double> nums;
+	typed_vector<std::int64_t> ints;
+	typed_vector<std::uint8_t> bools; ///< 0 or 1
 
 	static inline auto get_alloc() {
 		return small_vector_allocator<rt_allocator<type::rep>>(
 			memory::get_source(memory::uncollectable_gc_pool));
 	}
 
+	/// Typed storage holds no references, it needs no scanning
+	static inline auto get_typed_alloc() {
+		return rt_allocator<std::uint8_t>(memory::get_source());
+	}
+
 	explicit array_data(const std::vector<type::rep> &vec);
 	explicit array_data(std::vector<type::rep> &&vec);
+	/// Empty array of @a kind
+	explicit array_data(layout kind);
+	array_data(const array_data &other);
+
+	/// Typed layout, which can hold @a r
+	static layout layout_of(const type::rep &r) noexcept;
 
 	std::vector<type::rep> get_arr() const;
 	bool empty() const noexcept;
 	std::size_t size() const noexcept;
+	std::size_t raw_size() const noexcept;
 	type::rep at(std::size_t i);
+
+	void set(std::size_t i, const type::rep &value);
+	void push_back(const type::rep &value);
+	/// Replace all of the elements by @a value, the array gets its layout
+	void fill(const type::rep &value);
+
+	/// Sum of numbers, int if all of them are int and it doesn't overflow
+	type::rep sum() const;
+	/// Apply the arithmetic operator with @a operand to each element.
+	/// Integers continue in doubles on division or a possible overflow.
+	void map(op_kind op, const type::rep &operand);
+	/// Bool arr of the results of comparison of each element with @a operand
+	type::rep compare(op_kind op, const type::rep &operand) const;
+
+private:
+	void to_generic();
+	void to_nums();
+};
+
+/// Array of the arr rep @a r ready for mutation. If the storage
+/// is shared with other reps, @a r gets its own copy first.
+inline array_data *detach_arr(type::rep &r)
+{
+	assert(r.is_arr());
+	if(!r.get_counted_unchecked()->unique())
+		r.set_arr(memory::counted_ptr(r.get_counted_unchecked()->clone(), false));
+	return r.get_counted_unchecked()->get<array_data>();
+}
+
+/// Instance of a user class. Fields are addressed by the offsets
+/// from the fields tables of the class context.
+struct instance_data
+{
+	object_info info; // must be the first, see type::rep::get_type()
+	memory_ptr<context_info> whois;
+	small_vector<type::rep, 8, rt_allocator<type::rep>> fields;
+
+	static inline auto get_alloc() {
+		return small_vector_allocator<rt_allocator<type::rep>>(
+			memory::get_source(memory::uncollectable_gc_pool));
+	}
+
+	instance_data(const memory_ptr<context_info> &whois, std::size_t nr_fields);
 };
 
 } // inline namespace type_system
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "map-data.h"
+#include "str-kernels.h"
+#include "type-builtins.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+namespace emel { inline namespace type_system {
+
+namespace {
+
+/// Finalizer of MurmurHash3
+std::uint64_t mix(std::uint64_t x) noexcept
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+bool is_int(const type::rep &r) noexcept
+{
+	return r.is_local_int() || (r.is_ptr() && type::int_ == r.get_kind());
+}
+
+bool is_number(const type::rep &r) noexcept
+{
+	return r.is_local_num() || r.is_local_int()
+		|| (r.is_ptr() && (type::num == r.get_kind() || type::int_ == r.get_kind()));
+}
+
+/// Numbers out of the unboxed ranges are boxed
+double number_of(const type::rep &r)
+{
+	if(r.is_local_num())
+		return r.local_num();
+	return r.is_local_int() ? double(r.local_int()) : r.ops().get_num(r);
+}
+
+bool is_string(const type::rep &r) noexcept
+{
+	return r.is_counted_str() || r.is_local_str();
+}
+
+/// Mask of the slots of the group, whose control bytes are @a value
+unsigned match(const std::int8_t *group, std::int8_t value) noexcept
+{
+#ifdef __SSE2__
+	const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+	return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value))));
+#else
+	unsigned mask = 0;
+	for(std::size_t idx = 0; idx < map_data::group_size; ++idx)
+		mask |= unsigned(group[idx] == value) << idx;
+	return mask;
+#endif
+}
+
+/// Mask of the empty and deleted slots, only they have the sign bit
+unsigned match_free(const std::int8_t *group) noexcept
+{
+#ifdef __SSE2__
+	return unsigned(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group))));
+#else
+	unsigned mask = 0;
+	for(std::size_t idx = 0; idx < map_data::group_size; ++idx)
+		mask |= unsigned(group[idx] < 0) << idx;
+	return mask;
+#endif
+}
+
+/// Groups for @a count items at the load factor of at most 7/8
+std::size_t groups_for(std::size_t count) noexcept
+{
+	std::size_t nr_groups = 1;
+	while(nr_groups * map_data::group_size * 7 / 8 < count)
+		nr_groups *= 2;
+	return nr_groups;
+}
+
+} // anonymous namespace
+
+constexpr std::size_t map_data::group_size;
+constexpr std::int8_t map_data::ctrl_empty;
+constexpr std::int8_t map_data::ctrl_deleted;
+constexpr std::size_t map_data::npos;
+
+map_data::map_data()
+	: info { map::get() }, ctrl(get_ctrl_alloc()), slots(get_alloc())
+{
+}
+
+map_data::map_data(const map_data &other)
+	: info(other.info), ctrl(other.ctrl, get_ctrl_alloc()), slots(other.slots, get_alloc())
+	, nr_items(other.nr_items), nr_deleted(other.nr_deleted)
+{
+}
+
+/*static*/
+std::uint64_t map_data::hash(const type::rep &key)
+{
+	if(is_number(key)) {
+		double num = number_of(key);
+		if(0 == num)
+			num = 0; // -0 is the same key
+		std::uint64_t bits;
+		std::memcpy(&bits, &num, sizeof bits);
+		return mix(bits);
+	}
+
+	if(is_string(key))
+		return mix(str_hash(str_view(key)) | (std::uint64_t(1) << 32));
+	if(key.is_bool())
+		return mix(key.local_bool() ? 3 : 2);
+	if(key.is_none())
+		return mix(1);
+
+	return mix(std::uint64_t(key.get_counted_unchecked()));
+}
+
+/*static*/
+bool map_data::equal(const type::rep &lhs, const type::rep &rhs)
+{
+	if(is_number(lhs) || is_number(rhs)) {
+		if(!is_number(lhs) || !is_number(rhs))
+			return false;
+		if(is_int(lhs) && is_int(rhs))
+			return lhs.ops().get_int(lhs) == rhs.ops().get_int(rhs);
+		return number_of(lhs) == number_of(rhs);
+	}
+
+	if(is_string(lhs) || is_string(rhs))
+		return is_string(lhs) && is_string(rhs) && str_equal(str_view(lhs), str_view(rhs));
+	if(lhs.is_bool() || rhs.is_bool())
+		return lhs.is_bool() && rhs.is_bool() && lhs.local_bool() == rhs.local_bool();
+	if(lhs.is_none() || rhs.is_none())
+		return lhs.is_none() && rhs.is_none();
+
+	return lhs.is_arr() == rhs.is_arr()
+		&& lhs.get_counted_unchecked() == rhs.get_counted_unchecked();
+}
+
+std::size_t map_data::raw_size() const noexcept
+{
+	return sizeof(map_data) + ctrl.size() + slots.size() * sizeof(slot);
+}
+
+const type::rep *map_data::find(const type::rep &key) const
+{
+	const std::size_t idx = find_index(key, hash(key));
+	return npos != idx ? &slots[idx].value : nullptr;
+}
+
+void map_data::set(const type::rep &key, const type::rep &value)
+{
+	if(key.is_local_num() && std::isnan(key.local_num()))
+		throw std::invalid_argument("map: NaN can't be a key");
+
+	const std::uint64_t h = hash(key);
+	std::size_t idx = find_index(key, h);
+	if(npos != idx) {
+		slots[idx].value = value;
+		return;
+	}
+
+	if(nr_items + nr_deleted + 1 > capacity() * 7 / 8) {
+		// deleted slots are reused in place, if they take the room
+		std::size_t nr_groups = groups_for(nr_items + 1);
+		if(nr_deleted < capacity() / 8)
+			nr_groups = std::max(nr_groups, 2 * capacity() / group_size);
+		rehash(nr_groups);
+	}
+
+	idx = find_free(h);
+	if(ctrl_deleted == ctrl[idx])
+		--nr_deleted;
+
+	ctrl[idx] = std::int8_t(h & 0x7f);
+	slots[idx].key = key;
+	slots[idx].value = value;
+	++nr_items;
+}
+
+bool map_data::erase(const type::rep &key)
+{
+	const std::size_t idx = find_index(key, hash(key));
+	if(npos == idx)
+		return false;
+
+	// probes don't pass a group with an empty slot
+	const std::int8_t *const group = ctrl.data() + idx / group_size * group_size;
+	if(match(group, ctrl_empty))
+		ctrl[idx] = ctrl_empty;
+	else {
+		ctrl[idx] = ctrl_deleted;
+		++nr_deleted;
+	}
+
+	slots[idx].key.clear();
+	slots[idx].value.clear();
+	--nr_items;
+	return true;
+}
+
+void map_data::reserve(std::size_t count)
+{
+	const std::size_t nr_groups = groups_for(count);
+	if(nr_groups * group_size > capacity())
+		rehash(nr_groups);
+}
+
+std::size_t map_data::find_index(const type::rep &key, std::uint64_t h) const
+{
+	if(slots.empty())
+		return npos;
+
+	const std::size_t mask = ctrl.size() / group_size - 1;
+	const auto h2 = std::int8_t(h & 0x7f);
+	std::size_t group = (h >> 7) & mask;
+
+	// triangular steps visit all of the groups, if their number is a power of 2
+	for(std::size_t step = 1; ; ++step) {
+		const std::int8_t *const g = ctrl.data() + group * group_size;
+
+		for(unsigned m = match(g, h2); m; m &= m - 1) {
+			const std::size_t idx = group * group_size + std::size_t(__builtin_ctz(m));
+			if(equal(slots[idx].key, key))
+				return idx;
+		}
+
+		if(match(g, ctrl_empty))
+			return npos;
+
+		group = (group + step) & mask;
+	}
+}
+
+std::size_t map_data::find_free(std::uint64_t h) const noexcept
+{
+	const std::size_t mask = ctrl.size() / group_size - 1;
+	std::size_t group = (h >> 7) & mask;
+
+	for(std::size_t step = 1; ; ++step) {
+		const unsigned m = match_free(ctrl.data() + group * group_size);
+		if(m)
+			return group * group_size + std::size_t(__builtin_ctz(m));
+
+		group = (group + step) & mask;
+	}
+}
+
+void map_data::rehash(std::size_t nr_groups)
+{
+	decltype(ctrl) old_ctrl(get_ctrl_alloc());
+	decltype(slots) old_slots(get_alloc());
+	old_ctrl.swap(ctrl);
+	old_slots.swap(slots);
+
+	ctrl.assign(nr_groups * group_size, ctrl_empty);
+	slots.resize(nr_groups * group_size);
+	nr_deleted = 0;
+
+	for(std::size_t idx = 0; idx < old_slots.size(); ++idx) {
+		if(old_ctrl[idx] < 0)
+			continue;
+
+		const std::size_t free = find_free(hash(old_slots[idx].key));
+		ctrl[free] = old_ctrl[idx];
+		slots[free] = std::move(old_slots[idx]);
+	}
+}
+
+type::rep make_map()
+{
+	type::rep r;
+	r.set(memory::counted_ptr(memory::make_counted<map_data>(), false));
+	return r;
+}
+
+map_data *get_map(const type::rep &r) noexcept
+{
+	if(!r.is_ptr())
+		return nullptr;
+
+	const auto *const info = r.get_counted_unchecked()->get<object_info>();
+	return (info && map::get() == info->t)
+		? r.get_counted_unchecked()->get<map_data>() : nullptr;
+}
+
+} // inline namespace type_system
+
+} // namespace emel
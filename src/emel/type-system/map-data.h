@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "context.h"
+
+namespace emel { inline namespace type_system {
+
+/// Storage of map: an open addressing table in the layout of SwissTable.
+/// Slots are split into groups of group_size, each slot has a control
+/// byte: empty, deleted, or the low 7 bits of the hash of its key.
+/// Lookup compares these bits to the control bytes of a whole group
+/// at once and then only the keys of the matching slots. Groups are
+/// probed quadratically until one with an empty slot.
+///
+/// Numbers are equal keys if their values are, strings by their bytes,
+/// other values by identity. map reps have the ptr tag, the type
+/// is found by the info at the beginning, as for instances.
+struct map_data
+{
+	static constexpr std::size_t group_size = 16;
+	static constexpr std::int8_t ctrl_empty = -128;
+	static constexpr std::int8_t ctrl_deleted = -2;
+	static constexpr std::size_t npos = std::size_t(-1);
+
+	struct slot {
+		type::rep key, value;
+	};
+
+	object_info info; // must be the first, see type::rep::get_type()
+	std::vector<std::int8_t, rt_allocator<std::int8_t>> ctrl;
+	std::vector<slot, rt_allocator<slot>> slots;
+	std::size_t nr_items = 0, nr_deleted = 0;
+
+	static inline auto get_alloc() {
+		return rt_allocator<slot>(memory::get_source(memory::uncollectable_gc_pool));
+	}
+
+	/// Control bytes hold no references, they need no scanning
+	static inline auto get_ctrl_alloc() {
+		return rt_allocator<std::int8_t>(memory::get_source());
+	}
+
+	map_data();
+	map_data(const map_data &other);
+
+	static std::uint64_t hash(const type::rep &key);
+	static bool equal(const type::rep &lhs, const type::rep &rhs);
+
+	bool empty() const noexcept { return !nr_items; }
+	std::size_t size() const noexcept { return nr_items; }
+	std::size_t capacity() const noexcept { return slots.size(); }
+	std::size_t raw_size() const noexcept;
+
+	/// Value at @a key, null if there is none
+	const type::rep *find(const type::rep &key) const;
+	/// Insert or assign the value at @a key. NaN can't be a key.
+	void set(const type::rep &key, const type::rep &value);
+	bool erase(const type::rep &key);
+	/// Make room for @a count items without rehashing
+	void reserve(std::size_t count);
+
+	/// Call @a fn with the key and the value of each item
+  template <typename Fn>
+	void for_each(Fn fn) const
+	{
+		for(std::size_t idx = 0; idx < slots.size(); ++idx)
+			if(ctrl[idx] >= 0)
+				fn(slots[idx].key, slots[idx].value);
+	}
+
+private:
+	std::size_t find_index(const type::rep &key, std::uint64_t h) const;
+	std::size_t find_free(std::uint64_t h) const noexcept;
+	void rehash(std::size_t nr_groups);
+};
+
+/// Rep of a new empty map
+type::rep make_map();
+
+/// Map of the map rep @a r ready for mutation, see detach_arr
+inline map_data *detach_map(type::rep &r)
+{
+	assert(r.is_ptr());
+	if(!r.get_counted_unchecked()->unique())
+		r.set(memory::counted_ptr(r.get_counted_unchecked()->clone(), false));
+	return r.get_counted_unchecked()->get<map_data>();
+}
+
+/// Map of @a r, null if it's not a map
+map_data *get_map(const type::rep &r) noexcept;
+
+} // inline namespace type_system
+
+} // namespace emel
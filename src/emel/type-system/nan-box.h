@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "../memory/memory.h"
+
+namespace emel { inline namespace type_system {
+
+/// Alternative encoding of values by NaN-boxing. Every double is stored
+/// as is, NaNs are canonicalized to the positive quiet NaN, so the negative
+/// quiet NaNs are free: they hold the other values with a tag in bits 48-50
+/// and the value in the low 48 bits, enough for the pointers of x86-64 and
+/// AArch64 and for 48-bit ints. Pointers need no alignment for the tags.
+///
+/// Only the encoding is here, owning the counted objects is up to the
+/// holder of the box.
+class nan_box
+{
+	std::uint64_t bits;
+
+	static constexpr std::uint64_t boxed_prefix = 0xfff8000000000000ULL;
+	static constexpr std::uint64_t canonical_nan = 0x7ff8000000000000ULL;
+	static constexpr std::uint64_t payload_mask = 0x0000ffffffffffffULL;
+
+	enum tag : std::uint64_t { none_tag, bool_tag, int_tag, ptr_tag };
+
+	static constexpr std::uint64_t boxed(tag t, std::uint64_t payload) noexcept {
+		return boxed_prefix | (std::uint64_t(t) << 48) | (payload & payload_mask);
+	}
+
+	constexpr bool has_tag(tag t) const noexcept {
+		return (bits & ~payload_mask) == boxed(t, 0);
+	}
+
+public:
+	static constexpr std::int64_t min_int = -(std::int64_t(1) << 47);
+	static constexpr std::int64_t max_int = (std::int64_t(1) << 47) - 1;
+
+	static constexpr bool fits(std::int64_t value) noexcept {
+		return min_int <= value && value <= max_int;
+	}
+
+	constexpr nan_box() noexcept : bits(boxed(none_tag, 0)) { }
+	constexpr explicit nan_box(bool value) noexcept : bits(boxed(bool_tag, value)) { }
+
+	explicit nan_box(double value) noexcept
+	{
+		if(__builtin_expect(std::isnan(value), false))
+			bits = canonical_nan;
+		else
+			std::memcpy(&bits, &value, sizeof bits);
+	}
+
+	/// Ints out of 48 bits are for the holder to store as nums or to box
+	explicit nan_box(std::int64_t value) noexcept : bits(boxed(int_tag, std::uint64_t(value)))
+	{
+		assert(fits(value));
+	}
+
+	explicit nan_box(memory::atomic_counted *ptr) noexcept
+		: bits(boxed(ptr_tag, reinterpret_cast<std::uintptr_t>(ptr)))
+	{
+		assert(0 == (reinterpret_cast<std::uintptr_t>(ptr) & ~payload_mask));
+	}
+
+	constexpr bool is_num() const noexcept { return (bits & boxed_prefix) != boxed_prefix; }
+	constexpr bool is_none() const noexcept { return has_tag(none_tag); }
+	constexpr bool is_bool() const noexcept { return has_tag(bool_tag); }
+	constexpr bool is_int() const noexcept { return has_tag(int_tag); }
+	constexpr bool is_ptr() const noexcept { return has_tag(ptr_tag); }
+
+	double as_num() const noexcept
+	{
+		assert(is_num());
+		double value;
+		std::memcpy(&value, &bits, sizeof value);
+		return value;
+	}
+
+	constexpr bool as_bool() const noexcept { return 0 != (bits & 1); }
+
+	/// Sign-extended from 48 bits
+	constexpr std::int64_t as_int() const noexcept {
+		return std::int64_t(bits << 16) >> 16;
+	}
+
+	memory::atomic_counted *as_ptr() const noexcept
+	{
+		assert(is_ptr());
+		return reinterpret_cast<memory::atomic_counted *>(bits & payload_mask);
+	}
+
+	constexpr std::uint64_t raw() const noexcept { return bits; }
+};
+
+} // inline namespace type_system
+
+} // namespace emel
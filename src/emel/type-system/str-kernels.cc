@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "str-kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# define EMEL_STR_KERNELS_X86 1
+# include <immintrin.h>
+#endif
+
+namespace emel { inline namespace type_system {
+
+namespace {
+
+/// Reflected polynomial of CRC32C, the one of the crc32 instruction
+constexpr std::uint32_t crc32c_poly = 0x82f63b78;
+
+std::array<std::uint32_t, 256> make_crc32c_table() noexcept
+{
+	std::array<std::uint32_t, 256> table;
+	for(std::uint32_t idx = 0; idx < 256; ++idx) {
+		std::uint32_t crc = idx;
+		for(int bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ (crc & 1 ? crc32c_poly : 0);
+		table[idx] = crc;
+	}
+	return table;
+}
+
+std::size_t mismatch_tail(const char *lhs, const char *rhs, std::size_t pos, std::size_t len) noexcept
+{
+	while(pos < len && lhs[pos] == rhs[pos])
+		++pos;
+	return pos;
+}
+
+std::size_t scalar_mismatch(const char *lhs, const char *rhs, std::size_t len) noexcept
+{
+	std::size_t pos = 0;
+	for(; pos + sizeof(std::uint64_t) <= len; pos += sizeof(std::uint64_t)) {
+		std::uint64_t a, b;
+		std::memcpy(&a, lhs + pos, sizeof a);
+		std::memcpy(&b, rhs + pos, sizeof b);
+		if(a != b)
+			return pos + std::size_t(__builtin_ctzll(a ^ b)) / 8;
+	}
+
+	return mismatch_tail(lhs, rhs, pos, len);
+}
+
+std::uint32_t scalar_hash(const char *data, std::size_t len) noexcept
+{
+	static const auto table = make_crc32c_table();
+
+	std::uint32_t crc = ~std::uint32_t(0);
+	for(std::size_t pos = 0; pos < len; ++pos)
+		crc = (crc >> 8) ^ table[(crc ^ static_cast<unsigned char>(data[pos])) & 0xff];
+	return ~crc;
+}
+
+std::size_t find_tail(const char *hay, std::size_t pos, std::size_t hay_len,
+					  const char *needle, std::size_t needle_len) noexcept
+{
+	const char *const last = hay + hay_len - needle_len + 1;
+	for(const char *it = hay + pos; it < last; ++it) {
+		it = static_cast<const char *>(std::memchr(it, needle[0], std::size_t(last - it)));
+		if(!it)
+			break;
+		if(0 == std::memcmp(it + 1, needle + 1, needle_len - 1))
+			return std::size_t(it - hay);
+	}
+
+	return str_kernels::npos;
+}
+
+std::size_t scalar_find(const char *hay, std::size_t hay_len,
+						const char *needle, std::size_t needle_len) noexcept
+{
+	if(!needle_len)
+		return 0;
+	if(needle_len > hay_len)
+		return str_kernels::npos;
+	return find_tail(hay, 0, hay_len, needle, needle_len);
+}
+
+#ifdef EMEL_STR_KERNELS_X86
+
+__attribute__((target("sse4.2")))
+std::size_t sse42_mismatch(const char *lhs, const char *rhs, std::size_t len) noexcept
+{
+	std::size_t pos = 0;
+	for(; pos + 16 <= len; pos += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + pos));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + pos));
+		const unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) ^ 0xffffu;
+		if(mask)
+			return pos + std::size_t(__builtin_ctz(mask));
+	}
+
+	return mismatch_tail(lhs, rhs, pos, len);
+}
+
+__attribute__((target("sse4.2")))
+std::uint32_t sse42_hash(const char *data, std::size_t len) noexcept
+{
+	std::uint64_t crc = ~std::uint32_t(0);
+	std::size_t pos = 0;
+
+	for(; pos + sizeof(std::uint64_t) <= len; pos += sizeof(std::uint64_t)) {
+		std::uint64_t word;
+		std::memcpy(&word, data + pos, sizeof word);
+		crc = _mm_crc32_u64(crc, word);
+	}
+
+	std::uint32_t crc32 = std::uint32_t(crc);
+	for(; pos < len; ++pos)
+		crc32 = _mm_crc32_u8(crc32, static_cast<unsigned char>(data[pos]));
+	return ~crc32;
+}
+
+/// Candidates are the positions, where both the first and the last
+/// bytes of the needle match, only they are compared entirely
+__attribute__((target("sse4.2")))
+std::size_t sse42_find(const char *hay, std::size_t hay_len,
+					   const char *needle, std::size_t needle_len) noexcept
+{
+	if(!needle_len)
+		return 0;
+	if(needle_len > hay_len)
+		return str_kernels::npos;
+
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+	std::size_t pos = 0;
+
+	for(; pos + needle_len - 1 + 16 <= hay_len; pos += 16) {
+		const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hay + pos));
+		const __m128i block_last = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(hay + pos + needle_len - 1));
+
+		unsigned mask = unsigned(_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+
+		for(; mask; mask &= mask - 1) {
+			const std::size_t at = pos + std::size_t(__builtin_ctz(mask));
+			if(needle_len < 3 || 0 == std::memcmp(hay + at + 1, needle + 1, needle_len - 2))
+				return at;
+		}
+	}
+
+	return find_tail(hay, pos, hay_len, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+std::size_t avx2_mismatch(const char *lhs, const char *rhs, std::size_t len) noexcept
+{
+	std::size_t pos = 0;
+	for(; pos + 32 <= len; pos += 32) {
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + pos));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + pos));
+		const unsigned mask = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+		if(mask)
+			return pos + std::size_t(__builtin_ctz(mask));
+	}
+
+	return mismatch_tail(lhs, rhs, pos, len);
+}
+
+__attribute__((target("avx2")))
+std::size_t avx2_find(const char *hay, std::size_t hay_len,
+					  const char *needle, std::size_t needle_len) noexcept
+{
+	if(!needle_len)
+		return 0;
+	if(needle_len > hay_len)
+		return str_kernels::npos;
+
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+	std::size_t pos = 0;
+
+	for(; pos + needle_len - 1 + 32 <= hay_len; pos += 32) {
+		const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay + pos));
+		const __m256i block_last = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(hay + pos + needle_len - 1));
+
+		unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+
+		for(; mask; mask &= mask - 1) {
+			const std::size_t at = pos + std::size_t(__builtin_ctz(mask));
+			if(needle_len < 3 || 0 == std::memcmp(hay + at + 1, needle + 1, needle_len - 2))
+				return at;
+		}
+	}
+
+	return find_tail(hay, pos, hay_len, needle, needle_len);
+}
+
+#endif // EMEL_STR_KERNELS_X86
+
+const str_kernels scalar_kernels { scalar_mismatch, scalar_hash, scalar_find, "scalar" };
+
+#ifdef EMEL_STR_KERNELS_X86
+const str_kernels sse42_kernels { sse42_mismatch, sse42_hash, sse42_find, "sse4.2" };
+// crc32 has no wider form, the hash is shared with sse4.2
+const str_kernels avx2_kernels { avx2_mismatch, sse42_hash, avx2_find, "avx2" };
+#endif
+
+const str_kernels &select_kernels() noexcept
+{
+#ifdef EMEL_STR_KERNELS_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+		return avx2_kernels;
+	if(__builtin_cpu_supports("sse4.2"))
+		return sse42_kernels;
+#endif
+	return scalar_kernels;
+}
+
+} // anonymous namespace
+
+/*static*/
+const str_kernels &str_kernels::get() noexcept
+{
+	static const str_kernels &kernels = select_kernels();
+	return kernels;
+}
+
+/*static*/
+const str_kernels &str_kernels::scalar() noexcept
+{
+	return scalar_kernels;
+}
+
+int str_compare(boost::string_ref lhs, boost::string_ref rhs) noexcept
+{
+	const std::size_t len = std::min(lhs.size(), rhs.size());
+	const std::size_t pos = str_kernels::get().mismatch(lhs.data(), rhs.data(), len);
+
+	if(pos < len)
+		return static_cast<unsigned char>(lhs[pos]) < static_cast<unsigned char>(rhs[pos]) ? -1 : 1;
+	return lhs.size() < rhs.size() ? -1 : (lhs.size() > rhs.size() ? 1 : 0);
+}
+
+} // inline namespace type_system
+
+} // namespace emel
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 Max Plutonium <plutonium.max@gmail.com>
+ *
+ * This file is part of the EMEL library.
+ *
+ * The EMEL library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * The EMEL library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the EMEL library. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <boost/utility/string_ref.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace emel { inline namespace type_system {
+
+/// Byte kernels of str comparison, hashing and search, selected once
+/// by the features of the CPU. All implementations give the same
+/// results, so hashes may be stored and compared across them.
+struct str_kernels
+{
+	static constexpr std::size_t npos = std::size_t(-1);
+
+	/// Index of the first differing byte, @a len if there is none
+	std::size_t (*mismatch)(const char *lhs, const char *rhs, std::size_t len);
+	/// CRC32C of the bytes
+	std::uint32_t (*hash)(const char *data, std::size_t len);
+	/// Offset of the first occurrence of the needle, npos if there is none
+	std::size_t (*find)(const char *hay, std::size_t hay_len,
+						const char *needle, std::size_t needle_len);
+	const char *name;
+
+	/// The best kernels for this CPU: avx2, sse4.2 or scalar
+	static const str_kernels &get() noexcept;
+	static const str_kernels &scalar() noexcept;
+};
+
+/// Byte-wise comparison, which orders UTF-8 by code points
+int str_compare(boost::string_ref lhs, boost::string_ref rhs) noexcept;
+
+inline bool str_equal(boost::string_ref lhs, boost::string_ref rhs) noexcept
+{
+	return lhs.size() == rhs.size()
+		&& str_kernels::get().mismatch(lhs.data(), rhs.data(), lhs.size()) == lhs.size();
+}
+
+inline std::uint32_t str_hash(boost::string_ref str) noexcept
+{
+	return str_kernels::get().hash(str.data(), str.size());
+}
+
+inline std::size_t str_find(boost::string_ref hay, boost::string_ref needle) noexcept
+{
+	return str_kernels::get().find(hay.data(), hay.size(), needle.data(), needle.size());
+}
+
+/// Functors for unordered containers of strings
+struct str_hasher
+{
+	std::size_t operator()(const std::string &str) const noexcept {
+		return str_hash(str);
+	}
+};
+
+struct str_equal_to
+{
+	bool operator()(const std::string &lhs, const std::string &rhs) const noexcept {
+		return str_equal(lhs, rhs);
+	}
+};
+
+} // inline namespace type_system
+
+} // namespace emel
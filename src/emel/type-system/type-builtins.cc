@@ -19,6 +19,7 @@
  */
 #include "type-builtins.h"
 #include "context.h"
+#include "map-data.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/convert.hpp>
@@ -190,22 +191,19 @@ std::string str::get_str(const type::rep &r) const {
 }
 
 bool str::empty(const type::rep &r) const {
-	auto ptr = r.get_ptr_unchecked();
-	return ptr->get<string_data>()->empty();
+	return r.get_counted_unchecked()->get<string_data>()->empty();
 }
 
 std::size_t str::size(const type::rep &r) const {
-	auto ptr = r.get_ptr_unchecked();
-	return ptr->get<string_data>()->size();
+	return r.get_counted_unchecked()->get<string_data>()->size();
 }
 
 std::size_t str::raw_size(const type::rep &r) const {
-	return size(r) * sizeof(char_type) + sizeof(string_data);
+	return r.get_counted_unchecked()->get<string_data>()->bytes + sizeof(string_data);
 }
 
 type::rep str::at(const type::rep &r, std::size_t idx) const {
-	auto ptr = r.get_ptr_unchecked();
-	auto *const sd = ptr->get<string_data>();
+	auto *const sd = r.get_counted_unchecked()->get<string_data>();
 	if(idx >= sd->size())
 		throw std::out_of_range("str: index " + std::to_string(idx)
 			+ " >= size of str (which is " + std::to_string(sd->size()) + ").");
@@ -227,7 +225,8 @@ bool loc_str::empty(const type::rep &r) const {
 }
 
 std::size_t loc_str::size(const type::rep &r) const {
-	return get_str(r).size(); // TODO multibyte!
+	const auto s = get_str(r);
+	return string_data::count_chars(s.data(), s.size());
 }
 
 std::size_t loc_str::raw_size(const type::rep &r) const {
@@ -236,11 +235,23 @@ std::size_t loc_str::raw_size(const type::rep &r) const {
 
 type::rep loc_str::at(const type::rep &r, std::size_t idx) const {
 	auto s = get_str(r);
-	const auto len = s.size();
+	const auto len = string_data::count_chars(s.data(), s.size());
 	if(idx >= len)
 		throw std::out_of_range("str: index " + std::to_string(idx)
 			+ " >= size of str (which is " + std::to_string(len) + ").");
-	return s.substr(idx, 1); // TODO multibyte!
+
+	// bounds of the code point, continuation bytes are 10xxxxxx
+	const auto is_lead = [](char c) { return 0x80 != (static_cast<unsigned char>(c) & 0xc0); };
+	std::size_t first = 0;
+	for(std::size_t nr_chars = 0; ; ++first)
+		if(is_lead(s[first]) && idx == nr_chars++)
+			break;
+
+	std::size_t last = first + 1;
+	while(last < s.size() && !is_lead(s[last]))
+		++last;
+
+	return s.substr(first, last - first);
 }
 
 /*static*/
@@ -268,26 +279,27 @@ std::string arr::get_str(const type::rep &r) const {
 }
 
 std::vector<type::rep> arr::get_arr(const type::rep &r) const {
-	auto ptr = r.get_ptr_unchecked();
+	auto *const ptr = r.get_counted_unchecked();
 	return ptr->get<array_data>()->get_arr();
 }
 
 bool arr::empty(const type::rep &r) const {
-	auto ptr = r.get_ptr_unchecked();
+	auto *const ptr = r.get_counted_unchecked();
 	return ptr->get<array_data>()->empty();
 }
 
 std::size_t arr::size(const type::rep &r) const {
-	auto ptr = r.get_ptr_unchecked();
+	auto *const ptr = r.get_counted_unchecked();
 	return ptr->get<array_data>()->size();
 }
 
 std::size_t arr::raw_size(const type::rep &r) const {
-	return size(r) * sizeof(rep) + sizeof(array_data);
+	auto *const ptr = r.get_counted_unchecked();
+	return ptr->get<array_data>()->raw_size();
 }
 
 type::rep arr::at(const type::rep &r, std::size_t idx) const {
-	auto ptr = r.get_ptr_unchecked();
+	auto *const ptr = r.get_counted_unchecked();
 	auto *const ad = ptr->get<array_data>();
 	if(idx >= ad->size())
 		throw std::out_of_range("arr: index " + std::to_string(idx)
@@ -298,6 +310,170 @@ type::rep arr::at(const type::rep &r, std::size_t idx) const {
 /*static*/
 const arr *arr::get() noexcept { static arr instance; return &instance; }
 
+
+map::map() : type((1 << pos_prim_comp) | (1 << pos_counted)) { }
+type::kind map::get_kind() const { return type::map; }
+std::string map::get_name() const { return "map"; }
+
+bool map::get_bool(const type::rep &r) const {
+	return !empty(r);
+}
+
+std::int64_t map::get_int(const type::rep &r) const {
+	return size(r);
+}
+
+double map::get_num(const type::rep &r) const {
+	return size(r);
+}
+
+std::string map::get_str(const type::rep &r) const {
+	return "map of " + std::to_string(size(r)) + " entries";
+}
+
+void *map::get_ptr(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<map_data>();
+}
+
+bool map::empty(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<map_data>()->empty();
+}
+
+std::size_t map::size(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<map_data>()->size();
+}
+
+std::size_t map::raw_size(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<map_data>()->raw_size();
+}
+
+/*static*/
+const map *map::get() noexcept { static map instance; return &instance; }
+
+
+inst::inst() : type((1 << pos_sys_user) | (1 << pos_prim_comp) | (1 << pos_counted)) { }
+type::kind inst::get_kind() const { return type::ptr; }
+
+std::string inst::get_name() const { return "instance"; }
+
+bool inst::get_bool(const type::rep &) const {
+	return true;
+}
+
+std::int64_t inst::get_int(const type::rep &) const {
+	return 0;
+}
+
+double inst::get_num(const type::rep &) const {
+	return 0.0;
+}
+
+std::string inst::get_str(const type::rep &r) const {
+	auto *const data = r.get_counted_unchecked()->get<instance_data>();
+	return "instance of " + data->whois->name.get();
+}
+
+void *inst::get_ptr(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<instance_data>();
+}
+
+bool inst::empty(const type::rep &) const {
+	return false;
+}
+
+std::size_t inst::size(const type::rep &r) const {
+	return r.get_counted_unchecked()->get<instance_data>()->fields.size();
+}
+
+std::size_t inst::raw_size(const type::rep &r) const {
+	return size(r) * sizeof(rep) + sizeof(instance_data);
+}
+
+/*static*/
+const inst *inst::get() noexcept { static inst instance; return &instance; }
+
+
+template <typename T>
+struct builtin_ops
+{
+	static const type *get_type(const type::rep &) noexcept { return T::get(); }
+	static bool get_bool(const type::rep &r) { return T::get()->T::get_bool(r); }
+	static std::int64_t get_int(const type::rep &r) { return T::get()->T::get_int(r); }
+	static double get_num(const type::rep &r) { return T::get()->T::get_num(r); }
+	static std::string get_str(const type::rep &r) { return T::get()->T::get_str(r); }
+	static bool empty(const type::rep &r) { return T::get()->T::empty(r); }
+	static std::size_t size(const type::rep &r) { return T::get()->T::size(r); }
+};
+
+// unboxed numbers and booleans are converted inline on the tag bits
+
+template <>
+bool builtin_ops<bool_>::get_bool(const type::rep &r) { return r.local_bool(); }
+template <>
+std::int64_t builtin_ops<bool_>::get_int(const type::rep &r) { return r.local_bool() ? 1L : 0L; }
+template <>
+double builtin_ops<bool_>::get_num(const type::rep &r) { return r.local_bool() ? 1.0 : 0.0; }
+
+template <>
+bool builtin_ops<int_>::get_bool(const type::rep &r) { return 0L != r.local_int(); }
+template <>
+std::int64_t builtin_ops<int_>::get_int(const type::rep &r) { return r.local_int(); }
+template <>
+double builtin_ops<int_>::get_num(const type::rep &r) { return double(r.local_int()); }
+
+template <>
+bool builtin_ops<num>::get_bool(const type::rep &r) { return static_cast<bool>(r.local_num()); }
+template <>
+std::int64_t builtin_ops<num>::get_int(const type::rep &r) { return static_cast<std::int64_t>(r.local_num()); }
+template <>
+double builtin_ops<num>::get_num(const type::rep &r) { return r.local_num(); }
+
+namespace {
+
+/// Maps and user types share the ptr tag, their type is in object_info
+struct ptr_dispatch
+{
+	static const type *get_type(const type::rep &r) noexcept {
+		return r.get_counted_unchecked()->get<object_info>()->t;
+	}
+
+	static bool get_bool(const type::rep &r) { return get_type(r)->get_bool(r); }
+	static std::int64_t get_int(const type::rep &r) { return get_type(r)->get_int(r); }
+	static double get_num(const type::rep &r) { return get_type(r)->get_num(r); }
+	static std::string get_str(const type::rep &r) { return get_type(r)->get_str(r); }
+	static bool empty(const type::rep &r) { return get_type(r)->empty(r); }
+	static std::size_t size(const type::rep &r) { return get_type(r)->size(r); }
+};
+
+template <typename Ops>
+constexpr type_ops make_ops(type::kind kind, bool counted)
+{
+	return { kind, counted, &Ops::get_type, &Ops::get_bool, &Ops::get_int,
+		&Ops::get_num, &Ops::get_str, &Ops::empty, &Ops::size };
+}
+
+constexpr type_ops none_ops = make_ops<builtin_ops<none>>(type::none, false);
+constexpr type_ops bool_ops = make_ops<builtin_ops<bool_>>(type::bool_, false);
+constexpr type_ops int_ops = make_ops<builtin_ops<int_>>(type::int_, false);
+constexpr type_ops num_ops = make_ops<builtin_ops<num>>(type::num, false);
+constexpr type_ops str_ops = make_ops<builtin_ops<str>>(type::str, true);
+constexpr type_ops loc_str_ops = make_ops<builtin_ops<loc_str>>(type::str, false);
+constexpr type_ops arr_ops = make_ops<builtin_ops<arr>>(type::arr, true);
+constexpr type_ops ptr_ops = make_ops<ptr_dispatch>(type::ptr, true);
+
+} // anonymous namespace
+
+// see the layout of the tag bits in type.cc
+constexpr type_ops type_ops::table[type::rep::nr_tags] = {
+	// bit 7 is 0
+	num_ops, int_ops, num_ops, str_ops, num_ops, int_ops, num_ops, arr_ops,
+	num_ops, int_ops, num_ops, ptr_ops, num_ops, int_ops, num_ops, loc_str_ops,
+	// bit 7 is 1
+	num_ops, int_ops, num_ops, str_ops, num_ops, int_ops, num_ops, arr_ops,
+	num_ops, int_ops, num_ops, ptr_ops, num_ops, int_ops, num_ops, bool_ops,
+	none_ops
+};
+
 } // inline namespace type_system
 
 } // namespace emel
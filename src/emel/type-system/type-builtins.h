@@ -23,8 +23,13 @@
 
 namespace emel { inline namespace type_system {
 
+/// Entries of type_ops::table, calling the methods of @a T directly
+template <typename T>
+struct builtin_ops;
+
 class none final : public type
 {
+	friend struct builtin_ops<none>;
 	none();
 	virtual kind get_kind() const override;
 	virtual std::string get_name() const override;
@@ -42,6 +47,7 @@ public:
 
 class bool_ : public type
 {
+	friend struct builtin_ops<bool_>;
 	bool_();
 
 protected:
@@ -71,6 +77,7 @@ public:
 
 class int_ : public type
 {
+	friend struct builtin_ops<int_>;
 	int_();
 
 protected:
@@ -100,6 +107,7 @@ public:
 
 class num : public type
 {
+	friend struct builtin_ops<num>;
 	num();
 
 protected:
@@ -129,6 +137,7 @@ public:
 
 class str : public type
 {
+	friend struct builtin_ops<str>;
 	str();
 
 protected:
@@ -150,6 +159,7 @@ public:
 
 class loc_str final : public str
 {
+	friend struct builtin_ops<loc_str>;
 	loc_str();
 	virtual std::string get_str(const rep &r) const override;
 	virtual bool empty(const rep &r) const override;
@@ -163,6 +173,7 @@ public:
 
 class arr final : public type
 {
+	friend struct builtin_ops<arr>;
 	arr();
 	virtual kind get_kind() const override;
 	virtual std::string get_name() const override;
@@ -180,6 +191,43 @@ public:
 	static const arr *get() noexcept;
 };
 
+class map final : public type
+{
+	map();
+	virtual kind get_kind() const override;
+	virtual std::string get_name() const override;
+	virtual bool get_bool(const rep &r) const override;
+	virtual std::int64_t get_int(const rep &r) const override;
+	virtual double get_num(const rep &r) const override;
+	virtual std::string get_str(const rep &r) const override;
+	virtual void *get_ptr(const rep &r) const override;
+	virtual bool empty(const rep &r) const override;
+	virtual std::size_t size(const rep &r) const override;
+	virtual std::size_t raw_size(const rep &r) const override;
+
+public:
+	static const map *get() noexcept;
+};
+
+class inst final : public type
+{
+	inst();
+
+	virtual kind get_kind() const override;
+	virtual std::string get_name() const override;
+	virtual bool get_bool(const rep &r) const override;
+	virtual std::int64_t get_int(const rep &r) const override;
+	virtual double get_num(const rep &r) const override;
+	virtual std::string get_str(const rep &r) const override;
+	virtual void *get_ptr(const rep &r) const override;
+	virtual bool empty(const rep &r) const override;
+	virtual std::size_t size(const rep &r) const override;
+	virtual std::size_t raw_size(const rep &r) const override;
+
+public:
+	static const inst *get() noexcept;
+};
+
 /*class ptr : public type
 {
 public:
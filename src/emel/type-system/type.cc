@@ -21,13 +21,67 @@
 #include "type-builtins.h"
 #include "context.h"
 
+#include <atomic>
+#include <cstring>
 #include <limits>
 
 namespace emel { inline namespace type_system {
 
+namespace {
+
+const type *boxed_type(std::int64_t) { return int_ptr::get(); }
+const type *boxed_type(double) { return num_ptr::get(); }
+
+/// Boxed ints and nums are immutable, so equal ones are shared through
+/// a direct-mapped table of the runtime. Slots are filled once and never
+/// released, so that lookups need neither locks nor eviction. Boxes of
+/// the slots live out of the regions, they would pin their chunks.
+template <typename Tp>
+memory::atomic_counted *make_boxed(Tp value)
+{
+	static constexpr std::size_t nr_slots = 256;
+	static std::atomic<memory::atomic_counted *> slots[nr_slots];
+
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof bits);
+	auto &slot = slots[(bits * 0x9e3779b97f4a7c15ULL) >> 56];
+
+	// by the bits, so that -0.0 isn't 0.0
+	const auto holds = [&bits](memory::atomic_counted *ac) {
+		return 0 == std::memcmp(&ac->get<boxed_value<Tp>>()->value, &bits, sizeof bits);
+	};
+
+	const auto make = [value](memory::resource_type *source) {
+		return memory::allocate_counted<boxed_value<Tp>>(rt_allocator<boxed_value<Tp>>(source),
+			boxed_value<Tp> { { boxed_type(value) }, value });
+	};
+
+	memory::atomic_counted *cached = slot.load(std::memory_order_acquire);
+	if(!cached) {
+		auto *const ac = make(memory::get_global_source());
+		if(slot.compare_exchange_strong(cached, ac, std::memory_order_acq_rel)) {
+			ac->acquire(); // the reference of the slot
+			return ac;
+		}
+
+		// filled by another thread meanwhile
+		if(!holds(cached))
+			return ac;
+		ac->release();
+	}
+
+	if(!holds(cached))
+		return make(memory::get_source());
+
+	cached->acquire();
+	return cached;
+}
+
+} // anonymous namespace
+
 type::rep::rep(const rep &other) noexcept
 {
-	if(get_type()->is_counted()) {
+	if(other.ops().counted) {
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(other.i & ~0b1111L);
 		const auto alive = ac->acquire();
 		assert(alive);
@@ -38,7 +92,7 @@ type::rep::rep(const rep &other) noexcept
 
 type::rep &type::rep::operator =(const rep &other) noexcept
 {
-	if(get_type()->is_counted()) {
+	if(other.ops().counted) {
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(other.i & ~0b1111L);
 		const auto alive = ac->acquire();
 		assert(alive);
@@ -75,48 +129,18 @@ type::rep::~rep() noexcept
 // 0...1111 1111 - bool true
 // x...0xxx 1111 - str local
 // 0...0000 1011 - none (0x0 ptr)
-// FIXME 8-byte ptr alignment!
+
+static_assert(alignof(memory::atomic_counted) >= 0b10000,
+	"tags need 4 clear low bits of counted pointers, see memory::counted_alignment");
 
 const type *type::rep::get_type() const noexcept
 {
-	if(0L == (i & 1L))
-		return num::get();
-
-	else if(0L == (i & 2L))
-		return int_::get();
-
-	else if(0b1011L == i)
-		return none::get();
-
-	switch(i & 0b10001111L) {
-		case 0b00001111L:
-			return loc_str::get(); // local str
-		case 0b10001111L:
-			return bool_::get();
-		default:
-			switch(i & 0b1111L) {
-				case 0b0011L:
-					return str::get(); // non-local str
-				case 0b0111L:
-					return arr::get();
-				case 0b1011L: {
-					assert(0L != (i & ~0b1111L)); // this is none
-					auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
-					return ac->get<object_info>()->t;
-				}
-				case 0b1111L:
-					assert(false); // bool or local str
-				default: break;
-			}
-	}
-
-	assert(false);
-	return nullptr;
+	return ops().get_type(*this);
 }
 
 void type::rep::clear()
 {
-	if(get_type()->is_counted()) {
+	if(ops().counted) {
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
 		ac->release();
 	}
@@ -136,16 +160,15 @@ bool type::rep::get(bool &value) const noexcept
 
 bool type::rep::get(std::int64_t &value) const noexcept
 {
-	if(1L == (i & 0b11L)) {
-		const bool negative = 0L != (i & 0b100L);
-		value = (static_cast<std::uint64_t>(i) >> 3L) | ((negative ? 0b111L : 0L) << 61L);
+	if(is_local_int()) {
+		value = local_int();
 		return true;
 	}
 
 	if(0b1011L == (i & 0b1111L) && 0L != (i & ~0b1111L)) {
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
 		if(type::int_ == ac->get<object_info>()->t->get_kind()) {
-			value = *ac->get<std::int64_t>();
+			value = ac->get<boxed_value<std::int64_t>>()->value;
 			return true;
 		}
 	}
@@ -153,29 +176,17 @@ bool type::rep::get(std::int64_t &value) const noexcept
 	return false;
 }
 
-static constexpr auto exp_mask = 0b011111111111UL << 52;
-static constexpr auto beg_mask = 0b001000000000UL << 52;
-
 bool type::rep::get(double &value) const noexcept
 {
-	if(0L == (i & 1L)) {
-		auto orig_i = (static_cast<std::uint64_t>(i) >> 3L)
-			| ((i | (0L == (i & 0b10L))) << 61L);
-
-		if (__builtin_expect((beg_mask | 0xffffffffffffL) == (orig_i & ~(1L << 63L)), false))
-			orig_i &= 1L << 63L;
-		else if(__builtin_expect(beg_mask == (orig_i & exp_mask), false))
-			orig_i = (orig_i & ~beg_mask) | exp_mask;
-
-		union { std::uint64_t i; double d; } u;
-		u.i = orig_i; value = u.d;
+	if(is_local_num()) {
+		value = local_num();
 		return true;
 	}
 
 	if(0b1011L == (i & 0b1111L) && 0L != (i & ~0b1111L)) {
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
 		if(type::num == ac->get<object_info>()->t->get_kind()) {
-			value = *ac->get<double>();
+			value = ac->get<boxed_value<double>>()->value;
 			return true;
 		}
 	}
@@ -240,7 +251,7 @@ void type::rep::set(std::int64_t value) noexcept
 		i = (value << 3L) | (value < 0L ? 0b101L : 0b1L);
 
 	else {
-		auto *const ac = memory::make_counted<decltype(value)>(value);
+		auto *const ac = make_boxed(value);
 		i = reinterpret_cast<std::int64_t>(ac);
 		assert(0L == (i & 0b1111L)); // alignment
 		i |= 0b1011L;
@@ -269,7 +280,7 @@ void type::rep::set(double value) noexcept
 		i = (i << 3L) | ((static_cast<std::uint64_t>(i) >> 61L) & ~1L);
 
 	else {
-		auto *const ac = memory::make_counted<decltype(value)>(value);
+		auto *const ac = make_boxed(value);
 		i = reinterpret_cast<std::int64_t>(ac);
 		assert(0L == (i & 0b1111L)); // alignment
 		i |= 0b1011L;
@@ -317,6 +328,7 @@ void type::rep::set(memory::counted_ptr value) noexcept
 	clear();
 	assert(0L == (std::int64_t(value.get()) & 0b1111L)); // alignment
 	assert(value->use_count() > 0);
+	memory::record_store(this, value.get());
 	i = std::int64_t(value.detach()) | 0b1011L;
 }
 
@@ -325,6 +337,22 @@ void type::rep::set(std::nullptr_t) noexcept
 	clear();
 }
 
+void type::rep::set_str(memory::counted_ptr value) noexcept
+{
+	clear();
+	assert(0L == (std::int64_t(value.get()) & 0b1111L)); // alignment
+	assert(value->use_count() > 0);
+	i = std::int64_t(value.detach()) | 0b0011L;
+}
+
+void type::rep::set_arr(memory::counted_ptr value) noexcept
+{
+	clear();
+	assert(0L == (std::int64_t(value.get()) & 0b1111L)); // alignment
+	assert(value->use_count() > 0);
+	i = std::int64_t(value.detach()) | 0b0111L;
+}
+
 bool type::rep::get_bool_unchecked(bool /*from_ptr*/) const noexcept
 {
 	// TODO from_ptr
@@ -338,12 +366,11 @@ std::int64_t type::rep::get_int_unchecked(bool from_ptr) const noexcept
 		assert(0b1011L == (i & 0b1111L) && 0L != (i & ~0b1111L));
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
 		assert(type::int_ == ac->get<object_info>()->t->get_kind());
-		return *ac->get<std::int64_t>();
+		return ac->get<boxed_value<std::int64_t>>()->value;
 
 	} else {
-		assert(1L == (i & 0b11L));
-		const bool negative = 0L != (i & 0b100L);
-		return (static_cast<std::uint64_t>(i) >> 3L) | ((negative ? 0b111L : 0L) << 61L);
+		assert(is_local_int());
+		return local_int();
 	}
 }
 
@@ -353,21 +380,11 @@ double type::rep::get_num_unchecked(bool from_ptr) const noexcept
 		assert(0b1011L == (i & 0b1111L) && 0L != (i & ~0b1111L));
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
 		assert(type::num == ac->get<object_info>()->t->get_kind());
-		return *ac->get<double>();
+		return ac->get<boxed_value<double>>()->value;
 
 	} else {
-		assert(0L == (i & 1L));
-		auto orig_i = (static_cast<std::uint64_t>(i) >> 3L)
-			| ((i | (0L == (i & 0b10L))) << 61L);
-
-		if (__builtin_expect((beg_mask | 0xffffffffffffL) == (orig_i & ~(1L << 63L)), false))
-			orig_i &= 1L << 63L;
-		else if(__builtin_expect(beg_mask == (orig_i & exp_mask), false))
-			orig_i = (orig_i & ~beg_mask) | exp_mask;
-
-		union { std::uint64_t i; double d; } u;
-		u.i = orig_i;
-		return u.d;
+		assert(is_local_num());
+		return local_num();
 	}
 }
 
@@ -376,7 +393,6 @@ std::string type::rep::get_str_unchecked(bool from_ptr) const noexcept
 	if(from_ptr) {
 		assert(0b0011L == (i & 0b1111L));
 		auto *const ac = reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
-		assert(type::str == ac->get<object_info>()->t->get_kind());
 		return ac->get<string_data>()->get_str();
 
 	} else {
@@ -413,6 +429,7 @@ const char *type_name(type::kind t)
 		TYPE_NAME(type::num,   "{num}")
 		TYPE_NAME(type::str,   "{str}")
 		TYPE_NAME(type::arr,   "{arr}")
+		TYPE_NAME(type::map,   "{map}")
 
 		default:
 			break;
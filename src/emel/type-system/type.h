@@ -29,6 +29,8 @@
 
 namespace emel EMEL_EXPORT { inline namespace type_system {
 
+struct type_ops;
+
 class type
 {
 	std::bitset<32> bits;
@@ -50,6 +52,8 @@ class type
 	friend class str;
 	friend class loc_str;
 	friend class arr;
+	friend class map;
+	friend class inst;
 
 	type() = default;
 	type(std::bitset<32> &&bs) : bits(std::move(bs)) { }
@@ -65,6 +69,7 @@ public:
 		num,
 		str,
 		arr,
+		map,
 		ptr
 	};
 
@@ -93,6 +98,8 @@ public:
 		static_assert(BYTE_ORDER == LITTLE_ENDIAN, "little endian only");
 
 		static constexpr std::size_t local_bytes_count = sizeof(double) - sizeof(char);
+		static constexpr std::uint64_t exp_mask = 0b011111111111UL << 52;
+		static constexpr std::uint64_t beg_mask = 0b001000000000UL << 52;
 
 	public:
 		inline rep() noexcept : i(0) { set(nullptr); }
@@ -133,11 +140,72 @@ public:
 		void set(memory::counted_ptr value) noexcept;
 		void set(std::nullptr_t) noexcept;
 
+		/// Take @a value holding string_data as non-local str
+		void set_str(memory::counted_ptr value) noexcept;
+		/// Take @a value holding array_data as arr
+		void set_arr(memory::counted_ptr value) noexcept;
+
 	  template <std::size_t Nm>
 		inline void set(const  char (&value) [Nm]) { set(value, Nm - 1); }
 
 		inline void set(const std::string &value) { set(value.data(), value.length()); }
 
+		/// Unboxed values, tested and decoded inline on the tag bits
+		/// by the fast paths of the interpreter
+		inline bool is_local_num() const noexcept { return 0L == (i & 1L); }
+		inline bool is_local_int() const noexcept { return 1L == (i & 0b11L); }
+		inline bool is_bool() const noexcept { return 0b10001111L == (i & ~0b01110000L); }
+
+		inline bool local_bool() const noexcept { return 0b11111111L == i; }
+
+		inline bool is_none() const noexcept { return 0b1011L == i; }
+		inline bool is_counted_str() const noexcept { return 0b0011L == (i & 0b1111L); }
+		inline bool is_arr() const noexcept { return 0b0111L == (i & 0b1111L); }
+		inline bool is_ptr() const noexcept { return 0b1011L == (i & 0b1111L) && 0b1011L != i; }
+
+		inline bool is_local_str() const noexcept { return 0b00001111L == (i & 0b10001111L); }
+
+		/// Bytes of local str, valid while the rep is alive
+		inline const char *local_str_data() const noexcept { return s + 1; }
+		inline std::size_t local_str_size() const noexcept { return std::size_t(i & 0b01110000L) >> 4L; }
+
+		inline memory::atomic_counted *get_counted_unchecked() const noexcept {
+			return reinterpret_cast<memory::atomic_counted *>(i & ~0b1111L);
+		}
+
+		inline std::int64_t local_int() const noexcept
+		{
+			const bool negative = 0L != (i & 0b100L);
+			return (static_cast<std::uint64_t>(i) >> 3L) | ((negative ? 0b111L : 0L) << 61L);
+		}
+
+		inline double local_num() const noexcept
+		{
+			auto orig_i = (static_cast<std::uint64_t>(i) >> 3L)
+				| ((i | (0L == (i & 0b10L))) << 61L);
+
+			if (__builtin_expect((beg_mask | 0xffffffffffffL) == (orig_i & ~(1UL << 63L)), false))
+				orig_i &= 1UL << 63L;
+			else if(__builtin_expect(beg_mask == (orig_i & exp_mask), false))
+				orig_i = (orig_i & ~beg_mask) | exp_mask;
+
+			union { std::uint64_t i; double d; } u;
+			u.i = orig_i;
+			return u.d;
+		}
+
+		/// Compact index of the type in type_ops::table: the low 4 bits
+		/// and bit 7, which tells bool from local str; none is the last
+		static constexpr std::size_t nr_tags = 33;
+
+		inline std::size_t tag() const noexcept {
+			return 0b1011L == i ? nr_tags - 1
+				: std::size_t(i & 0b1111L) | (std::size_t(i >> 3L) & 0b10000L);
+		}
+
+		inline const type_ops &ops() const noexcept;
+		inline kind get_kind() const noexcept;
+
 		bool get_bool_unchecked(bool from_ptr = false) const noexcept;
 		std::int64_t get_int_unchecked(bool from_ptr = false) const noexcept;
 		double get_num_unchecked(bool from_ptr = false) const noexcept;
@@ -161,6 +229,37 @@ public:
 	virtual rep at(const rep &, std::size_t) const { return rep(); }
 };
 
+/// Operations of the builtin types, indexed by type::rep::tag(), so that
+/// a rep is dispatched by one load and a direct call instead of the bit
+/// tests of get_type() and a virtual call. Reps with the ptr tag are maps
+/// and user types, which are dispatched further by their own type.
+struct type_ops
+{
+	type::kind kind; // of the builtin type, ptr for the ptr tag
+	bool counted;
+
+	const type *(*get_type)(const type::rep &r) noexcept;
+	bool (*get_bool)(const type::rep &r);
+	std::int64_t (*get_int)(const type::rep &r);
+	double (*get_num)(const type::rep &r);
+	std::string (*get_str)(const type::rep &r);
+	bool (*empty)(const type::rep &r);
+	std::size_t (*size)(const type::rep &r);
+
+	static const type_ops table[type::rep::nr_tags];
+};
+
+inline const type_ops &type::rep::ops() const noexcept
+{
+	return type_ops::table[tag()];
+}
+
+inline type::kind type::rep::get_kind() const noexcept
+{
+	const type_ops &o = ops();
+	return __builtin_expect(type::ptr != o.kind, true) ? o.kind : get_type()->get_kind();
+}
+
 EMEL_EXPORT const char *type_name(type::kind t);
 
 } // inline namespace type_system
@@ -20,6 +20,8 @@
 #include <gmock/gmock.h>
 
 #include <emel/compiler/compiler.h>
+#include <emel/compiler/peephole.h>
+#include <emel/compiler/reg-translator.h>
 
 using namespace emel;
 using namespace std::literals;
@@ -1952,6 +1954,147 @@ TEST(Compiler, SwitchBlockWithMixedCases)
     }));
 }
 
+TEST(Compiler, RegisterTranslation)
+{
+    // for(i = 5, acc = 0; i; i = i - 1) acc = acc + i
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::brf_false, 10),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 10),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto code = compiler::reg_translator::translate(insns, 2);
+    ASSERT_TRUE(code.is_initialized());
+    EXPECT_EQ(2, code->nr_locals);
+    EXPECT_EQ(4, code->nr_regs);
+
+    std::vector<std::string> listing;
+    for(const auto &insn : code->insns)
+        listing.push_back(reg_insn_to_string(insn));
+
+    EXPECT_THAT(listing, ElementsAreArray({
+        "move r1, k1"s,
+        "move r0, k3"s,
+        "jmp-false r0, 4"s,
+        "add r1, r1, r0"s,
+        "sub r0, r0, k2"s,
+        "jmp -3"s,
+        "ret r1"s
+    }));
+}
+
+TEST(Compiler, RegisterTranslationSlots)
+{
+    // x = x ? 1 : 2; swap and store through the temporaries
+    const insn_array insns {
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::brf_false, 3),
+        insn_encode(opcode::push, 1),
+        insn_encode(opcode::brf, 2),
+        insn_encode(opcode::push, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::swap),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto code = compiler::reg_translator::translate(insns, 1);
+    ASSERT_TRUE(code.is_initialized());
+    EXPECT_EQ(3, code->nr_regs);
+
+    std::vector<std::string> listing;
+    for(const auto &insn : code->insns)
+        listing.push_back(reg_insn_to_string(insn));
+
+    EXPECT_THAT(listing, ElementsAreArray({
+        "jmp-false r0, 3"s,
+        "move r1, #1"s,
+        "jmp 2"s,
+        "move r1, #2"s,
+        "move r2, r0"s,
+        "swap r2, r1"s,
+        "move r0, r2"s,
+        "ret r1"s
+    }));
+
+    // methods with fields stay on the stack tier
+    EXPECT_FALSE(compiler::reg_translator::translate({
+        insn_encode(opcode::push_field, 0),
+        insn_encode(opcode::ret, 1)
+    }, 1).is_initialized());
+}
+
+TEST(Compiler, Superinstructions)
+{
+    // i = 5; while i > 0: i = i - 1
+    insn_array insns {
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::gt),
+        insn_encode(opcode::brf_false, 6),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 8),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::ret, 1)
+    };
+
+    compiler::ngram_profile profile;
+    compiler::peephole::profile(insns, 2, profile);
+    EXPECT_EQ(2, (profile[{ opcode::push_local, opcode::call_op }]));
+    EXPECT_EQ(2, (profile[{ opcode::push_const, opcode::push_local }]));
+
+    const auto stats = compiler::peephole::fuse(insns);
+    EXPECT_EQ(13, stats.insns_before);
+    EXPECT_EQ(10, stats.insns_after);
+    EXPECT_EQ(0, stats.call_op_const);
+    EXPECT_EQ(1, stats.call_op_local);
+    EXPECT_EQ(1, stats.call_op_store);
+
+    EXPECT_THAT(insns, ElementsAreArray({
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::call_op_local, fused_arg::make(op_kind::gt, 0)),
+        insn_encode(opcode::brf_false, 4),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::call_op_store, fused_arg::make(op_kind::sub, 0, 0)),
+        insn_encode(opcode::brb, 5),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::ret, 1)
+    }));
+
+    // sequences split by a branch target are kept
+    insn_array split {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::brf_true, 2),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto split_stats = compiler::peephole::fuse(split);
+    EXPECT_EQ(split_stats.insns_before, split_stats.insns_after);
+}
+
 // TODO Call
 // TODO TryBlock
 // TODO Branches
@@ -19,7 +19,18 @@
  */
 #include <gmock/gmock.h>
 
+#include <emel/compiler/peephole.h>
+#include <emel/compiler/reg-translator.h>
+#include <emel/runtime/call.h>
+#include <emel/runtime/const-pool.h>
+#include <emel/runtime/fast-ops.h>
+#include <emel/runtime/inline-cache.h>
 #include <emel/runtime/interp.h>
+#include <emel/runtime/jit.h>
+#include <emel/runtime/profiler.h>
+#include <emel/runtime/reg-interp.h>
+
+#include <sstream>
 
 using namespace emel;
 using namespace std::literals;
@@ -37,8 +48,10 @@ TEST(Interp, ReturnEmpty)
         insn_encode(opcode::ret, 0)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 1);
+        code.begin(), code.end(), 0, 1);
 
     auto res = interp.run();
     EXPECT_TRUE(res.empty());
@@ -55,8 +68,10 @@ TEST(Interp, ReturnConstant)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 1);
+        code.begin(), code.end(), 0, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -75,8 +90,10 @@ TEST(Interp, UnaryNot)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 1);
+        code.begin(), code.end(), 0, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -95,8 +112,10 @@ TEST(Interp, UnaryNeg)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 1);
+        code.begin(), code.end(), 0, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -116,8 +135,10 @@ TEST(Interp, BinaryOr)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -137,8 +158,10 @@ TEST(Interp, BinaryXor)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -158,8 +181,10 @@ TEST(Interp, BinaryAnd)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -184,6 +209,8 @@ TEST(Interp, BinaryRelativeOps)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     const insn_array insns2 {
         insn_encode(opcode::push_const, 3),
         insn_encode(opcode::push_const, 2),
@@ -196,11 +223,13 @@ TEST(Interp, BinaryRelativeOps)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code2(insns2);
+
     runtime::interp interp(const_pool,
-        insns2.begin(), insns2.end(), 0, 3);
+        code2.begin(), code2.end(), 0, 3);
 
     interp.push_frame(const_pool,
-        insns.begin(), insns.end(), 0, 3);
+        code.begin(), code.end(), 0, 3);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -220,8 +249,10 @@ TEST(Interp, BinaryLessThan)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -241,8 +272,10 @@ TEST(Interp, BinaryGreaterThan)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -270,8 +303,10 @@ TEST(Interp, BinaryLTE)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 3);
+        code.begin(), code.end(), 0, 3);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -299,8 +334,10 @@ TEST(Interp, BinaryGTE)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 3);
+        code.begin(), code.end(), 0, 3);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -320,8 +357,10 @@ TEST(Interp, BinaryAdd)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -341,8 +380,10 @@ TEST(Interp, BinarySub)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -362,8 +403,10 @@ TEST(Interp, BinaryMul)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -383,14 +426,47 @@ TEST(Interp, BinaryDiv)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 0, 2);
+        code.begin(), code.end(), 0, 2);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
     EXPECT_EQ(2.34 / 1.23, res.as_number().value());
 }
 
+TEST(Interp, FastOpsMatchGeneric)
+{
+    const runtime::object operands[] = {
+        std::int64_t(3), std::int64_t(-7), std::int64_t(1) << 40, 2.5, true
+    };
+
+    const std::pair<op_kind, runtime::object (*)(const runtime::object &, const runtime::object &)> ops[] = {
+        { op_kind::add, [](const runtime::object &l, const runtime::object &r) { return l + r; } },
+        { op_kind::sub, [](const runtime::object &l, const runtime::object &r) { return l - r; } },
+        { op_kind::mul, [](const runtime::object &l, const runtime::object &r) { return l * r; } },
+        { op_kind::div, [](const runtime::object &l, const runtime::object &r) { return l / r; } },
+        { op_kind::lt, [](const runtime::object &l, const runtime::object &r) { return runtime::object(l < r); } },
+        { op_kind::eq, [](const runtime::object &l, const runtime::object &r) { return runtime::object(l == r); } }
+    };
+
+    // the fast path gives the same kind and value of the result
+    for(const auto &op : ops) {
+        for(const auto &lhs : operands) {
+            for(const auto &rhs : operands) {
+                runtime::object fast;
+                if(!runtime::eval_fast_op(op.first, lhs, rhs, fast))
+                    continue;
+
+                const runtime::object generic = op.second(lhs, rhs);
+                EXPECT_EQ(generic.get_type(), fast.get_type());
+                EXPECT_EQ(generic, fast);
+            }
+        }
+    }
+}
+
 TEST(Interp, PushPopLocals)
 {
     const std::vector<value_type> const_pool {
@@ -404,8 +480,10 @@ TEST(Interp, PushPopLocals)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 1, 1);
+        code.begin(), code.end(), 1, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -438,8 +516,10 @@ TEST(Interp, DupAndPop)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 1, 1);
+        code.begin(), code.end(), 1, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -464,8 +544,10 @@ TEST(Interp, Swap)
         insn_encode(opcode::ret, 1)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 1, 1);
+        code.begin(), code.end(), 1, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
@@ -517,10 +599,655 @@ TEST(Interp, Branches)
         insn_encode(opcode::brb, 4)
     };
 
+    const runtime::code_object code(insns);
+
     runtime::interp interp(const_pool,
-        insns.begin(), insns.end(), 1, 1);
+        code.begin(), code.end(), 1, 1);
 
     auto res = interp.run();
     ASSERT_FALSE(res.empty());
     EXPECT_EQ(2, res.as_number().value());
 }
+
+TEST(Interp, LinkedCode)
+{
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::call_op, op_kind::neg),
+        insn_encode(opcode::brb, 2),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+
+    ASSERT_EQ(4, code.size());
+    EXPECT_EQ(0, reinterpret_cast<std::uintptr_t>(code.begin())
+              % runtime::code_object::alignment);
+
+    for(std::size_t idx = 0; idx < insns.size(); ++idx) {
+        const auto pair = insn_decode(insns[idx]);
+        EXPECT_EQ(pair.first, code[idx].op);
+        EXPECT_EQ(pair.second, code[idx].arg);
+    }
+}
+
+TEST(Interp, ThreadedDispatch)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 0.0, 1.0, 5.0
+    };
+
+    // for(i = 5, acc = 0; i; i = i - 1) acc = acc + i
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::brf_false, 10),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 10),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp interp(const_pool,
+            code.begin(), code.end(), 2, 2);
+
+        interp.set_dispatch_mode(mode);
+
+        auto res = interp.run();
+        ASSERT_FALSE(res.empty());
+        EXPECT_EQ(15, res.as_number().value());
+    }
+}
+
+TEST(Interp, FrameWindows)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, "test"s
+    };
+
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+
+    runtime::interp interp(const_pool,
+        code.begin(), code.end(), 1, 1);
+
+    // deep enough to spill over the first segment of the value stack
+    for(int i = 0; i < 1000; ++i)
+        interp.push_frame(const_pool,
+            code.begin(), code.end(), 2, 2);
+
+    EXPECT_EQ(1001, interp.frames_count());
+
+    auto res = interp.run();
+    EXPECT_EQ(0, interp.frames_count());
+    ASSERT_FALSE(res.empty());
+    EXPECT_EQ("test", res.as_string().value());
+}
+
+TEST(Interp, RegisterTier)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 0.0, 1.0, 5.0
+    };
+
+    // i = 5, acc = 0; while i > 0: acc = acc + i * 2, i = i - 1
+    const insn_array insns {
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::gt),
+        insn_encode(opcode::brf_false, 12),
+        insn_encode(opcode::push, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::mul),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 14),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+    runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+    auto expected = interp.run();
+
+    const auto reg_code = compiler::reg_translator::translate(insns, 2);
+    ASSERT_TRUE(reg_code.is_initialized());
+    EXPECT_LT(reg_code->insns.size(), insns.size());
+
+    runtime::reg_interp reg_interp(const_pool, *reg_code);
+    auto res = reg_interp.run();
+    ASSERT_FALSE(res.empty());
+    EXPECT_EQ(30, res.as_number().value());
+    EXPECT_EQ(expected.as_number().value(), res.as_number().value());
+}
+
+TEST(Interp, Superinstructions)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 0.0, 1.0, 5.0
+    };
+
+    // for(i = 5, acc = 0; i; i = i - 1) acc = acc + i * i
+    insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::brf_false, 12),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::mul),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 12),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto stats = compiler::peephole::fuse(insns);
+    EXPECT_LT(stats.insns_after, stats.insns_before);
+
+    const runtime::code_object code(insns);
+
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp interp(const_pool,
+            code.begin(), code.end(), 2, 3);
+
+        interp.set_dispatch_mode(mode);
+
+        auto res = interp.run();
+        ASSERT_FALSE(res.empty());
+        EXPECT_EQ(55, res.as_number().value());
+    }
+}
+
+TEST(Interp, MaterializedConstPool)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, "short"s, "a string longer than a local rep"s, 1.5, true
+    };
+
+    const runtime::materialized_pool pool(const_pool);
+    ASSERT_EQ(const_pool.size(), pool.size());
+    EXPECT_TRUE(pool[0].get_rep().is_none());
+    EXPECT_TRUE(pool[3].get_rep().is_local_num());
+    EXPECT_TRUE(pool[4].get_rep().is_bool());
+
+    // copies share the storage of the long string
+    const runtime::object first(pool[2]), second(pool[2]);
+    auto *const storage = pool[2].get_rep().get_counted_unchecked();
+    EXPECT_EQ(storage, first.get_rep().get_counted_unchecked());
+    EXPECT_EQ(storage, second.get_rep().get_counted_unchecked());
+
+    // equal literals are interned, the table holds a reference of its own
+    const runtime::materialized_pool other(const_pool);
+    EXPECT_EQ(storage, other[2].get_rep().get_counted_unchecked());
+    EXPECT_EQ(5, storage->use_count());
+}
+
+static memory_ptr<context_info> make_class(const char *name, std::initializer_list<offset_t> offsets)
+{
+    memory_ptr<context_info> ci(memory::make_counted<context_info>(
+        context_kind::type, boost::flyweight<std::string>(name)), false);
+    for(auto offset : offsets)
+        ci->fields_offsets.push_back(offset);
+    return ci;
+}
+
+struct field_interp : runtime::interp
+{
+    using interp::interp;
+    using interp::top_frame;
+};
+
+TEST(Interp, FieldInlineCache)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 1.0
+    };
+
+    // this.f1 = this.f0 + 1; return this.f1
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_field, 0),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::load_field, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_field, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    // same fields, different layouts
+    const auto class_a = make_class("A", { 0, 1 });
+    const auto class_b = make_class("B", { 1, 0 });
+
+    auto a1 = runtime::make_instance(class_a, 2);
+    auto b1 = runtime::make_instance(class_b, 2);
+    auto a2 = runtime::make_instance(class_a, 2);
+    runtime::get_instance(a1)->fields[0] = type::rep(1.0);
+    runtime::get_instance(b1)->fields[1] = type::rep(2.0);
+    runtime::get_instance(a2)->fields[0] = type::rep(3.0);
+
+    const runtime::code_object code(insns);
+    field_interp interp(const_pool, code.begin(), code.end(), 1, 4);
+
+    const std::pair<runtime::object *, double> runs[] = {
+        { &a1, 2.0 }, { &b1, 3.0 }, { &a2, 4.0 }
+    };
+
+    bool first = true;
+    for(const auto &run : runs) {
+        if(!first)
+            interp.push_frame(const_pool, code.begin(), code.end(), 1, 4);
+        first = false;
+
+        interp.top_frame->locals[0] = *run.first;
+        auto res = interp.run();
+        ASSERT_FALSE(res.empty());
+        EXPECT_EQ(run.second, res.as_number().value());
+    }
+
+    EXPECT_EQ(4.0, runtime::get_instance(a2)->fields[1].get_num_unchecked());
+    EXPECT_EQ(3.0, runtime::get_instance(b1)->fields[0].get_num_unchecked());
+
+    const auto stats = interp.get_field_cache_stats();
+    EXPECT_EQ(6, stats.misses);
+    EXPECT_EQ(3, stats.hits);
+    EXPECT_EQ(0, stats.monomorphic);
+    EXPECT_EQ(3, stats.polymorphic);
+    EXPECT_EQ(0, stats.megamorphic);
+
+    EXPECT_THROW(runtime::field_cache::resolve(*class_a, 2), std::out_of_range);
+}
+
+TEST(Interp, CallSites)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, "value"s
+    };
+
+    const insn_array insns {
+        // main(this): this.value() + value()
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::fcall, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::ret, 1),
+
+        // Base::value(this)
+        insn_encode(opcode::push, 1),
+        insn_encode(opcode::ret, 1),
+
+        // Derived::value(this)
+        insn_encode(opcode::push, 2),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto base = make_class("Base", { });
+    const auto derived = make_class("Derived", { });
+    const runtime::code_object code(insns);
+    const auto begin = code.begin();
+
+    const std::vector<runtime::function> funcs {
+        { begin, begin + 6, 1, 1, 2, &*base },
+        { begin + 6, begin + 8, 1, 1, 1, &*base },
+        { begin + 8, begin + 10, 1, 1, 1, &*derived }
+    };
+
+    runtime::build_vtable(*base, nullptr, { { "~init", 0 }, { "value", 1 } });
+    runtime::build_vtable(*derived, &*base, { { "~init", 0 }, { "value", 2 } });
+
+    // override takes the slot of the base method
+    EXPECT_EQ(4, derived->funcs_offsets.size());
+    EXPECT_EQ(2, derived->funcs_offsets[1]);
+    EXPECT_EQ(0, derived->funcs_offsets[2]);
+    EXPECT_EQ(3, derived->funcs_map.at("value"));
+
+    // fcall dispatches through the receiver, call by name is static
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp derived_interp(const_pool, funcs, 0,
+            { runtime::make_instance(derived, 0) });
+        derived_interp.set_dispatch_mode(mode);
+        EXPECT_EQ(3.0, derived_interp.run().as_number().value());
+
+        runtime::interp base_interp(const_pool, funcs, 0,
+            { runtime::make_instance(base, 0) });
+        base_interp.set_dispatch_mode(mode);
+        EXPECT_EQ(2.0, base_interp.run().as_number().value());
+
+        const auto stats = base_interp.get_call_cache_stats();
+        EXPECT_EQ(0, stats.hits);
+        EXPECT_EQ(2, stats.misses);
+    }
+
+    EXPECT_THROW(runtime::interp(const_pool, funcs, 0), std::runtime_error);
+}
+
+TEST(Interp, RecursiveCall)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 1.0
+    };
+
+    // sum(this, n): n ? n + this.sum(n - 1) : 0
+    const insn_array insns {
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::brf_false, 9),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::fcall, 0),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::ret, 1),
+        insn_encode(opcode::push, 0),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto cls = make_class("Sum", { });
+    const runtime::code_object code(insns);
+    const std::vector<runtime::function> funcs {
+        { code.begin(), code.end(), 2, 2, 4, &*cls }
+    };
+
+    runtime::build_vtable(*cls, nullptr, { { "sum", 0 } });
+
+    // deep enough to spill the windows over several stack segments
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp interp(const_pool, funcs, 0,
+            { runtime::make_instance(cls, 0), runtime::object(2000.0) });
+        interp.set_dispatch_mode(mode);
+
+        EXPECT_EQ(2001000.0, interp.run().as_number().value());
+        EXPECT_EQ(0, interp.frames_count());
+
+        const auto stats = interp.get_call_cache_stats();
+        EXPECT_EQ(1999, stats.hits);
+        EXPECT_EQ(1, stats.misses);
+    }
+}
+
+static insn_array make_branch_table(bool sealed)
+{
+    // switch(x) { case k0: 10 case k1: 20 default: 0 }
+    insn_array insns {
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push, 5),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push, 3),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::br_table, 2),
+        insn_encode(opcode::push, 0),
+        insn_encode(opcode::ret, 1),
+        insn_encode(opcode::push, 10),
+        insn_encode(opcode::ret, 1),
+        insn_encode(opcode::push, 20),
+        insn_encode(opcode::ret, 1)
+    };
+
+    // the nop in front of br_table keeps the pairs pushed on the stack
+    if(!sealed)
+        insns.insert(insns.begin() + 5, insn_encode(opcode::spec));
+
+    return insns;
+}
+
+TEST(Interp, BranchTable)
+{
+    // of the duplicate keys the last pair in the code wins,
+    // boxed numbers are matched as the unboxed ones
+    const std::vector<std::vector<value_type>> pools {
+        { empty_value, 1.0, 2.0 },
+        { empty_value, 1.5, 1e6 },
+        { empty_value, "one"s, "two"s },
+        { empty_value, 1.0, 1.0 },
+        { empty_value, 1.5, 1.5 },
+        { empty_value, "one"s, "one"s },
+        { empty_value, 1e300, 2.0 },
+        { empty_value, 4611686018427387904.0, 2.0 }
+    };
+
+    const std::vector<std::vector<runtime::object>> values {
+        { 1.0, 2.0, 3.0 },
+        { 1.5, 1e6, 1.0 },
+        { "one", "two", "three" },
+        { 1.0, 2.0, 3.0 },
+        { 1.5, 2.0, 1.0 },
+        { "one", "two", "three" },
+        { 1e300, 2.0, 1e-300 },
+        { std::int64_t(1) << 62, 2.0, 1.0 }
+    };
+
+    const std::vector<std::vector<double>> expected {
+        { 10.0, 20.0, 0.0 },
+        { 10.0, 20.0, 0.0 },
+        { 10.0, 20.0, 0.0 },
+        { 10.0, 0.0, 0.0 },
+        { 10.0, 0.0, 0.0 },
+        { 10.0, 0.0, 0.0 },
+        { 10.0, 20.0, 0.0 },
+        { 10.0, 20.0, 0.0 }
+    };
+
+    for(bool sealed : { true, false }) {
+        const runtime::code_object code(make_branch_table(sealed));
+        EXPECT_EQ(opcode::br_table, code[sealed ? 1 : 6].op);
+        EXPECT_EQ(sealed, 0 != (code[sealed ? 1 : 6].arg & runtime::br_table_sealed));
+
+        for(std::size_t kind = 0; kind < pools.size(); ++kind) {
+            for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+                for(std::size_t idx = 0; idx < 3; ++idx) {
+                    field_interp interp(pools[kind], code.begin(), code.end(), 1, 6);
+                    interp.set_dispatch_mode(mode);
+                    interp.top_frame->locals[0] = values[kind][idx];
+                    EXPECT_EQ(expected[kind][idx], interp.run().as_number().value());
+                }
+            }
+        }
+    }
+}
+
+TEST(Interp, JitCompiledLoop)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 0.0, 1.0, 1000.0
+    };
+
+    // for(i = 1000, acc = 0; i > 0; i = i - 1) acc = acc + i
+    const insn_array insns {
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 3),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::gt),
+        insn_encode(opcode::brf_false, 10),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::load_local, 1),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::brb, 12),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+
+#if defined(EMEL_HAS_JIT)
+    auto native = runtime::jit_compiler::compile(code.begin(), code.end(), 2, 0, const_pool);
+    ASSERT_TRUE(native);
+    EXPECT_LT(0, native->code_size());
+#endif
+
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp interp(const_pool, code.begin(), code.end(), 2, 2);
+        interp.set_dispatch_mode(mode);
+        interp.set_jit_threshold(1);
+
+        auto res = interp.run();
+        EXPECT_EQ(500500.0, res.as_number().value());
+
+#if defined(EMEL_HAS_JIT)
+        const auto stats = interp.get_jit_stats();
+        EXPECT_EQ(1, stats.compiled);
+        EXPECT_EQ(1, stats.native_runs);
+        EXPECT_EQ(0, stats.deopts);
+#endif
+    }
+}
+
+TEST(Interp, JitDeoptimization)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, "string"s, true
+    };
+
+    // strings have no native form, the code leaves
+    // to the interpreter at push_const 1
+    const insn_array insns {
+        insn_encode(opcode::push, 2),
+        insn_encode(opcode::push, 3),
+        insn_encode(opcode::call_op, op_kind::mul),
+        insn_encode(opcode::load_local, 0),
+        insn_encode(opcode::push_const, 2),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::pop),
+        insn_encode(opcode::pop),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const runtime::code_object code(insns);
+
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::interp interp(const_pool, code.begin(), code.end(), 1, 2);
+        interp.set_dispatch_mode(mode);
+        interp.set_jit_threshold(1);
+
+        auto res = interp.run();
+        EXPECT_EQ(6.0, res.as_number().value());
+
+#if defined(EMEL_HAS_JIT)
+        const auto stats = interp.get_jit_stats();
+        EXPECT_EQ(1, stats.compiled);
+        EXPECT_EQ(1, stats.deopts);
+#endif
+    }
+}
+
+TEST(Interp, Profiler)
+{
+    const std::vector<value_type> const_pool {
+        empty_value, 1.0
+    };
+
+    // sum(this, n): n ? n + this.sum(n - 1) : 0
+    const insn_array insns {
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::brf_false, 9),
+        insn_encode(opcode::push_local, 0),
+        insn_encode(opcode::push_const, 1),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::sub),
+        insn_encode(opcode::fcall, 0),
+        insn_encode(opcode::push_local, 1),
+        insn_encode(opcode::call_op, op_kind::add),
+        insn_encode(opcode::ret, 1),
+        insn_encode(opcode::push, 0),
+        insn_encode(opcode::ret, 1)
+    };
+
+    const auto cls = make_class("Sum", { });
+    const runtime::code_object code(insns);
+    const std::vector<runtime::function> funcs {
+        { code.begin(), code.end(), 2, 2, 4, &*cls }
+    };
+
+    runtime::build_vtable(*cls, nullptr, { { "sum", 0 } });
+
+    for(auto mode : { runtime::dispatch_mode::switch_, runtime::dispatch_mode::threaded }) {
+        runtime::profiler prof(code.begin());
+        prof.add_method("Sum.sum", 0, insns.size(), ast::position("sum.emel", 1));
+        prof.add_position(6, ast::position("sum.emel", 2));
+
+        runtime::interp interp(const_pool, funcs, 0,
+            { runtime::make_instance(cls, 0), runtime::object(100.0) });
+        interp.set_dispatch_mode(mode);
+        interp.set_profiler(&prof);
+
+        EXPECT_EQ(5050.0, interp.run().as_number().value());
+        EXPECT_EQ(100, prof.opcode_count(opcode::fcall));
+        EXPECT_EQ(101, prof.opcode_count(opcode::ret));
+        EXPECT_EQ(0, prof.depth());
+
+        const auto profiles = prof.get_method_profiles();
+        ASSERT_EQ(2, profiles.size());
+        EXPECT_EQ("Sum.sum", profiles[0].name);
+        EXPECT_EQ(101, profiles[0].calls);
+        EXPECT_LE(profiles[0].exclusive, profiles[0].inclusive);
+        EXPECT_EQ(0, profiles[1].calls);
+
+        EXPECT_EQ(2, prof.position_of(code.begin() + 7).line);
+        EXPECT_EQ(1, prof.position_of(code.begin() + 2).line);
+    }
+
+    runtime::profiler prof(code.begin());
+    prof.add_method("Sum.sum", 0, insns.size(), ast::position("sum.emel", 1));
+    prof.start_sampling(std::chrono::microseconds(100));
+
+    for(int iter = 0; iter < 1000 && !prof.samples_count(); ++iter) {
+        runtime::interp interp(const_pool, funcs, 0,
+            { runtime::make_instance(cls, 0), runtime::object(1000.0) });
+        interp.set_profiler(&prof);
+        interp.run();
+    }
+
+    prof.stop_sampling();
+    ASSERT_LT(0, prof.samples_count());
+    EXPECT_LE(1, prof.get_sample(0).depth);
+
+    std::ostringstream oss;
+    prof.write_folded(oss);
+    EXPECT_EQ(0, oss.str().find("Sum.sum (sum.emel:"));
+}
@@ -21,6 +21,12 @@
 
 #include <emel/memory/memory.h>
 
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+
 using namespace emel;
 
 using testing::InSequence;
@@ -113,6 +119,174 @@ TEST(Memory, CountedShared)
 	EXPECT_CALL(*p1->get<mock_atomic_counted>(), dtor());
 }
 
+TEST(Memory, CountedBiased)
+{
+	memory::counted_ptr p(memory::make_counted<mock_atomic_counted>(), false);
+	memory::merge_queued_refs();
+
+	// references released by the other threads are queued to the owner
+	memory::counted_ptr copy = p;
+	std::thread([&copy] { copy.reset(); }).join();
+	EXPECT_EQ(2, p->use_count());
+	EXPECT_EQ(1u, memory::merge_queued_refs());
+	EXPECT_TRUE(p->unique());
+
+	EXPECT_CALL(*p->get<mock_atomic_counted>(), dtor());
+}
+
+TEST(Memory, CountedBiasedShared)
+{
+	memory::counted_ptr p(memory::make_counted<mock_atomic_counted>(), false);
+	EXPECT_CALL(*p->get<mock_atomic_counted>(), dtor());
+
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t)
+		threads.emplace_back([copy = p]() mutable {
+			for(int idx = 0; idx < 10000; ++idx)
+				memory::counted_ptr(copy).swap(copy);
+			copy.reset();
+		});
+
+	for(int idx = 0; idx < 10000; ++idx)
+		memory::counted_ptr(p).swap(p);
+
+	for(auto &t : threads)
+		t.join();
+
+	memory::merge_queued_refs();
+	EXPECT_TRUE(p->unique());
+}
+
+TEST(Memory, CountedOwnerExit)
+{
+	memory::counted_ptr p;
+	std::thread([&p] {
+		p.reset(memory::make_counted<mock_atomic_counted>(), false);
+		memory::counted_ptr copy = p;
+	}).join();
+
+	// merged by the releasing thread
+	EXPECT_TRUE(p->unique());
+	EXPECT_CALL(*p->get<mock_atomic_counted>(), dtor());
+	p.reset();
+}
+
+TEST(Memory, CountedAlignment)
+{
+	struct odd_size { char bytes[40]; };
+
+	// type::rep keeps its tags in the low bits of the pointers
+	for(int t = memory::default_pool; t < memory::last_source_type; ++t) {
+		auto *const source = memory::get_source(memory::source_type(t));
+		std::vector<memory::counted_ptr> objects;
+
+		for(int idx = 0; idx < 16; ++idx) {
+			objects.emplace_back(memory::allocate_counted<char>(rt_allocator<char>(source), 'x'), false);
+			objects.emplace_back(memory::allocate_counted<odd_size>(rt_allocator<odd_size>(source)), false);
+		}
+
+		for(const auto &p : objects)
+			EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p.get()) % memory::counted_alignment) << t;
+	}
+}
+
+TEST(Memory, SlabPool)
+{
+	auto *const source = memory::get_source(memory::slab_pool);
+	const auto slab_of = [](void *ptr) {
+		return reinterpret_cast<std::uintptr_t>(ptr) & ~std::uintptr_t(64 * 1024 - 1);
+	};
+
+	// blocks outlive the thread and are freed by another one
+	std::vector<void *> blocks;
+	std::thread([&] {
+		for(int idx = 0; idx < 10000; ++idx)
+			blocks.push_back(source->allocate(48, 16));
+	}).join();
+
+	std::set<std::uintptr_t> slabs;
+	for(void *ptr : blocks) {
+		slabs.insert(slab_of(ptr));
+		source->deallocate(ptr, 48, 16);
+	}
+
+	// slabs of the exited thread are adopted by the next one
+	std::thread([&] {
+		for(int idx = 0; idx < 10000; ++idx) {
+			void *const ptr = source->allocate(40, 16);
+			EXPECT_EQ(1u, slabs.count(slab_of(ptr)));
+			blocks[std::size_t(idx)] = ptr;
+		}
+
+		for(void *ptr : blocks)
+			source->deallocate(ptr, 40, 16);
+	}).join();
+
+	// size classes and large blocks
+	for(std::size_t size : { 1, 16, 17, 100, 2048, 2049, 100000 }) {
+		void *const ptr = source->allocate(size, 16);
+		EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(ptr) % 16) << size;
+		std::memset(ptr, 0xab, size);
+		source->deallocate(ptr, size, 16);
+	}
+
+	// the last reference may be released by another thread
+	memory::counted_ptr obj(memory::allocate_counted<std::string>(
+		rt_allocator<std::string>(source), "shared"), false);
+	std::thread t([obj] { EXPECT_EQ("shared", *obj->get<std::string>()); });
+	obj.reset();
+	t.join();
+}
+
+TEST(Memory, Region)
+{
+	memory::counted_ptr escaped;
+	std::unique_ptr<std::vector<int, rt_allocator<int>>> grown;
+	auto *const global = memory::get_source();
+
+	{
+		memory::region scope;
+		auto *const source = memory::get_source();
+		EXPECT_EQ(memory::region::current_source(), source);
+		EXPECT_NE(global, source);
+		EXPECT_EQ(global, memory::get_global_source());
+
+		for(int idx = 0; idx < 10000; ++idx) {
+			memory::counted_ptr tmp(memory::make_counted<std::uint64_t>(idx), false);
+			EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(tmp.get()) % memory::counted_alignment);
+		}
+		EXPECT_EQ(0u, scope.live_blocks());
+
+		// larger blocks have chunks of their own
+		void *const ptr = source->allocate(100000, 64);
+		EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(ptr) % 64);
+		std::memset(ptr, 0xab, 100000);
+		source->deallocate(ptr, 100000, 64);
+
+		escaped.reset(memory::make_counted<std::string>("escaped"), false);
+		EXPECT_EQ(1u, scope.live_blocks());
+
+		{
+			memory::region inner;
+			grown.reset(new std::vector<int, rt_allocator<int>>(16, 42, rt_allocator<int>(memory::get_source())));
+			EXPECT_EQ(1u, inner.live_blocks());
+		}
+
+		EXPECT_EQ(source, memory::get_source());
+	}
+
+	EXPECT_EQ(nullptr, memory::region::current_source());
+	EXPECT_EQ(global, memory::get_source());
+
+	// escaped objects stay, containers keep growing out of the region
+	EXPECT_EQ("escaped", *escaped->get<std::string>());
+	grown->resize(100000, 42);
+	EXPECT_EQ(100000, std::count(grown->begin(), grown->end(), 42));
+
+	// the last reference may be released by another thread
+	std::thread([&escaped] { escaped.reset(); }).join();
+}
+
 TEST(Memory, GC)
 {
 	auto stat = memory::get_collectable_memory_usage();
@@ -276,6 +450,49 @@ TEST(Memory, CollectedShared)
 	EXPECT_CALL(*p1->get<mock_atomic_counted>(), dtor());
 }
 
+TEST(Memory, CollectedNursery)
+{
+	memory::collect_nursery(true);
+	const auto before = memory::get_nursery_stats();
+
+	// temporaries die young and never get finalizers
+	for(int idx = 0; idx < 10000; ++idx)
+		memory::counted_ptr(memory::make_collectable<std::uint64_t>(idx), false);
+
+	memory::counted_ptr p(memory::make_collectable<mock_atomic_counted>(), false);
+	EXPECT_EQ(2, p->weak_count());
+	EXPECT_EQ(1u, memory::collect_nursery(true));
+
+	const auto after = memory::get_nursery_stats();
+	EXPECT_EQ(10000u, after.nr_died_young - before.nr_died_young);
+	EXPECT_EQ(1u, after.nr_promoted - before.nr_promoted);
+	EXPECT_LE(3u, after.nr_collections - before.nr_collections);
+	EXPECT_LE(after.max_pause, after.total_pause);
+
+	// the finalizer holds the weak reference of the nursery now
+	EXPECT_EQ(2, p->weak_count());
+	EXPECT_CALL(*p->get<mock_atomic_counted>(), dtor());
+}
+
+TEST(Memory, CollectedRemembered)
+{
+	memory::collect_nursery(true);
+
+	memory::counted_ptr p1(memory::make_collectable<int>(1), false);
+	memory::counted_ptr p2(memory::make_collectable<int>(2), false);
+
+	// stores to the stack aren't remembered
+	void *local_slot = nullptr;
+	std::unique_ptr<void *> heap_slot(new void *(nullptr));
+	memory::record_store(&local_slot, p1.get());
+	memory::record_store(heap_slot.get(), p2.get());
+
+	// p2 is promoted at once, p1 after it outlives the nursery age
+	EXPECT_EQ(1u, memory::collect_nursery());
+	EXPECT_EQ(1u, memory::collect_nursery());
+	EXPECT_EQ(0u, memory::collect_nursery());
+}
+
 TEST(Memory, CollectedShouldCollectCyclicRefs)
 {
 	InSequence seq;
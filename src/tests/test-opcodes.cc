@@ -36,3 +36,23 @@ TEST(OpCodes, EncodeDecode)
     EXPECT_EQ(op2, pair.first);
     EXPECT_EQ(65535, pair.second);
 }
+
+TEST(OpCodes, FusedArgs)
+{
+    auto arg = fused_arg::make(op_kind::sub, 1234);
+    EXPECT_EQ(op_kind::sub, fused_arg::kind(arg));
+    EXPECT_EQ(1234, fused_arg::operand(arg));
+
+    arg = fused_arg::make(op_kind::not_, 7);
+    EXPECT_EQ(op_kind::not_, fused_arg::kind(arg));
+    EXPECT_EQ(7, fused_arg::operand(arg));
+
+    arg = fused_arg::make(op_kind::div, 2047, 4095);
+    EXPECT_EQ(op_kind::div, fused_arg::kind(arg));
+    EXPECT_EQ(2047, fused_arg::store_operand(arg));
+    EXPECT_EQ(4095, fused_arg::store_target(arg));
+
+    auto pair = insn_decode(insn_encode(opcode::call_op_store, arg));
+    EXPECT_EQ(opcode::call_op_store, pair.first);
+    EXPECT_EQ(arg, pair.second);
+}
@@ -19,14 +19,55 @@
  */
 #include <gmock/gmock.h>
 
+#include <boost/container/pmr/global_resource.hpp>
+
+#include <emel/type-system/context.h>
+#include <emel/type-system/map-data.h>
+#include <emel/type-system/nan-box.h>
+#include <emel/type-system/str-kernels.h>
 #include <emel/type-system/type.h>
 
+#include <atomic>
+#include <cmath>
+#include <codecvt>
+#include <limits>
+#include <locale>
+#include <thread>
+
 using namespace emel;
 
 using testing::IsEmpty;
 using testing::SizeIs;
+using testing::ElementsAre;
 using testing::ElementsAreArray;
 
+/// Counts the allocations of the default memory source while it's alive
+class counting_resource : public memory::resource_type
+{
+public:
+	counting_resource()
+		: upstream(boost::container::pmr::set_default_resource(this)) { }
+	~counting_resource() { boost::container::pmr::set_default_resource(upstream); }
+
+	std::size_t nr_allocations = 0;
+
+private:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+		++nr_allocations;
+		return upstream->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+		upstream->deallocate(ptr, bytes, alignment);
+	}
+
+	bool do_is_equal(const memory::resource_type &other) const noexcept override {
+		return this == &other;
+	}
+
+	memory::resource_type *const upstream;
+};
+
 TEST(TypeRep, None)
 {
 	type::rep v;
@@ -261,6 +302,38 @@ TEST(TypeRep, Num)
 	EXPECT_EQ(nullptr, ptr);
 }
 
+TEST(TypeRep, InlineAccessors)
+{
+	for(double value : { 0.0, -0.0, 1.5, -2.25, 1e300, -1e-300, 123456789.0 }) {
+		type::rep v(value);
+		if(!v.is_local_num())
+			continue;
+		EXPECT_FALSE(v.is_local_int());
+		EXPECT_FALSE(v.is_bool());
+		EXPECT_EQ(value, v.local_num());
+	}
+
+	for(std::int64_t value : { 0L, 1L, -1L, 42L, -100000L }) {
+		type::rep v(value);
+		ASSERT_TRUE(v.is_local_int());
+		EXPECT_FALSE(v.is_local_num());
+		EXPECT_FALSE(v.is_bool());
+		EXPECT_EQ(value, v.local_int());
+	}
+
+	type::rep t(true), f(false), none, str("abc");
+	EXPECT_TRUE(t.is_bool());
+	EXPECT_TRUE(f.is_bool());
+	EXPECT_TRUE(t.local_bool());
+	EXPECT_FALSE(f.local_bool());
+	EXPECT_FALSE(none.is_bool());
+	EXPECT_FALSE(none.is_local_num());
+	EXPECT_FALSE(none.is_local_int());
+	EXPECT_FALSE(str.is_bool());
+	EXPECT_FALSE(str.is_local_num());
+	EXPECT_FALSE(str.is_local_int());
+}
+
 TEST(TypeRep, Str)
 {
 	type::rep v("a1ёЫ");
@@ -338,6 +411,180 @@ TEST(TypeRep, Str)
 	EXPECT_EQ(nullptr, ptr);
 }
 
+TEST(TypeRep, StrConcat)
+{
+	const type::rep hello("hello, ");
+	const type::rep world("это было в жаркий июльский день");
+
+	// short results stay flat
+	type::rep v = string_data::concat(type::rep("ab"), type::rep("cd"));
+	EXPECT_FALSE(v.get_type()->is_counted());
+	EXPECT_EQ("abcd", v.get_str_unchecked());
+
+	v = string_data::concat(hello, world);
+	ASSERT_TRUE(v.is_counted_str());
+	auto *sd = v.get_counted_unchecked()->get<string_data>();
+	EXPECT_TRUE(sd->is_concat());
+	EXPECT_FALSE(sd->is_flattened());
+	EXPECT_EQ(38, v.get_type()->size(v));
+
+	EXPECT_EQ("hello, это было в жаркий июльский день", v.get_type()->get_str(v));
+	EXPECT_TRUE(sd->is_flattened());
+	EXPECT_EQ(sd->view().data(), str_view(v).data());
+	EXPECT_EQ(38, v.get_type()->size(v));
+
+	EXPECT_EQ(v.get_counted_unchecked(), string_data::concat(v, type::rep("")).get_counted_unchecked());
+
+	// a long chain is flattened and released without recursion
+	std::string expected;
+	type::rep acc("");
+	for(int idx = 0; idx < 100000; ++idx) {
+		acc = string_data::concat(acc, type::rep("xy"));
+		expected += "xy";
+	}
+
+	EXPECT_EQ(200000, acc.get_type()->size(acc));
+	sd = acc.get_counted_unchecked()->get<string_data>();
+	EXPECT_TRUE(sd->is_concat());
+
+	type::rep ch = acc.get_type()->at(acc, 1);
+	EXPECT_EQ("y", ch.get_str_unchecked());
+	EXPECT_EQ(expected, acc.get_type()->get_str(acc));
+
+	acc = string_data::concat(acc, acc);
+	acc.clear();
+
+	EXPECT_THROW(string_data::concat(hello, type::rep(1.0)), std::invalid_argument);
+}
+
+TEST(TypeRep, StrConcatShared)
+{
+	type::rep v("");
+	for(int idx = 0; idx < 1000; ++idx)
+		v = string_data::concat(v, type::rep("жаркий июль "));
+
+	const auto *const sd = v.get_counted_unchecked()->get<string_data>();
+	ASSERT_FALSE(sd->is_flattened());
+
+	// readers of the shared str flatten it concurrently
+	std::atomic<int> mismatches { 0 };
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t)
+		threads.emplace_back([&v, &mismatches] {
+			const type::rep ch = v.get_type()->at(v, 12 * 999 + 7);
+			if("и" != ch.get_type()->get_str(ch) || 22 * 1000 != str_view(v).size())
+				++mismatches;
+		});
+
+	for(auto &t : threads)
+		t.join();
+
+	EXPECT_EQ(0, mismatches);
+	EXPECT_TRUE(sd->is_flattened());
+	EXPECT_EQ(str_view(v).data(), sd->view().data());
+}
+
+TEST(TypeRep, StrUtf8)
+{
+	const std::string text = "это было в жаркий июльский день, когда болота горят";
+	const type::rep v(text);
+	ASSERT_TRUE(v.is_counted_str());
+
+	const auto *const sd = v.get_counted_unchecked()->get<string_data>();
+	EXPECT_FALSE(sd->ascii);
+	EXPECT_EQ(text.size(), sd->bytes);
+
+	std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> converter;
+	const std::u32string chars = converter.from_bytes(text);
+	ASSERT_EQ(chars.size(), v.get_type()->size(v));
+
+	// found on construction, before the storage can be shared
+	EXPECT_EQ((chars.size() - 1) / string_data::offsets_step + 1, sd->offsets.size());
+
+	// past several cached offsets
+	for(std::size_t idx = chars.size(); idx--; ) {
+		const type::rep ch = v.get_type()->at(v, idx);
+		EXPECT_EQ(converter.to_bytes(chars[idx]), ch.get_type()->get_str(ch));
+	}
+
+	EXPECT_THROW(v.get_type()->at(v, chars.size()), std::out_of_range);
+
+	const type::rep a("plain ascii text longer than a local rep");
+	const auto *const ascii = a.get_counted_unchecked()->get<string_data>();
+	EXPECT_TRUE(ascii->ascii);
+	EXPECT_TRUE(ascii->offsets.empty());
+	const type::rep x = a.get_type()->at(a, 14);
+	EXPECT_EQ("x", x.get_type()->get_str(x));
+	EXPECT_EQ(ascii->u.data(), ascii->view().data());
+	EXPECT_EQ("plain ascii text longer than a local rep", ascii->view());
+
+	// local strings count code points as well
+	const type::rep local("ёЫz");
+	EXPECT_EQ(3, local.get_type()->size(local));
+	const type::rep ch = local.get_type()->at(local, 1);
+	EXPECT_EQ("Ы", ch.get_type()->get_str(ch));
+}
+
+TEST(TypeRep, StrInterning)
+{
+	const std::string literal = "a literal longer than a local rep";
+	const type::rep a = string_data::intern(literal.data(), literal.size());
+	const type::rep b = string_data::intern(literal.data(), literal.size());
+
+	ASSERT_TRUE(a.is_counted_str());
+	EXPECT_EQ(a.get_counted_unchecked(), b.get_counted_unchecked());
+	EXPECT_EQ(literal, a.get_type()->get_str(a));
+
+	// local strings need no storage, long ones aren't interned
+	EXPECT_FALSE(string_data::intern("short", 5).is_counted_str());
+
+	const std::string text(string_data::max_interned_length + 1, 'x');
+	const type::rep c = string_data::intern(text.data(), text.size());
+	const type::rep d = string_data::intern(text.data(), text.size());
+	EXPECT_NE(c.get_counted_unchecked(), d.get_counted_unchecked());
+}
+
+TEST(TypeRep, StrKernels)
+{
+	const str_kernels &simd = str_kernels::get(), &scalar = str_kernels::scalar();
+
+	// lengths around the vector widths
+	for(std::size_t len = 0; len < 100; ++len) {
+		std::string a;
+		for(std::size_t idx = 0; idx < len; ++idx)
+			a += char('a' + idx % 3);
+
+		EXPECT_EQ(scalar.hash(a.data(), len), simd.hash(a.data(), len)) << len;
+
+		for(std::size_t diff = 0; diff < len; ++diff) {
+			std::string b = a;
+			b[diff] = 'z';
+			EXPECT_EQ(diff, simd.mismatch(a.data(), b.data(), len));
+			EXPECT_EQ(diff, scalar.mismatch(a.data(), b.data(), len));
+		}
+
+		for(const std::string needle : { "", "a", "ab", "cab", "abcabca", "abd" }) {
+			const std::size_t expected = a.find(needle);
+			const std::size_t pos = std::string::npos == expected ? str_kernels::npos : expected;
+			EXPECT_EQ(pos, simd.find(a.data(), len, needle.data(), needle.size())) << len << needle;
+			EXPECT_EQ(pos, scalar.find(a.data(), len, needle.data(), needle.size())) << len << needle;
+		}
+	}
+
+	EXPECT_EQ(0xe3069283, str_hash("123456789"));
+
+	// bytes are unsigned, UTF-8 is ordered by code points
+	EXPECT_GT(0, str_compare("z", "ё"));
+	EXPECT_GT(0, str_compare("ab", "abc"));
+	EXPECT_EQ(0, str_compare("abc", "abc"));
+
+	// local and non-local reps are viewed in place
+	const type::rep local("abc"), counted("abc, but longer than a local rep");
+	EXPECT_EQ("abc", str_view(local));
+	EXPECT_EQ(counted.get_counted_unchecked()->get<string_data>()->u.data(), str_view(counted).data());
+	EXPECT_EQ(0, str_find(str_view(counted), str_view(local)));
+}
+
 TEST(TypeRep, DISABLED_Arr)
 {
 	type::rep v(std::vector<type::rep> { 1L, 2L, 3L });
@@ -385,6 +632,319 @@ TEST(TypeRep, DISABLED_Arr)
 	}
 }
 
+TEST(TypeRep, ArrTyped)
+{
+	using layout = array_data::layout;
+
+	const type::rep nums(std::vector<type::rep> { 0.5, 1.5, 2.5, 3.5, 4.5 });
+	auto *const nd = nums.get_counted_unchecked()->get<array_data>();
+	ASSERT_EQ(layout::nums, nd->kind);
+	EXPECT_TRUE(nd->a.empty());
+	EXPECT_EQ(12.5, nd->sum().local_num());
+
+	nd->map(op_kind::mul, 2.0);
+	EXPECT_THAT(nd->nums, ElementsAre(1.0, 3.0, 5.0, 7.0, 9.0));
+
+	const type::rep mask = nd->compare(op_kind::gt, std::int64_t(4));
+	auto *const md = mask.get_counted_unchecked()->get<array_data>();
+	EXPECT_EQ(layout::bools, md->kind);
+	EXPECT_THAT(md->bools, ElementsAre(0, 0, 1, 1, 1));
+	EXPECT_EQ(3, md->sum().local_int());
+	EXPECT_TRUE(md->at(2).local_bool());
+
+	// ints continue in doubles on division and overflow
+	const type::rep ints(std::vector<type::rep> { 1L, 2L, 3L });
+	auto *const id = ints.get_counted_unchecked()->get<array_data>();
+	ASSERT_EQ(layout::ints, id->kind);
+	id->map(op_kind::add, std::int64_t(10));
+	EXPECT_THAT(id->ints, ElementsAre(11, 12, 13));
+	EXPECT_EQ(36, id->sum().local_int());
+	id->map(op_kind::div, std::int64_t(2));
+	EXPECT_EQ(layout::nums, id->kind);
+	EXPECT_THAT(id->nums, ElementsAre(5.5, 6.0, 6.5));
+
+	const type::rep big(std::vector<type::rep> { std::int64_t(1) << 59, 1L });
+	auto *const bd = big.get_counted_unchecked()->get<array_data>();
+	bd->map(op_kind::mul, std::int64_t(1) << 10);
+	EXPECT_EQ(layout::nums, bd->kind);
+	EXPECT_EQ(std::ldexp(1.0, 69), bd->nums[0]);
+
+	// a heterogeneous element makes the array generic
+	const type::rep str("abc");
+	nd->set(1, str);
+	EXPECT_EQ(layout::generic, nd->kind);
+	EXPECT_TRUE(nd->nums.empty());
+	ASSERT_EQ(5, nd->size());
+	EXPECT_EQ(1.0, nd->at(0).local_num());
+	EXPECT_EQ("abc", nd->at(1).get_type()->get_str(nd->at(1)));
+	EXPECT_THROW(nd->sum(), std::invalid_argument);
+
+	// filling gives the layout of the value back
+	nd->fill(true);
+	EXPECT_EQ(layout::bools, nd->kind);
+	EXPECT_EQ(5, nd->sum().local_int());
+	EXPECT_THROW(nd->map(op_kind::add, 1.0), std::invalid_argument);
+
+	const type::rep mixed(std::vector<type::rep> { 1L, 2.5 });
+	auto *const xd = mixed.get_counted_unchecked()->get<array_data>();
+	EXPECT_EQ(layout::generic, xd->kind);
+	EXPECT_EQ(3.5, xd->sum().local_num());
+	EXPECT_THAT(mixed.get_type()->get_arr(mixed), SizeIs(2));
+}
+
+// passes the array by value through @a depth calls
+static void pass_by_value(type::rep arr, int depth,
+	const memory::atomic_counted *&storage, std::int32_t &use_count)
+{
+	if(depth)
+		return pass_by_value(arr, depth - 1, storage, use_count);
+
+	storage = arr.get_counted_unchecked();
+	use_count = storage->use_count();
+}
+
+TEST(TypeRep, ArrCopyOnWrite)
+{
+	const type::rep arr(std::vector<type::rep>(1000000, type::rep(1.5)));
+	auto *const storage = arr.get_counted_unchecked();
+
+	// the array and a copy on each level of calls
+	const memory::atomic_counted *seen = nullptr;
+	std::int32_t use_count = 0;
+	pass_by_value(arr, 10, seen, use_count);
+	EXPECT_EQ(storage, seen);
+	EXPECT_EQ(12, use_count);
+	EXPECT_TRUE(storage->unique());
+
+	// the first mutation of a copy clones the storage
+	type::rep copy = arr;
+	EXPECT_EQ(2, storage->use_count());
+	array_data *const own = detach_arr(copy);
+	EXPECT_NE(storage, copy.get_counted_unchecked());
+	EXPECT_TRUE(storage->unique());
+	EXPECT_EQ(array_data::layout::nums, own->kind);
+
+	own->set(0, 2.5);
+	EXPECT_EQ(1.5, storage->get<array_data>()->at(0).local_num());
+	EXPECT_EQ(2.5, own->at(0).local_num());
+
+	// unique storage is mutated in place
+	EXPECT_EQ(own, detach_arr(copy));
+
+	const type::rep mixed(std::vector<type::rep> { 1L, type::rep("abc") });
+	type::rep mixed_copy = mixed;
+	array_data *const mixed_own = detach_arr(mixed_copy);
+	mixed_own->push_back(2.5);
+	EXPECT_EQ(2, mixed.get_type()->size(mixed));
+	ASSERT_EQ(3, mixed_own->size());
+	EXPECT_EQ("abc", mixed_own->at(1).get_type()->get_str(mixed_own->at(1)));
+}
+
+TEST(TypeRep, Map)
+{
+	type::rep m = make_map();
+	ASSERT_TRUE(m.is_ptr());
+	EXPECT_EQ(type::map, m.get_type()->get_kind());
+	EXPECT_TRUE(m.get_type()->empty(m));
+
+	map_data *const md = get_map(m);
+	ASSERT_NE(nullptr, md);
+	EXPECT_EQ(nullptr, get_map(type::rep(1L)));
+
+	// numbers are equal keys by their values
+	md->set(1L, type::rep("one"));
+	md->set(0.0, type::rep("zero"));
+	ASSERT_NE(nullptr, md->find(1.0));
+	EXPECT_EQ("one", md->find(1.0)->get_type()->get_str(*md->find(1.0)));
+	ASSERT_NE(nullptr, md->find(-0.0));
+	EXPECT_EQ(nullptr, md->find(2L));
+	EXPECT_THROW(md->set(std::nan(""), 1L), std::invalid_argument);
+
+	// local and counted strings are equal keys by their bytes
+	const std::string long_key(64, 'k');
+	md->set(type::rep("abc"), 1L);
+	md->set(type::rep(long_key), 2L);
+	ASSERT_NE(nullptr, md->find(type::rep(std::string("abc"))));
+	ASSERT_NE(nullptr, md->find(type::rep(long_key)));
+	EXPECT_EQ(2L, md->find(type::rep(long_key))->local_int());
+	EXPECT_EQ(nullptr, md->find(type::rep("abd")));
+
+	md->set(type::rep("abc"), 3L);
+	EXPECT_EQ(3L, md->find(type::rep("abc"))->local_int());
+	EXPECT_EQ(4, m.get_type()->size(m));
+
+	EXPECT_TRUE(md->erase(0L));
+	EXPECT_FALSE(md->erase(0L));
+	EXPECT_EQ(nullptr, md->find(0L));
+	EXPECT_EQ(3, md->size());
+
+	// growth keeps all of the items
+	for(long idx = 0; idx < 10000; ++idx)
+		md->set(idx + 100, idx);
+	for(long idx = 0; idx < 10000; idx += 2)
+		EXPECT_TRUE(md->erase(idx + 100));
+	EXPECT_EQ(5003, md->size());
+	EXPECT_GE(md->capacity() * 7 / 8, md->size());
+
+	std::size_t found = 0;
+	for(long idx = 0; idx < 10000; ++idx) {
+		const type::rep *const value = md->find(idx + 100);
+		if(idx % 2)
+			found += (value && idx == value->local_int());
+		else
+			EXPECT_EQ(nullptr, value);
+	}
+	EXPECT_EQ(5000, found);
+
+	std::size_t visited = 0;
+	md->for_each([&](const type::rep &, const type::rep &) { ++visited; });
+	EXPECT_EQ(md->size(), visited);
+
+	// copies share the table until the first mutation
+	type::rep copy = m;
+	EXPECT_EQ(2, m.get_counted_unchecked()->use_count());
+	map_data *const own = detach_map(copy);
+	EXPECT_NE(md, own);
+	EXPECT_TRUE(m.get_counted_unchecked()->unique());
+
+	own->set(1L, 42L);
+	EXPECT_EQ("one", md->find(1L)->get_type()->get_str(*md->find(1L)));
+	EXPECT_EQ(42L, own->find(1L)->local_int());
+	EXPECT_EQ(own, detach_map(copy));
+}
+
+TEST(TypeRep, TypeOps)
+{
+	const std::vector<type::rep> reps {
+		type::rep(), true, false, 0L, -7L, 42L, 0.0, -2.5, 1e6,
+		type::rep("abc"), type::rep(std::string(32, 'x')),
+		type::rep(std::vector<type::rep> { 1L, 2L }), make_map()
+	};
+
+	// the table agrees with the types of the reps
+	for(const auto &r : reps) {
+		const type *const t = r.get_type();
+		const type_ops &ops = r.ops();
+		EXPECT_EQ(t->get_kind(), r.get_kind());
+		EXPECT_EQ(t->is_counted(), ops.counted);
+		if(type::ptr != ops.kind) {
+			EXPECT_EQ(t->get_kind(), ops.kind);
+		}
+
+		EXPECT_EQ(t->get_bool(r), ops.get_bool(r));
+		EXPECT_EQ(t->get_str(r), ops.get_str(r));
+		EXPECT_EQ(t->empty(r), ops.empty(r));
+		EXPECT_EQ(t->size(r), ops.size(r));
+		if(type::str != t->get_kind()) {
+			EXPECT_EQ(t->get_int(r), ops.get_int(r));
+			EXPECT_EQ(t->get_num(r), ops.get_num(r));
+		}
+	}
+
+	EXPECT_EQ(type::rep::nr_tags - 1, type::rep().tag());
+	EXPECT_EQ(type::map, make_map().get_kind());
+	EXPECT_EQ(type::bool_, type::rep(true).get_kind());
+	EXPECT_EQ(type::str, type::rep("").get_kind());
+}
+
+TEST(TypeRep, BoxedCache)
+{
+	// outlives the reps of the test, the boxes of the cache are never freed
+	counting_resource counting;
+	const auto &nr_allocations = counting.nr_allocations;
+
+	// common constants are unboxed and never allocate
+	std::size_t before = nr_allocations;
+	{
+		const type::rep values[] {
+			0L, 1L, -1L, 255L, 0.0, 1.0, -1.0, 0.5, true, false, type::rep("")
+		};
+		for(const auto &r : values) {
+			type::rep copy = r;
+			EXPECT_FALSE(copy.ops().counted);
+		}
+	}
+	EXPECT_EQ(before, nr_allocations);
+	const type::rep counted("longer than a local str");
+	EXPECT_LT(before, nr_allocations);
+
+	// boxed values are shared after the first one
+	const std::int64_t big = std::numeric_limits<std::int64_t>::max();
+	const type::rep i1(big);
+	before = nr_allocations;
+	const type::rep i2(big), i3 = type::rep(big);
+	EXPECT_EQ(before, nr_allocations);
+	EXPECT_EQ(i1.get_counted_unchecked(), i2.get_counted_unchecked());
+	EXPECT_EQ(i1.get_counted_unchecked(), i3.get_counted_unchecked());
+
+	std::int64_t integer = 0;
+	EXPECT_EQ(type::int_, i2.get_kind());
+	EXPECT_TRUE(i2.get(integer));
+	EXPECT_EQ(big, integer);
+	EXPECT_EQ(big, i2.get_type()->get_int(i2));
+
+	const type::rep n1(1e300);
+	before = nr_allocations;
+	const type::rep n2(1e300);
+	EXPECT_EQ(before, nr_allocations);
+	EXPECT_EQ(n1.get_counted_unchecked(), n2.get_counted_unchecked());
+
+	double number = 0;
+	EXPECT_EQ(type::num, n2.get_kind());
+	EXPECT_TRUE(n2.get(number));
+	EXPECT_EQ(1e300, number);
+	EXPECT_EQ(1e300, n2.ops().get_num(n2));
+
+	// boxed numbers are equal map keys by their values
+	type::rep m = make_map();
+	get_map(m)->set(n1, 1L);
+	get_map(m)->set(big, 2L);
+	ASSERT_NE(nullptr, get_map(m)->find(type::rep(1e300)));
+	ASSERT_NE(nullptr, get_map(m)->find(type::rep(big)));
+	EXPECT_EQ(nullptr, get_map(m)->find(type::rep(big - 1)));
+}
+
+TEST(TypeRep, NanBox)
+{
+	// every double is stored losslessly, including the boxed ones of rep
+	const double nums[] {
+		0.0, -0.0, 1.0, -1.5, 1e300, -1e-300, std::numeric_limits<double>::max(),
+		std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::infinity(),
+		-std::numeric_limits<double>::infinity(), 0.1 + 0.2
+	};
+
+	for(const double num : nums) {
+		const nan_box b(num);
+		ASSERT_TRUE(b.is_num());
+		EXPECT_FALSE(b.is_int() || b.is_bool() || b.is_none() || b.is_ptr());
+		std::uint64_t bits;
+		std::memcpy(&bits, &num, sizeof bits);
+		EXPECT_EQ(bits, b.raw());
+	}
+
+	const nan_box nan(-std::nan(""));
+	ASSERT_TRUE(nan.is_num());
+	EXPECT_TRUE(std::isnan(nan.as_num()));
+
+	for(const std::int64_t value : { std::int64_t(0), std::int64_t(-1), nan_box::min_int, nan_box::max_int }) {
+		const nan_box b(value);
+		ASSERT_TRUE(b.is_int());
+		EXPECT_FALSE(b.is_num());
+		EXPECT_EQ(value, b.as_int());
+	}
+	EXPECT_FALSE(nan_box::fits(nan_box::max_int + 1));
+
+	EXPECT_TRUE(nan_box().is_none());
+	EXPECT_TRUE(nan_box(true).is_bool());
+	EXPECT_TRUE(nan_box(true).as_bool());
+	EXPECT_FALSE(nan_box(false).as_bool());
+
+	const type::rep arr(std::vector<type::rep> { 1L });
+	const nan_box ptr(arr.get_counted_unchecked());
+	ASSERT_TRUE(ptr.is_ptr());
+	EXPECT_EQ(arr.get_counted_unchecked(), ptr.as_ptr());
+}
+
 TEST(TypeRep, DISABLED_Ptr)
 {
 	type::rep v(reinterpret_cast<void *>(0x10247890));